@@ -0,0 +1,164 @@
+/*! \file */
+
+#ifndef _BINARY_KEY_HH
+#define _BINARY_KEY_HH
+
+#include <cstring>
+#include <functional>
+#include <stdint.h>
+#if defined(__SSE2__)
+#  include <immintrin.h>
+#endif
+
+#include "city_hasher.hh"
+
+/*! BinaryKeyEqual compares fixed-size binary keys of 16 or 32 bytes, such
+ *  as UUIDs, IPv6 addresses or digests stored in a std::array<uint8_t, 16>
+ *  or a \ref binary_key, by their bytes. A 16-byte key is compared with one
+ *  SSE2 load and compare per key, and a 32-byte key with one AVX2 load and
+ *  compare when the code is compiled for AVX2, or two SSE2 ones otherwise.
+ *  Key must be trivially copyable, and its bytes must all be significant,
+ *  so it can't have padding. */
+template <class Key>
+class BinaryKeyEqual {
+    static_assert(sizeof(Key) == 16 || sizeof(Key) == 32,
+                  "BinaryKeyEqual only compares 16- and 32-byte keys");
+
+public:
+    bool operator()(const Key& a, const Key& b) const {
+        return equal(reinterpret_cast<const char*>(&a),
+                     reinterpret_cast<const char*>(&b));
+    }
+
+private:
+    // The loads are unaligned, since std::array keys are only byte aligned.
+    // They cost the same as aligned loads when the key doesn't cross a cache
+    // line, which binary_key guarantees.
+    static inline bool equal(const char* a, const char* b) {
+#if defined(__AVX2__)
+        if (sizeof(Key) == 32) {
+            const __m256i x = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(a));
+            const __m256i y = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(b));
+            return _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) == -1;
+        }
+#endif
+#if defined(__SSE2__)
+        __m128i eq = _mm_cmpeq_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(a)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(b)));
+        if (sizeof(Key) == 32) {
+            eq = _mm_and_si128(eq, _mm_cmpeq_epi8(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 16)),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 16))));
+        }
+        return _mm_movemask_epi8(eq) == 0xffff;
+#else
+        uint64_t diff = 0;
+        for (size_t i = 0; i < sizeof(Key); i += 8) {
+            uint64_t x, y;
+            memcpy(&x, a + i, sizeof(x));
+            memcpy(&y, b + i, sizeof(y));
+            diff |= x ^ y;
+        }
+        return diff == 0;
+#endif
+    }
+};
+
+/*! BinaryKeyHasher hashes fixed-size binary keys of 16 or 32 bytes, the
+ *  same keys \ref BinaryKeyEqual compares. It reads the key as 64-bit
+ *  words and mixes each pair of them with one 64x64 to 128-bit multiply
+ *  whose halves are folded together and added to the pair, so a word
+ *  that cancels its constant doesn't hide the other, and mixes the
+ *  result once more with a constant. That takes two multiplies for a
+ *  16-byte key and three for a 32-byte one, fewer than CityHasher needs.
+ *  Where the compiler has no 128-bit integer type, it falls back to
+ *  CityHasher's hash. */
+template <class Key>
+class BinaryKeyHasher {
+    static_assert(sizeof(Key) == 16 || sizeof(Key) == 32,
+                  "BinaryKeyHasher only hashes 16- and 32-byte keys");
+
+public:
+    size_t operator()(const Key& k) const {
+        const char* s = reinterpret_cast<const char*>(&k);
+#if defined(__SIZEOF_INT128__)
+        uint64_t h = mix(fetch64(s) ^ k0, fetch64(s + 8) ^ k1);
+        if (sizeof(Key) == 32) {
+            h ^= mix(fetch64(s + 16) ^ k2, fetch64(s + 24) ^ k3);
+        }
+        return fold_mul(h, k3 ^ sizeof(Key));
+#else
+        return CityHashInline::hash(s, sizeof(Key));
+#endif
+    }
+
+private:
+    static const uint64_t k0 = 0xa0761d6478bd642fULL;
+    static const uint64_t k1 = 0xe7037ed1a0b428dbULL;
+    static const uint64_t k2 = 0x8ebc6af09c88c6e3ULL;
+    static const uint64_t k3 = 0x589965cc75374cc3ULL;
+
+    static inline uint64_t fetch64(const char* p) {
+        uint64_t result;
+        memcpy(&result, p, sizeof(result));
+        return result;
+    }
+
+#if defined(__SIZEOF_INT128__)
+    static inline uint64_t fold_mul(const uint64_t a, const uint64_t b) {
+        const unsigned __int128 r = static_cast<unsigned __int128>(a) * b;
+        return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+    }
+
+    // The product of a pair of words is 0 whenever either of them is, which
+    // would make every key whose word equals its constant hash alike, so the
+    // words themselves are added back in. The rotate keeps swapped pairs
+    // from summing alike.
+    static inline uint64_t mix(const uint64_t a, const uint64_t b) {
+        return fold_mul(a, b) + a + ((b << 32) | (b >> 32));
+    }
+#endif
+};
+
+/*! binary_key is a 16- or 32-byte binary key, such as a UUID or an IPv6
+ *  address, aligned to 16 bytes. Since cuckoohash_map aligns its keys to
+ *  their type's alignment, the keys of a table of binary_key are 16-byte
+ *  aligned, and a 16-byte key never straddles two cache lines. The
+ *  alignment pads each bucket's partial keys to 16 bytes, so a table of
+ *  std::array<uint8_t, N> with BinaryKeyHasher and BinaryKeyEqual is a
+ *  little smaller. std::hash and operator== are defined with \ref
+ *  BinaryKeyHasher and \ref BinaryKeyEqual, so a
+ *  cuckoohash_map<binary_key<16>, T> uses them by default. */
+template <size_t N>
+struct alignas(16) binary_key {
+    static_assert(N == 16 || N == 32, "binary keys must be 16 or 32 bytes");
+
+    uint8_t bytes[N];
+
+    //! from returns the binary key whose bytes are the \p N bytes at \p p.
+    static binary_key from(const void* p) {
+        binary_key k;
+        memcpy(k.bytes, p, N);
+        return k;
+    }
+};
+
+template <size_t N>
+inline bool operator==(const binary_key<N>& a, const binary_key<N>& b) {
+    return BinaryKeyEqual<binary_key<N> >()(a, b);
+}
+
+template <size_t N>
+inline bool operator!=(const binary_key<N>& a, const binary_key<N>& b) {
+    return !(a == b);
+}
+
+namespace std {
+    template <size_t N>
+    struct hash<binary_key<N> > : public BinaryKeyHasher<binary_key<N> > {};
+}
+
+#endif
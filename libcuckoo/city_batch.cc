@@ -0,0 +1,125 @@
+// See city_batch.h for what the functions compute and when they are
+// vectorized.
+
+#include "config.h"
+#include <city.h>
+#include <city_batch.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CITY_BATCH_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+static void HashEach(const char *keys, size_t len, size_t n, uint64_t *out) {
+  for (size_t i = 0; i < n; i++, keys += len) {
+    out[i] = CityHash64(keys, len);
+  }
+}
+
+#ifdef CITY_BATCH_HAVE_AVX2
+
+// CityHash64 of an 8- or 16-byte key s is HashLen0to16 in city.cc:
+//
+//   mul = k2 + len * 2
+//   a = Fetch64(s) + k2, b = Fetch64(s + len - 8)
+//   c = Rotate(b, 37) * mul + a, d = (Rotate(a, 25) + b) * mul
+//   return HashLen16(c, d, mul)
+//
+// The functions below compute it for four keys at once, given the first and
+// last word of each key. AVX2 has no 64-bit multiply, so each one is built
+// out of three 32-bit multiplies.
+
+static const uint64_t k2 = 0x9ae16a3b2f90404fULL;
+
+__attribute__((target("avx2")))
+static inline __m256i Mul64(__m256i x, __m256i m, __m256i m_hi) {
+  const __m256i lo = _mm256_mul_epu32(x, m);
+  const __m256i cross = _mm256_add_epi64(
+      _mm256_mul_epu32(_mm256_srli_epi64(x, 32), m),
+      _mm256_mul_epu32(x, m_hi));
+  return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i Rotate64(__m256i x, int shift) {
+  return _mm256_or_si256(_mm256_srli_epi64(x, shift),
+                         _mm256_slli_epi64(x, 64 - shift));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i ShiftMix47(__m256i x) {
+  return _mm256_xor_si256(x, _mm256_srli_epi64(x, 47));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i HashLen8or16x4(__m256i first, __m256i last, size_t len) {
+  const uint64_t mul_scalar = k2 + len * 2;
+  const __m256i mul = _mm256_set1_epi64x(mul_scalar);
+  const __m256i mul_hi = _mm256_set1_epi64x(mul_scalar >> 32);
+  const __m256i a = _mm256_add_epi64(first, _mm256_set1_epi64x(k2));
+  const __m256i b = last;
+  const __m256i c = _mm256_add_epi64(Mul64(Rotate64(b, 37), mul, mul_hi), a);
+  const __m256i d = Mul64(_mm256_add_epi64(Rotate64(a, 25), b), mul, mul_hi);
+  // HashLen16(c, d, mul)
+  const __m256i x = ShiftMix47(Mul64(_mm256_xor_si256(c, d), mul, mul_hi));
+  const __m256i y = ShiftMix47(Mul64(_mm256_xor_si256(d, x), mul, mul_hi));
+  return Mul64(y, mul, mul_hi);
+}
+
+__attribute__((target("avx2")))
+static void HashBatchAvx2(const char *keys, size_t len, size_t n,
+                          uint64_t *out) {
+  size_t i = 0;
+  if (len == 8) {
+    for (; i + 4 <= n; i += 4) {
+      const __m256i w = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(keys + i * 8));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                          HashLen8or16x4(w, w, 8));
+    }
+  } else if (len == 16) {
+    for (; i + 4 <= n; i += 4) {
+      // v0 holds the words of keys i and i+1, and v1 those of keys i+2 and
+      // i+3. Unpacking splits them into first and last words, in the order
+      // i, i+2, i+1, i+3, which the final permute undoes.
+      const __m256i v0 = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(keys + i * 16));
+      const __m256i v1 = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(keys + i * 16 + 32));
+      const __m256i h = HashLen8or16x4(_mm256_unpacklo_epi64(v0, v1),
+                                       _mm256_unpackhi_epi64(v0, v1), 16);
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                          _mm256_permute4x64_epi64(h, 0xd8));
+    }
+  }
+  HashEach(keys + i * len, len, n - i, out + i);
+}
+
+#endif  // CITY_BATCH_HAVE_AVX2
+
+typedef void (*CityHashBatchFn)(const char *, size_t, size_t, uint64_t *);
+
+static CityHashBatchFn ChooseCityHashBatch() {
+#ifdef CITY_BATCH_HAVE_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return HashBatchAvx2;
+  }
+#endif
+  return HashEach;
+}
+
+// As in crc_hash.cc, the implementation is chosen the first time it is
+// needed, so that it works from static initializers.
+static CityHashBatchFn GetCityHashBatch() {
+  static const CityHashBatchFn fn = ChooseCityHashBatch();
+  return fn;
+}
+
+void CityHash64Batch(const char *keys, size_t len, size_t n, uint64_t *out) {
+  GetCityHashBatch()(keys, len, n, out);
+}
+
+bool CityHashBatchAccelerated() {
+  return GetCityHashBatch() != HashEach;
+}
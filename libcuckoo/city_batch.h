@@ -0,0 +1,21 @@
+// CityHash64Batch computes CityHash64 of many keys of the same length in one
+// call. For 8- and 16-byte keys, such as integers and 128-bit ids, it hashes
+// four keys at a time in the lanes of AVX2 registers, when the CPU supports
+// AVX2. Other key lengths, and machines without AVX2, hash one key at a time.
+// The results are always the same as calling CityHash64 on each key.
+
+#ifndef CITY_BATCH_H_
+#define CITY_BATCH_H_
+
+#include <stdlib.h>  // for size_t.
+#include <stdint.h>
+
+// Hashes the n keys of len bytes each stored back to back at keys, writing
+// CityHash64 of key i to out[i].
+void CityHash64Batch(const char *keys, size_t len, size_t n, uint64_t *out);
+
+// Returns true if CityHash64Batch uses AVX2 for 8- and 16-byte keys on this
+// machine.
+bool CityHashBatchAccelerated();
+
+#endif  // CITY_BATCH_H_
@@ -1,22 +1,266 @@
+#ifndef _CITY_HASHER_HH
+#define _CITY_HASHER_HH
+
+#include <cstring>
+#include <string>
+#if __cplusplus >= 201703L
+#  include <string_view>
+#endif
+
 #include "city.h"
+#include "city_batch.h"
+
+/*! CityHashInline computes the same hash as CityHash64. Keys of up to 32
+ *  bytes are hashed inline with CityHash's multiply-xorshift mixers for
+ *  short inputs, so that a hasher for a fixed-size key compiles down to a
+ *  few multiplies instead of a call into libcityhash. Longer keys are
+ *  passed on to CityHash64. */
+class CityHashInline {
+public:
+    //! kMaxInlineLen is the longest key that is hashed inline.
+    static const size_t kMaxInlineLen = 32;
+
+    //! hash returns CityHash64(\p s, \p len).
+    static inline uint64 hash(const char* s, const size_t len) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        if (len <= 16) {
+            return hash_len_0_to_16(s, len);
+        } else if (len <= kMaxInlineLen) {
+            return hash_len_17_to_32(s, len);
+        }
+#endif
+        return CityHash64(s, len);
+    }
+
+    //! hash_with_seed returns CityHash64WithSeed(\p s, \p len, \p seed),
+    //! which mixes \p seed into the result of \ref hash.
+    static inline uint64 hash_with_seed(const char* s, const size_t len,
+                                        const uint64 seed) {
+        return Hash128to64(uint128(hash(s, len) - k2, seed));
+    }
+
+private:
+    // These mirror the functions of the same purpose in city.cc, which reads
+    // words in little-endian order. On other machines, everything goes
+    // through CityHash64.
+    static const uint64 k0 = 0xc3a5c85c97cb3127ULL;
+    static const uint64 k1 = 0xb492b66fbe98f273ULL;
+    static const uint64 k2 = 0x9ae16a3b2f90404fULL;
+
+    static inline uint64 fetch64(const char* p) {
+        uint64 result;
+        memcpy(&result, p, sizeof(result));
+        return result;
+    }
+
+    static inline uint32_t fetch32(const char* p) {
+        uint32_t result;
+        memcpy(&result, p, sizeof(result));
+        return result;
+    }
+
+    static inline uint64 rotate(const uint64 val, const int shift) {
+        return shift == 0 ? val : ((val >> shift) | (val << (64 - shift)));
+    }
+
+    static inline uint64 shift_mix(const uint64 val) {
+        return val ^ (val >> 47);
+    }
+
+    static inline uint64 hash_len_16(const uint64 u, const uint64 v,
+                                     const uint64 mul) {
+        uint64 a = (u ^ v) * mul;
+        a ^= (a >> 47);
+        uint64 b = (v ^ a) * mul;
+        b ^= (b >> 47);
+        return b * mul;
+    }
+
+    static inline uint64 hash_len_0_to_16(const char* s, const size_t len) {
+        if (len >= 8) {
+            const uint64 mul = k2 + len * 2;
+            const uint64 a = fetch64(s) + k2;
+            const uint64 b = fetch64(s + len - 8);
+            const uint64 c = rotate(b, 37) * mul + a;
+            const uint64 d = (rotate(a, 25) + b) * mul;
+            return hash_len_16(c, d, mul);
+        }
+        if (len >= 4) {
+            const uint64 mul = k2 + len * 2;
+            const uint64 a = fetch32(s);
+            return hash_len_16(len + (a << 3), fetch32(s + len - 4), mul);
+        }
+        if (len > 0) {
+            const uint8_t a = s[0];
+            const uint8_t b = s[len >> 1];
+            const uint8_t c = s[len - 1];
+            const uint32_t y = static_cast<uint32_t>(a) +
+                (static_cast<uint32_t>(b) << 8);
+            const uint32_t z = len + (static_cast<uint32_t>(c) << 2);
+            return shift_mix(y * k2 ^ z * k0) * k2;
+        }
+        return k2;
+    }
+
+    static inline uint64 hash_len_17_to_32(const char* s, const size_t len) {
+        const uint64 mul = k2 + len * 2;
+        const uint64 a = fetch64(s) * k1;
+        const uint64 b = fetch64(s + 8);
+        const uint64 c = fetch64(s + len - 8) * mul;
+        const uint64 d = fetch64(s + len - 16) * k2;
+        return hash_len_16(rotate(a + b, 43) + rotate(c, 30) + d,
+                           a + rotate(b + k2, 18) + c, mul);
+    }
+};
 
 /*! CityHasher is a std::hash-style wrapper around CityHash. We
  *  encourage using CityHasher instead of the default std::hash if
- *  possible. */
+ *  possible. Integral keys and other keys of up to 32 bytes are hashed
+ *  inline, with the same result as CityHash64 on their bytes. */
 template <class Key>
 class CityHasher {
 public:
     size_t operator()(const Key& k) const {
-        return CityHash64((const char*) &k, sizeof(k));
+        return CityHashInline::hash((const char*) &k, sizeof(k));
+    }
+
+    //! hash_many stores the hash of each of the \p n keys at \p keys in
+    //! \p out. 8- and 16-byte keys are hashed several at a time with
+    //! CityHash64Batch.
+    void hash_many(const Key* keys, const size_t n, size_t* out) const {
+        if ((sizeof(Key) == 8 || sizeof(Key) == 16) &&
+            sizeof(size_t) == sizeof(uint64_t)) {
+            CityHash64Batch((const char*) keys, sizeof(Key), n,
+                            reinterpret_cast<uint64_t*>(out));
+        } else {
+            for (size_t i = 0; i < n; i++) {
+                out[i] = (*this)(keys[i]);
+            }
+        }
     }
 };
 
 /*! This is a template specialization of CityHasher for
- *  std::string. */
+ *  std::string. It also hashes C strings, and std::string_view when
+ *  compiled as C++17, to the same values as the equal std::string, and
+ *  declares \p is_transparent, so that together with \ref StringEqual
+ *  it lets a table of std::string look those up without building a
+ *  temporary std::string. */
 template <>
 class CityHasher<std::string> {
 public:
+    typedef void is_transparent;
+
+    size_t operator()(const std::string& k) const {
+        return CityHashInline::hash(k.c_str(), k.size());
+    }
+
+    size_t operator()(const char* k) const {
+        return CityHashInline::hash(k, strlen(k));
+    }
+
+#if __cplusplus >= 201703L
+    size_t operator()(std::string_view k) const {
+        return CityHashInline::hash(k.data(), k.size());
+    }
+#endif
+
+    //! hash_many stores the hash of each of the \p n keys at \p keys in
+    //! \p out.
+    void hash_many(const std::string* keys, const size_t n,
+                   size_t* out) const {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = (*this)(keys[i]);
+        }
+    }
+};
+
+/*! SeededCityHasher hashes keys like CityHasher, but with
+ *  CityHash64WithSeed and a seed chosen when the hasher is constructed.
+ *  Since cuckoohash_map keeps a copy of the hasher it is constructed with,
+ *  tables can be given different seeds, so that a set of keys that collides
+ *  in one of them is unlikely to collide in another. */
+template <class Key>
+class SeededCityHasher {
+public:
+    explicit SeededCityHasher(const uint64 seed = 0) : seed_(seed) {}
+
+    size_t operator()(const Key& k) const {
+        return CityHashInline::hash_with_seed((const char*) &k, sizeof(k),
+                                              seed_);
+    }
+
+    //! seed returns the seed the hasher was constructed with.
+    uint64 seed() const {
+        return seed_;
+    }
+
+private:
+    uint64 seed_;
+};
+
+/*! This is a template specialization of SeededCityHasher for
+ *  std::string. Like CityHasher<std::string>, it also hashes C strings and
+ *  std::string_view, and declares \p is_transparent. */
+template <>
+class SeededCityHasher<std::string> {
+public:
+    typedef void is_transparent;
+
+    explicit SeededCityHasher(const uint64 seed = 0) : seed_(seed) {}
+
     size_t operator()(const std::string& k) const {
-        return CityHash64(k.c_str(), k.size());
+        return CityHashInline::hash_with_seed(k.c_str(), k.size(), seed_);
+    }
+
+    size_t operator()(const char* k) const {
+        return CityHashInline::hash_with_seed(k, strlen(k), seed_);
+    }
+
+#if __cplusplus >= 201703L
+    size_t operator()(std::string_view k) const {
+        return CityHashInline::hash_with_seed(k.data(), k.size(), seed_);
+    }
+#endif
+
+    //! seed returns the seed the hasher was constructed with.
+    uint64 seed() const {
+        return seed_;
+    }
+
+private:
+    uint64 seed_;
+};
+
+/*! StringEqual is an equality predicate for std::string keys that also
+ *  compares them to C strings, and std::string_view when compiled as
+ *  C++17, without converting them. It declares \p is_transparent for
+ *  use with CityHasher<std::string>. */
+class StringEqual {
+public:
+    typedef void is_transparent;
+
+    bool operator()(const std::string& a, const std::string& b) const {
+        return a == b;
     }
+
+    bool operator()(const std::string& a, const char* b) const {
+        return a.compare(b) == 0;
+    }
+
+    bool operator()(const char* a, const std::string& b) const {
+        return b.compare(a) == 0;
+    }
+
+#if __cplusplus >= 201703L
+    bool operator()(const std::string& a, std::string_view b) const {
+        return a == b;
+    }
+
+    bool operator()(std::string_view a, const std::string& b) const {
+        return a == b;
+    }
+#endif
 };
+
+#endif
@@ -0,0 +1,185 @@
+// See crc_hash.h for what the hash computes and how it picks an
+// implementation.
+
+#include "config.h"
+#include <crc_hash.h>
+
+#include <string.h>  // for memcpy
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRC_HASH_HAVE_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+static const uint64_t k0 = 0xc3a5c85c97cb3127ULL;
+static const uint64_t k1 = 0xb492b66fbe98f273ULL;
+
+// Turns the seed into the starting state of the two CRC streams. The CRC32C
+// instruction xors its state into the next word of input, so starting the
+// streams at the seed itself would let flipping a bit of the seed cancel out
+// flipping the same bit of the input.
+static uint64_t MixSeed(uint64_t seed) {
+  seed = (seed ^ k0) * k1;
+  return seed ^ (seed >> 29);
+}
+
+static uint64_t Fetch64(const char *p) {
+  uint64_t result;
+  memcpy(&result, p, sizeof(result));
+  return result;
+}
+
+// Mixes the two CRC streams and the length into the final hash with the
+// finalizer of MurmurHash3, so that every bit of the streams affects every
+// bit of the hash.
+static uint64_t Finish(uint32_t a, uint32_t b, size_t len) {
+  uint64_t h = ((static_cast<uint64_t>(a) << 32) | b) ^ (len * k1);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// The CRC32C lookup table for the reflected Castagnoli polynomial, which is
+// what the SSE4.2 instruction computes.
+struct CrcTable {
+  uint32_t t[256];
+
+  CrcTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ ((crc & 1) ? 0x82f63b78 : 0);
+      }
+      t[i] = crc;
+    }
+  }
+};
+
+static const CrcTable& GetCrcTable() {
+  static const CrcTable table;
+  return table;
+}
+
+// Reads the 8 bytes at p as a little-endian word, whatever the byte order of
+// the machine.
+static uint64_t Load64Le(const char *p) {
+  uint64_t result = 0;
+  for (int i = 7; i >= 0; i--) {
+    result = (result << 8) | static_cast<uint8_t>(p[i]);
+  }
+  return result;
+}
+
+// Packs the last 1 to 7 bytes of the input into a word. Every byte ends up in
+// the word, and the length is hashed separately, so two tails of the same
+// length only give the same word if they are equal.
+static uint64_t TailWord(const char *s, size_t len) {
+  if (len >= 4) {
+    uint32_t lo = 0, hi = 0;
+    for (int i = 3; i >= 0; i--) {
+      lo = (lo << 8) | static_cast<uint8_t>(s[i]);
+      hi = (hi << 8) | static_cast<uint8_t>(s[len - 4 + i]);
+    }
+    return lo | (static_cast<uint64_t>(hi) << 32);
+  }
+  return static_cast<uint8_t>(s[0]) |
+      (static_cast<uint32_t>(static_cast<uint8_t>(s[len >> 1])) << 8) |
+      (static_cast<uint32_t>(static_cast<uint8_t>(s[len - 1])) << 16);
+}
+
+// Feeds word to crc, in the order the CRC32C instruction takes its bytes.
+static uint32_t Crc64Portable(const uint32_t *table, uint32_t crc,
+                              uint64_t word) {
+  for (int i = 0; i < 8; i++, word >>= 8) {
+    crc = table[(crc ^ word) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+uint64_t CrcHash64Portable(const char *s, size_t len, uint64_t seed) {
+  const uint32_t *table = GetCrcTable().t;
+  const size_t total = len;
+  seed = MixSeed(seed);
+  uint32_t a = static_cast<uint32_t>(seed);
+  uint32_t b = static_cast<uint32_t>(seed >> 32);
+  for (; len >= 16; s += 16, len -= 16) {
+    a = Crc64Portable(table, a, Load64Le(s));
+    b = Crc64Portable(table, b, Load64Le(s + 8));
+  }
+  if (len >= 8) {
+    a = Crc64Portable(table, a, Load64Le(s));
+    s += 8;
+    len -= 8;
+  }
+  if (len > 0) {
+    b = Crc64Portable(table, b, TailWord(s, len));
+  }
+  return Finish(a, b, total);
+}
+
+#ifdef CRC_HASH_HAVE_SSE42
+
+__attribute__((target("sse4.2")))
+static uint32_t Crc64Sse42(uint32_t crc, uint64_t word) {
+  return static_cast<uint32_t>(_mm_crc32_u64(crc, word));
+}
+
+// The same as CrcHash64Portable, with each 8 bytes fed to the CRC32C
+// instruction as a little-endian word.
+__attribute__((target("sse4.2")))
+static uint64_t CrcHash64Sse42(const char *s, size_t len, uint64_t seed) {
+  const size_t total = len;
+  seed = MixSeed(seed);
+  uint32_t a = static_cast<uint32_t>(seed);
+  uint32_t b = static_cast<uint32_t>(seed >> 32);
+  for (; len >= 16; s += 16, len -= 16) {
+    a = Crc64Sse42(a, Fetch64(s));
+    b = Crc64Sse42(b, Fetch64(s + 8));
+  }
+  if (len >= 8) {
+    a = Crc64Sse42(a, Fetch64(s));
+    s += 8;
+    len -= 8;
+  }
+  if (len > 0) {
+    b = Crc64Sse42(b, TailWord(s, len));
+  }
+  return Finish(a, b, total);
+}
+
+#endif  // CRC_HASH_HAVE_SSE42
+
+typedef uint64_t (*CrcHashFn)(const char *, size_t, uint64_t);
+
+static CrcHashFn ChooseCrcHash() {
+#ifdef CRC_HASH_HAVE_SSE42
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) {
+    return CrcHash64Sse42;
+  }
+#endif
+  return CrcHash64Portable;
+}
+
+// The implementation is chosen the first time it is needed, rather than
+// during static initialization, so that hashing works from the static
+// initializers of other translation units too.
+static CrcHashFn GetCrcHash() {
+  static const CrcHashFn fn = ChooseCrcHash();
+  return fn;
+}
+
+uint64_t CrcHash64(const char *s, size_t len) {
+  return GetCrcHash()(s, len, 0);
+}
+
+uint64_t CrcHash64WithSeed(const char *s, size_t len, uint64_t seed) {
+  return GetCrcHash()(s, len, seed);
+}
+
+bool CrcHashAccelerated() {
+  return GetCrcHash() != CrcHash64Portable;
+}
@@ -0,0 +1,32 @@
+// CrcHash64 is a hash function for byte arrays built on the CRC32C
+// instruction of SSE4.2. The input is fed 8 bytes at a time through two
+// independent CRC32C streams, which hides the latency of the instruction, and
+// the two 32-bit results are mixed together with a multiply-xorshift
+// finalizer, since a CRC on its own is linear in its input.
+//
+// Whether the CPU supports SSE4.2 is checked once, the first time a hash is
+// computed. Machines without it use a table-driven CRC32C that gives the same
+// results, so hashes computed on one machine are valid on any other.
+//
+// CrcHash64 is not suitable for cryptography.
+
+#ifndef CRC_HASH_H_
+#define CRC_HASH_H_
+
+#include <stdlib.h>  // for size_t.
+#include <stdint.h>
+
+// Hash function for a byte array.
+uint64_t CrcHash64(const char *buf, size_t len);
+
+// Hash function for a byte array.  The seed is also hashed into the result.
+uint64_t CrcHash64WithSeed(const char *buf, size_t len, uint64_t seed);
+
+// The portable implementation of CrcHash64WithSeed, which is used when the
+// CPU doesn't support SSE4.2.
+uint64_t CrcHash64Portable(const char *buf, size_t len, uint64_t seed);
+
+// Returns true if CrcHash64 uses the CRC32C instruction on this machine.
+bool CrcHashAccelerated();
+
+#endif  // CRC_HASH_H_
@@ -0,0 +1,31 @@
+#ifndef _CRC_HASHER_HH
+#define _CRC_HASHER_HH
+
+#include <string>
+
+#include "crc_hash.h"
+
+/*! CrcHasher is a std::hash-style wrapper around CrcHash64, which
+ *  hashes with the SSE4.2 CRC32C instruction when the CPU supports
+ *  it. It is faster than \ref CityHasher on long keys, such as
+ *  strings of more than a few dozen bytes, while CityHasher is faster
+ *  on short ones. */
+template <class Key>
+class CrcHasher {
+public:
+    size_t operator()(const Key& k) const {
+        return CrcHash64((const char*) &k, sizeof(k));
+    }
+};
+
+/*! This is a template specialization of CrcHasher for
+ *  std::string. */
+template <>
+class CrcHasher<std::string> {
+public:
+    size_t operator()(const std::string& k) const {
+        return CrcHash64(k.c_str(), k.size());
+    }
+};
+
+#endif
@@ -10,7 +10,44 @@ const size_t SLOT_PER_BUCKET = 8;
 //! table
 const size_t DEFAULT_SIZE = (1U << 16) * SLOT_PER_BUCKET;
 
+//! an insert that fails to find a free slot while the load factor of the
+//! table is below RESEED_LOAD_FACTOR rebuilds the table at the same size with
+//! a new seed mixed into the bucket indices, rather than expanding it. This
+//! is only done once per size of the table.
+const double RESEED_LOAD_FACTOR = 0.5;
+
 //! set LIBCUCKOO_DEBUG to 1 to enable debug output
 #define LIBCUCKOO_DEBUG 0
 
+//! set LIBCUCKOO_STATS to 1 to have the table count the events reported by
+//! cuckoohash_map::stats. It can also be defined on the compiler command line.
+#ifndef LIBCUCKOO_STATS
+#define LIBCUCKOO_STATS 0
+#endif
+
+//! set LIBCUCKOO_LOCK_PROFILE to 1 to have each lock count its acquisitions
+//! and spins, as reported by cuckoohash_map::lock_profile
+#ifndef LIBCUCKOO_LOCK_PROFILE
+#define LIBCUCKOO_LOCK_PROFILE 0
+#endif
+
+//! set LIBCUCKOO_TRACE to 1 to let cuckoo_trace record the operations run
+//! on tables
+#ifndef LIBCUCKOO_TRACE
+#define LIBCUCKOO_TRACE 0
+#endif
+
+//! set LIBCUCKOO_CHECK_HASHES to 1 to have the _hashed operations, such as
+//! cuckoohash_map::find_hashed, hash the key again and throw an
+//! std::invalid_argument if it doesn't match the hash they were given
+#ifndef LIBCUCKOO_CHECK_HASHES
+#define LIBCUCKOO_CHECK_HASHES 0
+#endif
+
+//! when profiling locks, the hold time of one in every
+//! LIBCUCKOO_LOCK_PROFILE_SAMPLE acquisitions of a lock is measured
+#ifndef LIBCUCKOO_LOCK_PROFILE_SAMPLE
+#define LIBCUCKOO_LOCK_PROFILE_SAMPLE 64
+#endif
+
 #endif
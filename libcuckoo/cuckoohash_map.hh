@@ -6,16 +6,27 @@
 #include <atomic>
 #include <bitset>
 #include <cassert>
+#include <cerrno>
 #include <chrono>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
+#include <fstream>
 #include <functional>
+#include <initializer_list>
+#include <iterator>
 #include <limits>
 #include <list>
 #include <memory>
 #include <mutex>
+#include <pthread.h>
+#include <signal.h>
 #include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <thread>
 #include <tuple>
 #include <type_traits>
@@ -24,11 +35,39 @@
 #include <vector>
 
 #include "cuckoohash_config.h"
+#include "cuckoohash_trace.hh"
 #include "cuckoohash_util.h"
 
+/*! default_partial_key is the default partial-key policy of
+ *  cuckoohash_map. A partial-key policy has a static member \p bits,
+ *  the width of the partial key, or tag, the table stores next to every
+ *  key: 0, 8, or 16 bits of the key's hash. Before comparing a key in a
+ *  slot with the one it is looking for, the table compares their partial
+ *  keys, so a wider tag saves more comparisons of keys that don't match,
+ *  at the cost of more space per slot. With 0, no partial keys are stored
+ *  and every occupied slot probed is compared. The default stores 8-bit
+ *  partial keys, except for POD keys of up to 8 bytes, which are cheaper
+ *  to compare than to tag. */
+template <class Key>
+struct default_partial_key {
+    static const size_t bits =
+        (std::is_pod<Key>::value && sizeof(Key) <= 8) ? 0 : 8;
+};
+
+/*! partial_key_bits is a partial-key policy that stores partial keys of
+ *  \p Bits bits for any key type, for example 16-bit tags for long keys or
+ *  8-bit tags for small keys with an expensive equality predicate. */
+template <size_t Bits>
+struct partial_key_bits {
+    static_assert(Bits == 0 || Bits == 8 || Bits == 16,
+                  "partial keys must be 0, 8, or 16 bits wide");
+    static const size_t bits = Bits;
+};
+
 //! cuckoohash_map is the hash table class.
 template <class Key, class T, class Hash = std::hash<Key>,
-          class Pred = std::equal_to<Key> >
+          class Pred = std::equal_to<Key>,
+          class PartialKey = default_partial_key<Key> >
 class cuckoohash_map {
 public:
     //! key_type is the type of keys.
@@ -48,14 +87,33 @@ public:
 private:
     // Constants used internally
 
-    // true if the key is small and simple, which means using partial keys would
-    // probably slow us down
-    static const bool is_simple =
-        std::is_pod<key_type>::value && sizeof(key_type) <= 8;
+    // the width of the partial keys, as chosen by the PartialKey policy
+    static const size_t kPartialBits = PartialKey::bits;
+    static_assert(kPartialBits == 0 || kPartialBits == 8 ||
+                  kPartialBits == 16,
+                  "partial keys must be 0, 8, or 16 bits wide");
+
+    // true if the table stores partial keys
+    static const bool use_partials = kPartialBits != 0;
 
     // number of locks in the locks_ array
     static const size_t kNumLocks = 1 << 13;
 
+    // transparent_lookup is true if both the hasher and the equality predicate
+    // declare an is_transparent member type, which enables the templated
+    // lookup functions.
+    template <class H, class P>
+    struct transparent_lookup {
+        template <class U>
+        static std::true_type test(typename U::is_transparent*);
+
+        template <class U>
+        static std::false_type test(...);
+
+        static const bool value = decltype(test<H>(0))::value &&
+            decltype(test<P>(0))::value;
+    };
+
     // number of cores on the machine
     static const size_t kNumCores;
 
@@ -66,25 +124,149 @@ private:
     // The maximum depth of a BFS path
     static const size_t MAX_BFS_DEPTH = 4;
 
+    // The number of buckets ahead of the current one that a full scan of the
+    // table prefetches
+    static const size_t kPrefetchDistance = 4;
+
+    // The number of keys find_batch hashes at a time before looking them up.
+    static const size_t kFindBatchSize = 32;
+
     // Structs and functions used internally
     class spinlock {
         std::atomic_flag lock_;
+        // the pid of the process holding the lock, or 0 if the lock is free
+        // or its holder hasn't recorded itself yet. The locks of a shared
+        // table live in the shared mapping, so a process can die holding
+        // one, and this lets the processes waiting on it notice.
+        std::atomic<pid_t> owner_;
+
+        // how many times lock spins between checks that the holder is alive
+        static const size_t kOwnerCheckSpins = 1U << 16;
+
+        // process_id returns the pid of the calling process. getpid is a
+        // system call, so the pid is cached, and updated in the child after
+        // a fork.
+        static pid_t process_id() {
+            return cached_pid().load(std::memory_order_relaxed);
+        }
+
+        static std::atomic<pid_t>& cached_pid() {
+            static std::atomic<pid_t> pid(register_fork_handler());
+            return pid;
+        }
+
+        // register_fork_handler arranges for the cached pid to be updated in
+        // the child of a fork, and returns the current pid.
+        static pid_t register_fork_handler() {
+            pthread_atfork(nullptr, nullptr, [] {
+                    cached_pid().store(getpid(), std::memory_order_relaxed);
+                });
+            return getpid();
+        }
+
+        // check_owner throws an std::runtime_error if the process recorded
+        // as holding the lock has exited, since nothing will release it.
+        void check_owner() const {
+            const pid_t owner = owner_.load(std::memory_order_acquire);
+            if (owner != 0 && kill(owner, 0) == -1 && errno == ESRCH) {
+                throw std::runtime_error(
+                    "a process died holding a lock of a shared "
+                    "cuckoohash_map");
+            }
+        }
+#if LIBCUCKOO_LOCK_PROFILE
+        // The profiling counters are only written while holding the lock, so
+        // they don't need atomic increments, but they're atomic so that
+        // lock_profile can read them at any time.
+        std::atomic<size_t> acquisitions_;
+        std::atomic<size_t> spins_;
+        std::atomic<size_t> max_hold_nanos_;
+        // the time at which the lock was taken, if this acquisition is being
+        // timed, and 0 otherwise
+        size_t hold_start_;
+
+        static size_t now_nanos() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        inline void acquired(const size_t spins) {
+            const size_t n = acquisitions_.load(std::memory_order_relaxed);
+            acquisitions_.store(n + 1, std::memory_order_relaxed);
+            spins_.store(spins_.load(std::memory_order_relaxed) + spins,
+                         std::memory_order_relaxed);
+            hold_start_ = (n % LIBCUCKOO_LOCK_PROFILE_SAMPLE == 0) ?
+                now_nanos() : 0;
+        }
+#endif
     public:
         spinlock() {
             lock_.clear();
+            owner_.store(0);
+#if LIBCUCKOO_LOCK_PROFILE
+            acquisitions_.store(0);
+            spins_.store(0);
+            max_hold_nanos_.store(0);
+            hold_start_ = 0;
+#endif
         }
 
+        // lock spins until it takes the lock. If the process holding the
+        // lock has died, which can only happen to the lock of a shared
+        // table, it throws an std::runtime_error instead.
         inline void lock() {
-            while (lock_.test_and_set(std::memory_order_acquire));
+            size_t spins = 0;
+            while (lock_.test_and_set(std::memory_order_acquire)) {
+                if (++spins % kOwnerCheckSpins == 0) {
+                    check_owner();
+                }
+            }
+            owner_.store(process_id(), std::memory_order_relaxed);
+#if LIBCUCKOO_LOCK_PROFILE
+            acquired(spins);
+#endif
         }
 
         inline void unlock() {
+#if LIBCUCKOO_LOCK_PROFILE
+            if (hold_start_ != 0) {
+                const size_t held = now_nanos() - hold_start_;
+                if (held > max_hold_nanos_.load(std::memory_order_relaxed)) {
+                    max_hold_nanos_.store(held, std::memory_order_relaxed);
+                }
+            }
+#endif
+            // The owner is cleared first, so that a waiter never sees the pid
+            // of a process that no longer holds the lock
+            owner_.store(0, std::memory_order_relaxed);
             lock_.clear(std::memory_order_release);
         }
 
         inline bool try_lock() {
-            return !lock_.test_and_set(std::memory_order_acquire);
+            const bool locked =
+                !lock_.test_and_set(std::memory_order_acquire);
+            if (locked) {
+                owner_.store(process_id(), std::memory_order_relaxed);
+#if LIBCUCKOO_LOCK_PROFILE
+                acquired(0);
+#endif
+            }
+            return locked;
+        }
+
+#if LIBCUCKOO_LOCK_PROFILE
+        size_t acquisitions() const {
+            return acquisitions_.load(std::memory_order_relaxed);
+        }
+
+        size_t spins() const {
+            return spins_.load(std::memory_order_relaxed);
+        }
+
+        size_t max_hold_nanos() const {
+            return max_hold_nanos_.load(std::memory_order_relaxed);
         }
+#endif
 
     } __attribute__((aligned(64)));
 
@@ -99,11 +281,12 @@ private:
         failure_under_expansion = 7,
     } cuckoo_status;
 
-    typedef char partial_t;
+    typedef typename std::conditional<
+        kPartialBits == 16, uint16_t, uint8_t>::type partial_t;
     // Two partial key containers. One for when we're actually using partial
-    // keys and another that mocks partial keys for when the type is simple. The
-    // bucket will derive the correct class depending on whether the type is
-    // simple or not.
+    // keys and another that mocks partial keys for when the PartialKey policy
+    // turns them off. The bucket will derive the correct class depending on
+    // whether partial keys are used or not.
     class RealPartialContainer {
         std::array<partial_t, SLOT_PER_BUCKET> partials_;
     public:
@@ -133,8 +316,8 @@ private:
     // bitset, which indicates whether the slot at the given bit index is in
     // the table or not. It uses aligned_storage arrays to store the keys and
     // values to allow constructing and destroying key-value pairs in place.
-    class Bucket : public std::conditional<is_simple, FakePartialContainer,
-                                           RealPartialContainer>::type {
+    class Bucket : public std::conditional<use_partials, RealPartialContainer,
+                                           FakePartialContainer>::type {
     private:
         std::array<typename std::aligned_storage<
                        sizeof(key_type), alignof(key_type)>::type,
@@ -200,32 +383,180 @@ private:
         cacheint(cacheint&& x): num(x.num.load()) {}
     } __attribute__((aligned(64)));
 
+    // StatsCounters holds one core's share of the counters reported by
+    // stats(). The table only allocates them when LIBCUCKOO_STATS is set, and
+    // value-initializing them zeroes every counter.
+    struct StatsCounters {
+        std::atomic<size_t> insert_fast_path;
+        std::atomic<size_t> cuckoo_runs;
+        std::array<std::atomic<size_t>, MAX_BFS_DEPTH+1> path_depths;
+        std::atomic<size_t> path_search_failures;
+        std::atomic<size_t> path_retries;
+        std::atomic<size_t> duplicate_rechecks;
+        std::atomic<size_t> expansion_retries;
+        std::atomic<size_t> expansions;
+        std::atomic<size_t> reseeds;
+        std::atomic<size_t> expansion_nanos;
+        std::atomic<size_t> max_expansion_nanos;
+    } __attribute__((aligned(64)));
+
     // An alias for the type of lock we are using
     typedef spinlock locktype;
 
+    // SharedHeader is stored at the start of the memory that holds a table's
+    // arrays. It is only filled in for tables that live in a shared mapping,
+    // where it lets the processes that open the table check that it was
+    // created with the same layout, and wait until the creating process has
+    // finished initializing it.
+    struct SharedHeader {
+        // set to a nonzero value once the table is ready to be used
+        std::atomic<uint64_t> ready;
+        char magic[8];
+        uint64_t version;
+        uint64_t slot_per_bucket;
+        uint64_t key_size;
+        uint64_t mapped_size;
+        uint64_t bucket_size;
+        uint64_t num_locks;
+        uint64_t num_counters;
+        uint64_t partial_bits;
+        uint64_t hashpower;
+    };
+
+    // TableLayout describes how the lock, counter, and bucket arrays of a
+    // table with a given hashpower are laid out in a single block of memory,
+    // as offsets from the start of the block. Since it doesn't contain any
+    // pointers, the same block can be mapped at different addresses in
+    // different processes.
+    struct TableLayout {
+        // the alignment of the block, which the bucket array starts at a
+        // multiple of. A shared mapping is page aligned, so it always has at
+        // least this alignment.
+        static const size_t kAlign = alignof(Bucket) > 64 ?
+            alignof(Bucket) : 64;
+        static_assert(kAlign <= 4096, "buckets must fit a page alignment");
+
+        size_t locks;
+        size_t counters;
+        size_t buckets;
+        size_t total;
+
+        TableLayout(const size_t hashpower) {
+            locks = round_up(sizeof(SharedHeader), alignof(locktype));
+            counters = round_up(locks + kNumLocks * sizeof(locktype),
+                                alignof(cacheint));
+            buckets = round_up(counters + 2 * kNumCores * sizeof(cacheint),
+                               kAlign);
+            total = buckets + hashsize(hashpower) * sizeof(Bucket);
+        }
+
+        static size_t round_up(const size_t n, const size_t align) {
+            return (n + align - 1) / align * align;
+        }
+    };
+
     // TableInfo contains the entire state of the hashtable. We allocate one
     // TableInfo pointer per hash table and store all of the table memory in it,
-    // so that all the data can be atomically swapped during expansion.
+    // so that all the data can be atomically swapped during expansion. The
+    // arrays themselves live in one block of memory laid out by TableLayout,
+    // which is either allocated by the TableInfo or is a shared mapping of a
+    // file.
     struct TableInfo {
         // 2**hashpower is the number of buckets
         size_t hashpower_;
 
-        // vector of buckets
-        std::vector<Bucket> buckets_;
+        // array of buckets
+        Bucket* buckets_;
 
-        // array of locks
-        std::array<locktype, kNumLocks> locks_;
+        // array of kNumLocks locks
+        locktype* locks_;
 
-        // per-core counters for the number of inserts and deletes
-        std::vector<cacheint> num_inserts, num_deletes;
+        // per-core counters for the number of inserts and deletes, with
+        // kNumCores counters each
+        cacheint* num_inserts;
+        cacheint* num_deletes;
 
-        // The constructor allocates the memory for the table. It allocates one
-        // cacheint for each core in num_inserts and num_deletes.
+        // the block of memory holding the arrays, and its size
+        char* region_;
+        size_t region_size_;
+
+        // true if region_ is a shared mapping, which is unmapped rather than
+        // freed when the TableInfo is destroyed
+        bool shared_;
+
+        // seed_ is mixed into the hashed key to pick its first bucket. It is
+        // 0, meaning the low bits of the hashed key are used directly, until
+        // the table is reseeded, and is kept across expansions.
+        size_t seed_;
+
+        // true if the table was rebuilt with a new seed at this hashpower,
+        // so an insert that fails on it expands the table instead of
+        // reseeding it again
+        bool reseeded_;
+
+        // The constructor allocates the memory for the table and initializes
+        // the arrays in it. It allocates one cacheint for each core in
+        // num_inserts and num_deletes.
         TableInfo(const size_t hashpower)
-            : hashpower_(hashpower), buckets_(hashsize(hashpower_)),
-              num_inserts(kNumCores), num_deletes(kNumCores) {}
+            : hashpower_(hashpower), region_(nullptr), shared_(false),
+              seed_(0), reseeded_(false) {
+            TableLayout layout(hashpower_);
+            void* region;
+            if (posix_memalign(&region, TableLayout::kAlign,
+                               layout.total) != 0) {
+                throw std::bad_alloc();
+            }
+            attach(static_cast<char*>(region), layout.total);
+            init();
+        }
+
+        // This constructor wraps a shared mapping of region_size bytes at
+        // region, which holds the arrays of a table with the given hashpower.
+        // It doesn't initialize the arrays, since the mapping may already
+        // contain a table.
+        TableInfo(const size_t hashpower, char* region,
+                  const size_t region_size)
+            : hashpower_(hashpower), shared_(true), seed_(0),
+              reseeded_(false) {
+            attach(region, region_size);
+        }
+
+        ~TableInfo() {
+            if (shared_) {
+                munmap(region_, region_size_);
+            } else {
+                for (size_t i = 0; i < hashsize(hashpower_); ++i) {
+                    buckets_[i].~Bucket();
+                }
+                free(region_);
+            }
+        }
+
+        // attach points the arrays at their positions in region.
+        void attach(char* region, const size_t region_size) {
+            TableLayout layout(hashpower_);
+            region_ = region;
+            region_size_ = region_size;
+            locks_ = reinterpret_cast<locktype*>(region_ + layout.locks);
+            num_inserts = reinterpret_cast<cacheint*>(
+                region_ + layout.counters);
+            num_deletes = num_inserts + kNumCores;
+            buckets_ = reinterpret_cast<Bucket*>(region_ + layout.buckets);
+        }
 
-        ~TableInfo() {}
+        // init constructs empty arrays in the region.
+        void init() {
+            for (size_t i = 0; i < kNumLocks; ++i) {
+                new (&locks_[i]) locktype();
+            }
+            for (size_t i = 0; i < kNumCores; ++i) {
+                new (&num_inserts[i]) cacheint();
+                new (&num_deletes[i]) cacheint();
+            }
+            for (size_t i = 0; i < hashsize(hashpower_); ++i) {
+                new (&buckets_[i]) Bucket();
+            }
+        }
     };
 
     // This is a hazard pointer, used to indicate which version of the TableInfo
@@ -317,11 +648,67 @@ private:
 
 public:
     //! The constructor creates a new hash table with enough space for \p n
-    //! elements. If the constructor fails, it will throw an exception.
-    explicit cuckoohash_map(size_t n = DEFAULT_SIZE) {
+    //! elements, which hashes keys with \p hf and compares them with \p
+    //! eql. The table keeps its own copies of \p hf and \p eql, so tables of
+    //! the same type can use differently seeded hashers, such as \ref
+    //! SeededCityHasher. If the constructor fails, it will throw an
+    //! exception.
+    explicit cuckoohash_map(size_t n = DEFAULT_SIZE,
+                            const hasher& hf = hasher(),
+                            const key_equal& eql = key_equal())
+        : hashfn(hf), eqfn(eql) {
         cuckoo_init(reserve_calc(n));
     }
 
+    //! This constructor opens a table that lives in the file at \p path,
+    //! creating the file with enough space for \p n elements if it doesn't
+    //! exist yet. The table's buckets, locks, and counters are kept in a
+    //! shared mapping of the file, so every process that opens the same path,
+    //! or that is forked from one that has, operates on the same table, and
+    //! all operations are safe to run concurrently across processes. Use a
+    //! path under /dev/shm to keep the table in POSIX shared memory rather
+    //! than on disk. The file is not removed when the table is destroyed.
+    //!
+    //! Shared tables have some restrictions. The key and mapped types must be
+    //! trivially copyable, and the hash function must produce the same hash
+    //! values in every process. Since other processes can't follow the table
+    //! to a new location, shared tables are never expanded: \ref rehash and
+    //! \ref reserve return false, \ref load throws an exception, and an
+    //! insert that doesn't fit in the table throws an \p std::runtime_error.
+    //! The table's locks live in the file too, so a process that dies in the
+    //! middle of an operation leaves the locks it held taken. Each lock
+    //! records the pid of its holder, and an operation that finds the holder
+    //! of a lock it is waiting for has exited throws an
+    //! \p std::runtime_error rather than waiting forever, but nothing ever
+    //! releases the lock, and a process that died in the middle of an insert
+    //! or a cuckoo move may have left the buckets guarded by it half written.
+    //! Such a table should be discarded. The constructor throws an
+    //! \p std::runtime_error if the file can't be opened or mapped, or holds
+    //! a table with a different layout.
+    cuckoohash_map(const std::string& path, size_t n = DEFAULT_SIZE,
+                   const hasher& hf = hasher(),
+                   const key_equal& eql = key_equal())
+        : hashfn(hf), eqfn(eql) {
+        static_assert(std::is_trivially_copyable<key_type>::value &&
+                      std::is_trivially_copyable<mapped_type>::value,
+                      "shared tables require trivially copyable key and "
+                      "mapped types");
+        table_info.store(cuckoo_open_shared(path, reserve_calc(n)));
+    }
+
+    //! This constructor creates a table sized to hold the key-value pairs in
+    //! [\p first, \p last) and fills it with them using \ref bulk_load,
+    //! hashing keys with \p hf and comparing them with \p eql.
+    template <class ForwardIt>
+    cuckoohash_map(ForwardIt first, ForwardIt last,
+                   size_t nthreads = kNumCores,
+                   const hasher& hf = hasher(),
+                   const key_equal& eql = key_equal())
+        : hashfn(hf), eqfn(eql) {
+        cuckoo_init(reserve_calc(std::distance(first, last)));
+        bulk_load(first, last, nthreads);
+    }
+
     //! The destructor explicitly deletes the current table info.
     ~cuckoohash_map() {
         TableInfo* ti = table_info.load();
@@ -388,16 +775,21 @@ public:
     //! find searches through the table for \p key, and stores the associated
     //! value it finds in \p val.
     bool find(const key_type& key, mapped_type& val) {
-        check_hazard_pointer();
-        size_t hv = hashed_key(key);
-        TableInfo* ti;
-        size_t i1, i2;
-        std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
-        HazardPointerUnsetter hpu;
+        return find_hashed(key, hashed_key(key), val);
+    }
 
-        const cuckoo_status st = cuckoo_find(key, val, hv, ti, i1, i2);
-        unlock_two(ti, i1, i2);
-        return (st == ok);
+    //! find_hashed does the same thing as find, using \p hv as the hash of
+    //! \p key instead of computing it. \p hv must be the value \ref
+    //! hash_function returns for \p key, so that a hash computed once can
+    //! be used to look the key up in several tables with the same hasher.
+    //! The same holds for the other _hashed operations. Passing any other
+    //! hash is undefined behavior: the key may be stored in or looked up
+    //! from the wrong buckets. When LIBCUCKOO_CHECK_HASHES is set to 1, the
+    //! _hashed operations check \p hv and throw an \p std::invalid_argument
+    //! if it doesn't match.
+    bool find_hashed(const key_type& key, const size_t hv, mapped_type& val) {
+        check_hash(key, hv);
+        return find_with_hash(key, hv, val);
     }
 
     //! This version of find does the same thing as the two-argument version,
@@ -413,36 +805,146 @@ public:
         }
     }
 
+    //! If the hasher and the equality predicate both declare an \p
+    //! is_transparent member type, find, find_fn, contains, erase and
+    //! update_fn also accept a key of any type \p K they can hash and compare
+    //! to key_type, and look it up without converting it to key_type. For a
+    //! table of std::string, \ref CityHasher and \ref StringEqual accept C
+    //! strings this way. \p K must hash to the same value as the key_type it
+    //! is equal to.
+    template <class K, class H = hasher, class P = key_equal,
+              class = typename std::enable_if<
+                  transparent_lookup<H, P>::value>::type>
+    bool find(const K& key, mapped_type& val) {
+        return find_with_hash(key, hashed_key(key), val);
+    }
+
+    //! This version of find is the transparent version of the one-argument
+    //! find.
+    template <class K, class H = hasher, class P = key_equal,
+              class = typename std::enable_if<
+                  transparent_lookup<H, P>::value>::type>
+    mapped_type find(const K& key) {
+        mapped_type val;
+        if (find_with_hash(key, hashed_key(key), val)) {
+            return val;
+        } else {
+            throw std::out_of_range("key not found in table");
+        }
+    }
+
+    //! find_fn calls \p fn on the value associated with \p key while the
+    //! key's bucket is still locked, instead of copying the value out like
+    //! find. \p fn must accept an argument of type const mapped_type&, and
+    //! can read as much or as little of the value as it needs. It must not
+    //! throw or call any method of the table. If \p key is not there, \p fn
+    //! isn't called and find_fn returns false.
+    template <class F>
+    bool find_fn(const key_type& key, F fn) {
+        return find_fn_with_hash(key, hashed_key(key), fn);
+    }
+
+    //! This version of find_fn is the transparent version of the one above.
+    template <class K, class F, class H = hasher, class P = key_equal,
+              class = typename std::enable_if<
+                  transparent_lookup<H, P>::value>::type>
+    bool find_fn(const K& key, F fn) {
+        return find_fn_with_hash(key, hashed_key(key), fn);
+    }
+
+    //! contains returns true if \p key is in the table. Unlike find, it
+    //! doesn't copy the value.
+    bool contains(const key_type& key) {
+        return contains_with_hash(key, hashed_key(key));
+    }
+
+    //! This version of contains is the transparent version of the one above.
+    template <class K, class H = hasher, class P = key_equal,
+              class = typename std::enable_if<
+                  transparent_lookup<H, P>::value>::type>
+    bool contains(const K& key) {
+        return contains_with_hash(key, hashed_key(key));
+    }
+
+    //! find_batch looks up the \p n keys at \p keys. For each key \p i that
+    //! it finds, it stores the value in \p vals[i] and sets \p found[i] to
+    //! true, and for the others it sets \p found[i] to false. It returns the
+    //! number of keys it found. The keys are hashed in groups before they are
+    //! looked up, using the hasher's \p hash_many member function if it has
+    //! one, like \ref CityHasher does.
+    size_t find_batch(const key_type* keys, const size_t n, mapped_type* vals,
+                      bool* found) {
+        size_t hvs[kFindBatchSize];
+        size_t num_found = 0;
+        for (size_t first = 0; first < n; first += kFindBatchSize) {
+            const size_t count = (n - first < kFindBatchSize) ?
+                n - first : kFindBatchSize;
+            hashed_keys(keys + first, count, hvs);
+            for (size_t j = 0; j < count; j++) {
+                const size_t i = first + j;
+                found[i] = find_hashed(keys[i], hvs[j], vals[i]);
+                num_found += found[i];
+            }
+        }
+        return num_found;
+    }
+
     //! insert puts the given key-value pair into the table. It first checks
     //! that \p key isn't already in the table, since the table doesn't support
     //! duplicate keys. If the table is out of space, insert will automatically
     //! expand until it can succeed. Note that expansion can throw an exception,
     //! which insert will propagate.
     bool insert(const key_type& key, const mapped_type& val) {
-        check_hazard_pointer();
-        check_counterid();
-        size_t hv = hashed_key(key);
-        TableInfo* ti;
-        size_t i1, i2;
-        std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
-        HazardPointerUnsetter hpu;
-        return cuckoo_insert_loop(key, val, hv, ti, i1, i2);
+        return insert_hashed(key, hashed_key(key), val);
+    }
+
+    //! insert_hashed does the same thing as insert, using \p hv as the hash
+    //! of \p key.
+    bool insert_hashed(const key_type& key, const size_t hv,
+                       const mapped_type& val) {
+        check_hash(key, hv);
+        LIBCUCKOO_TRACE_OP(INSERT, hv);
+        return cuckoo_insert_hashed(key, val, hv);
     }
 
     //! erase removes \p key and it's associated value from the table, calling
     //! their destructors. If \p key is not there, it returns false.
     bool erase(const key_type& key) {
-        check_hazard_pointer();
-        check_counterid();
-        size_t hv = hashed_key(key);
-        TableInfo* ti;
-        size_t i1, i2;
-        std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
-        HazardPointerUnsetter hpu;
+        return erase_hashed(key, hashed_key(key));
+    }
 
-        const cuckoo_status st = cuckoo_delete(key, hv, ti, i1, i2);
-        unlock_two(ti, i1, i2);
-        return (st == ok);
+    //! erase_hashed does the same thing as erase, using \p hv as the hash of
+    //! \p key.
+    bool erase_hashed(const key_type& key, const size_t hv) {
+        check_hash(key, hv);
+        return erase_with_hash(key, hv, erase_nop());
+    }
+
+    //! This version of erase is the transparent version of the one above.
+    template <class K, class H = hasher, class P = key_equal,
+              class = typename std::enable_if<
+                  transparent_lookup<H, P>::value>::type>
+    bool erase(const K& key) {
+        return erase_with_hash(key, hashed_key(key), erase_nop());
+    }
+
+    //! erase_fn removes \p key and its associated value from the table like
+    //! erase, but first calls \p fn on the value, while the key's bucket is
+    //! still locked. \p fn must accept an argument of type mapped_type&, and
+    //! can move the value out or release what it refers to. It must not
+    //! throw or call any method of the table. If \p key is not there, \p fn
+    //! isn't called and erase_fn returns false.
+    template <class F>
+    bool erase_fn(const key_type& key, F fn) {
+        return erase_with_hash(key, hashed_key(key), fn);
+    }
+
+    //! This version of erase_fn is the transparent version of the one above.
+    template <class K, class F, class H = hasher, class P = key_equal,
+              class = typename std::enable_if<
+                  transparent_lookup<H, P>::value>::type>
+    bool erase_fn(const K& key, F fn) {
+        return erase_with_hash(key, hashed_key(key), fn);
     }
 
     //! update changes the value associated with \p key to \p val. If \p key is
@@ -450,6 +952,7 @@ public:
     bool update(const key_type& key, const mapped_type& val) {
         check_hazard_pointer();
         size_t hv = hashed_key(key);
+        LIBCUCKOO_TRACE_OP(UPDATE, hv);
         TableInfo* ti;
         size_t i1, i2;
         std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
@@ -465,16 +968,15 @@ public:
     //!  mapped_type and returns a new value of type \p mapped_type. The exact
     //!  type of \p fn is specified by the \ref updater typedef.
     bool update_fn(const key_type& key, const updater& fn) {
-        check_hazard_pointer();
-        size_t hv = hashed_key(key);
-        TableInfo* ti;
-        size_t i1, i2;
-        std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
-        HazardPointerUnsetter hpu;
+        return update_fn_with_hash(key, hashed_key(key), fn);
+    }
 
-        const cuckoo_status st = cuckoo_update_fn(key, fn, hv, ti, i1, i2);
-        unlock_two(ti, i1, i2);
-        return (st == ok);
+    //! This version of update_fn is the transparent version of the one above.
+    template <class K, class H = hasher, class P = key_equal,
+              class = typename std::enable_if<
+                  transparent_lookup<H, P>::value>::type>
+    bool update_fn(const K& key, const updater& fn) {
+        return update_fn_with_hash(key, hashed_key(key), fn);
     }
 
     //! upsert is a combined update_fn-insert function. It first tries updating
@@ -482,9 +984,17 @@ public:
     //!  table, then it runs an insert with \p key and \p val.
     bool upsert(const key_type& key, const updater& fn,
                 const mapped_type& val) {
+        return upsert_hashed(key, hashed_key(key), fn, val);
+    }
+
+    //! upsert_hashed does the same thing as upsert, using \p hv as the hash
+    //! of \p key.
+    bool upsert_hashed(const key_type& key, const size_t hv,
+                       const updater& fn, const mapped_type& val) {
+        check_hash(key, hv);
         check_hazard_pointer();
         check_counterid();
-        size_t hv = hashed_key(key);
+        LIBCUCKOO_TRACE_OP(UPSERT, hv);
         TableInfo* ti;
         size_t i1, i2;
 
@@ -509,6 +1019,131 @@ public:
         return true;
     }
 
+    //! bulk_load inserts every key-value pair in [\p first, \p last) into the
+    //! table, using \p nthreads threads. The range's elements must have \p
+    //! first and \p second members holding the key and value. If the range
+    //! contains duplicate keys, or keys that are already in the table, only
+    //! one value for each key ends up in the table. It returns the number of
+    //! pairs that were inserted.
+    //!
+    //! bulk_load first expands the table, if necessary, to fit all the new
+    //! elements. The keys are then hashed in parallel, without any locks held,
+    //! and grouped by the range of buckets their first bucket falls in. If the
+    //! table is empty, it then takes all the locks on the table and each
+    //! thread places the elements of one bucket range directly into their
+    //! first buckets, without any per-bucket locking or cuckoo hashing. Only
+    //! the elements that don't fit in their first bucket, or all of them if
+    //! the table wasn't empty, go through a regular concurrent insert once the
+    //! locks are released.
+    template <class ForwardIt>
+    size_t bulk_load(ForwardIt first, ForwardIt last,
+                     size_t nthreads = kNumCores) {
+        typedef BulkRecord<ForwardIt> record;
+        const size_t n = std::distance(first, last);
+        nthreads = std::max<size_t>(1, nthreads);
+        reserve(size() + n);
+        size_t hp, seed;
+        {
+            check_hazard_pointer();
+            const TableInfo* ti = snapshot_table_nolock();
+            HazardPointerUnsetter hpu;
+            hp = ti->hashpower_;
+            seed = ti->seed_;
+        }
+        const size_t num_buckets = hashsize(hp);
+        const size_t nparts = std::min(nthreads, num_buckets);
+        const size_t buckets_per_part = num_buckets / nparts;
+
+        // Hash every key and group the records by the bucket range of their
+        // first bucket. Each thread hashes a contiguous chunk of the input.
+        std::vector<std::vector<std::vector<record> > > staged(
+            nthreads, std::vector<std::vector<record> >(nparts));
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < nthreads; ++t) {
+            ForwardIt chunk_first = first;
+            std::advance(first, n / nthreads + (t < n % nthreads ? 1 : 0));
+            threads.emplace_back(
+                [this, hp, seed, nparts, buckets_per_part, &staged, t]
+                (ForwardIt it, ForwardIt end) {
+                    for (; it != end; ++it) {
+                        const size_t hv = hashed_key(it->first);
+                        LIBCUCKOO_TRACE_OP(INSERT, hv);
+                        const size_t part = std::min(
+                            (seeded_hash(hv, seed) & hashmask(hp)) /
+                            buckets_per_part,
+                            nparts - 1);
+                        staged[t][part].push_back(record(it, hv));
+                    }
+                }, chunk_first, first);
+        }
+        for (size_t t = 0; t < threads.size(); ++t) {
+            threads[t].join();
+        }
+
+        // Place as many records as possible directly into their first bucket.
+        // This is only safe if the table is still the one we partitioned the
+        // records for, and it is empty, since then no key can already be in
+        // its second bucket.
+        std::vector<std::vector<record> > overflow(nparts);
+        std::atomic<size_t> inserted(0);
+        {
+            check_hazard_pointer();
+            TableInfo* ti = snapshot_and_lock_all();
+            AllUnlocker au(ti);
+            HazardPointerUnsetter hpu;
+            if (ti->hashpower_ == hp && ti->seed_ == seed &&
+                cuckoo_size(ti) == 0) {
+                run_on_bucket_ranges(
+                    ti, nparts,
+                    [this, ti, &staged, &overflow, &inserted]
+                    (size_t part, size_t, size_t) {
+                        check_counterid();
+                        size_t placed = 0;
+                        for (size_t t = 0; t < staged.size(); ++t) {
+                            for (const record& r : staged[t][part]) {
+                                if (bulk_place(ti, r)) {
+                                    ++placed;
+                                } else {
+                                    overflow[part].push_back(r);
+                                }
+                            }
+                        }
+                        inserted.fetch_add(placed);
+                    });
+            } else {
+                for (size_t t = 0; t < staged.size(); ++t) {
+                    for (size_t part = 0; part < nparts; ++part) {
+                        overflow[part].insert(overflow[part].end(),
+                                              staged[t][part].begin(),
+                                              staged[t][part].end());
+                    }
+                }
+            }
+        }
+        staged.clear();
+
+        // Insert the leftover records concurrently, with cuckoo hashing and
+        // expansion as needed.
+        threads.clear();
+        for (size_t part = 0; part < nparts; ++part) {
+            threads.emplace_back(
+                [this, &overflow, &inserted, part]() {
+                    size_t placed = 0;
+                    for (const record& r : overflow[part]) {
+                        if (cuckoo_insert_hashed(r.it->first, r.it->second,
+                                                 r.hv)) {
+                            ++placed;
+                        }
+                    }
+                    inserted.fetch_add(placed);
+                });
+        }
+        for (size_t t = 0; t < threads.size(); ++t) {
+            threads[t].join();
+        }
+        return inserted.load();
+    }
+
     //! rehash will size the table using a hashpower of \p n. Note that the
     //! number of buckets in the table will be 2<SUP>\p n</SUP> after expansion,
     //! so the table will have 2<SUP>\p n</SUP> &times; \ref SLOT_PER_BUCKET
@@ -516,14 +1151,15 @@ public:
     //! hashpower, then the function does nothing. It returns true if the table
     //! expansion succeeded, and false otherwise. rehash can throw an exception
     //! if the expansion fails to allocate enough memory for the larger table.
-    bool rehash(size_t n) {
+    //! The elements are moved to the new table by \p nthreads threads.
+    bool rehash(size_t n, size_t nthreads = kNumCores) {
         check_hazard_pointer();
         TableInfo* ti = snapshot_table_nolock();
         HazardPointerUnsetter hpu;
         if (n <= ti->hashpower_) {
             return false;
         }
-        const cuckoo_status st = cuckoo_expand_simple(n);
+        const cuckoo_status st = cuckoo_expand_simple(n, nthreads);
         return (st == ok);
     }
 
@@ -533,24 +1169,282 @@ public:
     //! hashpower sufficient to hold \p n elements. It will return true if there
     //! was an expansion, and false otherwise. reserve can throw an exception if
     //! the expansion fails to allocate enough memory for the larger table.
-    bool reserve(size_t n) {
+    //! The elements are moved to the new table by \p nthreads threads.
+    bool reserve(size_t n, size_t nthreads = kNumCores) {
         check_hazard_pointer();
         TableInfo* ti = snapshot_table_nolock();
         HazardPointerUnsetter hpu;
         if (n <= hashsize(ti->hashpower_) * SLOT_PER_BUCKET) {
             return false;
         }
-        const cuckoo_status st = cuckoo_expand_simple(reserve_calc(n));
+        const cuckoo_status st = cuckoo_expand_simple(reserve_calc(n),
+                                                      nthreads);
         return (st == ok);
     }
 
+    //! save writes the contents of the table to the file at \p path, so that
+    //! they can be restored later with \ref load. The buckets are written
+    //! sequentially, exactly as they are laid out in memory, so this version
+    //! is only available when both the key and the mapped type are trivially
+    //! copyable. Use the two-argument version for other types. It takes all
+    //! the locks on the table while writing, and throws an \p
+    //! std::runtime_error if the file can't be written.
+    void save(const std::string& path) {
+        static_assert(is_trivially_serializable,
+                      "save(path) requires trivially copyable key and mapped "
+                      "types. Use save(path, serializer) instead.");
+        TrivialSerializer serializer;
+        cuckoo_save(path, serializer);
+    }
+
+    //! This version of save writes the table to \p path using \p
+    //! serializer, which must provide a method save(std::ostream&, const
+    //! key_type&, const mapped_type&) that writes one key-value pair to the
+    //! stream. The position of every element in the table is written
+    //! alongside it, so that \ref load can put it back without hashing it
+    //! again.
+    template <class Serializer>
+    void save(const std::string& path, Serializer serializer) {
+        cuckoo_save(path, serializer);
+    }
+
+    //! load replaces the contents of the table with a table that was written
+    //! to \p path by the one-argument version of \ref save. Since every
+    //! element is restored to the bucket it was saved from, the table that
+    //! wrote the file must have used a hash function that produces the same
+    //! hash values as this table's. The file is read into a new table before
+    //! any locks are taken, after which the new table replaces the existing
+    //! one, as in an expansion. It throws an \p std::runtime_error if the
+    //! file can't be read or was written by an incompatible table.
+    void load(const std::string& path) {
+        static_assert(is_trivially_serializable,
+                      "load(path) requires trivially copyable key and mapped "
+                      "types. Use load(path, serializer) instead.");
+        TrivialSerializer serializer;
+        cuckoo_load(path, serializer);
+    }
+
+    //! This version of load reads a table that was written with the
+    //! two-argument version of \ref save. \p serializer must provide a
+    //! method load(std::istream&, key_type&, mapped_type&) that reads back
+    //! one key-value pair written by its save method, and key_type and
+    //! mapped_type must be default constructible.
+    template <class Serializer>
+    void load(const std::string& path, Serializer serializer) {
+        cuckoo_load(path, serializer);
+    }
+
+    //! memory_stats is the type returned by \ref memory_usage. All sizes
+    //! are in bytes.
+    struct memory_stats {
+        //! the array of buckets, which holds the keys and values
+        size_t buckets;
+        //! the array of locks
+        size_t locks;
+        //! the per-core counters of inserts and deletes
+        size_t counters;
+        //! the header and alignment padding of the table's memory, and the
+        //! statistics counters if they are enabled
+        size_t overhead;
+        //! old tables replaced by expansion that are kept alive until no
+        //! thread is using them anymore
+        size_t retired_tables;
+        //! the sum of all the above
+        size_t total;
+    };
+
+    //! memory_usage returns the number of bytes the table has allocated,
+    //! broken down by what they are used for. It doesn't include memory
+    //! allocated by the keys and values themselves, such as the characters
+    //! of a long std::string. It takes all the locks on the table to read
+    //! the list of retired tables, so it shouldn't be called often.
+    memory_stats memory_usage() {
+        check_hazard_pointer();
+        TableInfo* ti = snapshot_and_lock_all();
+        assert(ti == table_info.load());
+        AllUnlocker au(ti);
+        HazardPointerUnsetter hpu;
+        memory_stats ms = memory_stats();
+        ms.buckets = hashsize(ti->hashpower_) * sizeof(Bucket);
+        ms.locks = kNumLocks * sizeof(locktype);
+        ms.counters = 2 * kNumCores * sizeof(cacheint);
+        ms.overhead = ti->region_size_ - ms.buckets - ms.locks - ms.counters +
+            stats_counters.size() * sizeof(StatsCounters);
+        for (auto it = old_table_infos.begin(); it != old_table_infos.end();
+             ++it) {
+            ms.retired_tables += (*it)->region_size_;
+        }
+        ms.total = ms.buckets + ms.locks + ms.counters + ms.overhead +
+            ms.retired_tables;
+        return ms;
+    }
+
+    //! An expansion, reseed or \ref load keeps the table it replaced until
+    //! no operation that started on it is still running, since operations
+    //! such as a cuckoo insert can keep reading the keys of the old table.
+    //! reclaim_retired_tables frees the replaced tables that no operation is
+    //! using any more, and returns true if none are left, in which case no
+    //! operation can read a key of a table that was replaced before this
+    //! call. A table whose keys refer to memory it manages, like
+    //! cuckoohash_string_map, can only free memory that the keys of a
+    //! replaced table may refer to once this returns true. It takes all the
+    //! locks on the table.
+    bool reclaim_retired_tables() {
+        check_hazard_pointer();
+        TableInfo* ti = snapshot_and_lock_all();
+        AllUnlocker au(ti);
+        HazardPointerUnsetter hpu;
+        global_hazard_pointers.delete_unused(old_table_infos);
+        return old_table_infos.empty();
+    }
+
+    //! cuckoo_stats is the type returned by \ref stats.
+    struct cuckoo_stats {
+        //! inserts that found a free slot in one of the key's two buckets
+        size_t insert_fast_path;
+        //! inserts that had to search for a cuckoo path to free up a slot
+        size_t cuckoo_runs;
+        //! path_depths[d] is the number of cuckoo paths found that displaced
+        //! d items
+        std::array<size_t, MAX_BFS_DEPTH+1> path_depths;
+        //! searches that found no path within the maximum depth, after which
+        //! the table was expanded or reseeded
+        size_t path_search_failures;
+        //! paths that changed before they could be moved along, so the search
+        //! had to be run again
+        size_t path_retries;
+        //! inserts that found the key had been inserted by another thread
+        //! while they were looking for a cuckoo path
+        size_t duplicate_rechecks;
+        //! inserts that had to start over because the table was expanded
+        //! while they were running
+        size_t expansion_retries;
+        //! number of times the table was expanded
+        size_t expansions;
+        //! number of times an insert failed while the load factor was below
+        //! RESEED_LOAD_FACTOR, and the table was rebuilt with a new seed
+        //! instead of being expanded
+        size_t reseeds;
+        //! total time spent holding every lock to expand the table, in seconds
+        double expansion_seconds;
+        //! longest time spent holding every lock for a single expansion, in
+        //! seconds
+        double max_expansion_seconds;
+    };
+
+    //! stats returns the operation statistics the table has collected since
+    //! it was created. The counters are kept per core and summed up when this
+    //! is called, so it may miss operations running concurrently with it.
+    //! Statistics are only collected when LIBCUCKOO_STATS is set to 1 before
+    //! including the header; otherwise every field is zero.
+    cuckoo_stats stats() const {
+        cuckoo_stats st = cuckoo_stats();
+        for (size_t i = 0; i < stats_counters.size(); ++i) {
+            const StatsCounters& c = stats_counters[i];
+            st.insert_fast_path += c.insert_fast_path.load();
+            st.cuckoo_runs += c.cuckoo_runs.load();
+            for (size_t d = 0; d <= MAX_BFS_DEPTH; ++d) {
+                st.path_depths[d] += c.path_depths[d].load();
+            }
+            st.path_search_failures += c.path_search_failures.load();
+            st.path_retries += c.path_retries.load();
+            st.duplicate_rechecks += c.duplicate_rechecks.load();
+            st.expansion_retries += c.expansion_retries.load();
+            st.expansions += c.expansions.load();
+            st.reseeds += c.reseeds.load();
+            st.expansion_seconds += c.expansion_nanos.load() / 1e9;
+            st.max_expansion_seconds = std::max(
+                st.max_expansion_seconds, c.max_expansion_nanos.load() / 1e9);
+        }
+        return st;
+    }
+
+    //! stripe_profile describes how contended one of the table's locks was,
+    //! as reported by \ref lock_profile.
+    struct stripe_profile {
+        //! the index of the lock
+        size_t stripe;
+        //! the number of times the lock was taken
+        size_t acquisitions;
+        //! the total number of iterations threads spent spinning while
+        //! waiting for the lock
+        size_t spins;
+        //! the longest the lock was held, among the sampled acquisitions, in
+        //! seconds
+        double max_hold_seconds;
+        //! a few keys currently in the buckets guarded by the lock
+        std::vector<key_type> sample_keys;
+    };
+
+    //! lock_profile returns the \p n most contended locks of the table,
+    //! ordered by the number of spins and then by the number of acquisitions,
+    //! along with up to \p num_samples keys currently guarded by each one.
+    //! The counts cover the table since it was created or last expanded,
+    //! since expansion replaces the locks. Locks are only profiled when
+    //! LIBCUCKOO_LOCK_PROFILE is set to 1 before including the header;
+    //! otherwise this returns an empty vector. Hold times are measured for
+    //! one in every LIBCUCKOO_LOCK_PROFILE_SAMPLE acquisitions of each lock,
+    //! which keeps profiling cheap enough to leave on.
+    std::vector<stripe_profile> lock_profile(size_t n = 10,
+                                             size_t num_samples = 4) {
+        std::vector<stripe_profile> profiles;
+#if LIBCUCKOO_LOCK_PROFILE
+        check_hazard_pointer();
+        TableInfo* ti = snapshot_table_nolock();
+        HazardPointerUnsetter hpu;
+        profiles.resize(kNumLocks);
+        for (size_t i = 0; i < kNumLocks; ++i) {
+            profiles[i].stripe = i;
+            profiles[i].acquisitions = ti->locks_[i].acquisitions();
+            profiles[i].spins = ti->locks_[i].spins();
+            profiles[i].max_hold_seconds = ti->locks_[i].max_hold_nanos() / 1e9;
+        }
+        n = std::min(n, profiles.size());
+        std::partial_sort(
+            profiles.begin(), profiles.begin() + n, profiles.end(),
+            [](const stripe_profile& a, const stripe_profile& b) {
+                return a.spins != b.spins ? a.spins > b.spins :
+                    a.acquisitions > b.acquisitions;
+            });
+        profiles.resize(n);
+
+        // Finds sample keys in the buckets guarded by each lock, taking the
+        // lock so that the keys can be copied safely.
+        const size_t num_buckets = hashsize(ti->hashpower_);
+        for (size_t p = 0; p < profiles.size(); ++p) {
+            const size_t stripe = profiles[p].stripe;
+            ti->locks_[stripe].lock();
+            for (size_t i = stripe; i < num_buckets &&
+                     profiles[p].sample_keys.size() < num_samples;
+                 i += kNumLocks) {
+                for (size_t j = 0; j < SLOT_PER_BUCKET &&
+                         profiles[p].sample_keys.size() < num_samples; ++j) {
+                    if (ti->buckets_[i].occupied(j)) {
+                        profiles[p].sample_keys.push_back(
+                            ti->buckets_[i].key(j));
+                    }
+                }
+            }
+            ti->locks_[stripe].unlock();
+        }
+#else
+        (void)n;
+        (void)num_samples;
+#endif
+        return profiles;
+    }
+
     //! hash_function returns the hash function object used by the table.
-    hasher hash_function() {
+    //! The hashes it computes are the ones the _hashed operations, such as
+    //! \ref find_hashed, expect to be given. They are only the same across
+    //! processes if the hash function is deterministic, which \ref
+    //! CityHasher and \ref CrcHasher are, but std::hash need not be.
+    hasher hash_function() const {
         return hashfn;
     }
 
     //! key_eq returns the equality predicate object used by the table.
-    key_equal key_eq() {
+    key_equal key_eq() const {
         return eqfn;
     }
 
@@ -562,8 +1456,120 @@ private:
     // operations, until they are deleted by the global hazard pointer manager.
     std::list<std::unique_ptr<TableInfo>> old_table_infos;
 
-    static hasher hashfn;
-    static key_equal eqfn;
+    // StatsArray owns an array of StatsCounters. Like the table region, it
+    // is allocated with posix_memalign, since new and std::allocator aren't
+    // guaranteed to honor the counters' 64-byte alignment before C++17.
+    class StatsArray {
+    public:
+        StatsArray(const size_t n): counters_(nullptr), size_(n) {
+            if (n == 0) {
+                return;
+            }
+            void* mem;
+            if (posix_memalign(&mem, alignof(StatsCounters),
+                               n * sizeof(StatsCounters)) != 0) {
+                throw std::bad_alloc();
+            }
+            counters_ = static_cast<StatsCounters*>(mem);
+            for (size_t i = 0; i < n; ++i) {
+                new (&counters_[i]) StatsCounters();
+            }
+        }
+
+        ~StatsArray() {
+            for (size_t i = 0; i < size_; ++i) {
+                counters_[i].~StatsCounters();
+            }
+            free(counters_);
+        }
+
+        StatsArray(const StatsArray&) = delete;
+        StatsArray& operator=(const StatsArray&) = delete;
+
+        size_t size() const {
+            return size_;
+        }
+
+        StatsCounters& operator[](const size_t i) {
+            return counters_[i];
+        }
+
+        const StatsCounters& operator[](const size_t i) const {
+            return counters_[i];
+        }
+
+    private:
+        StatsCounters* counters_;
+        size_t size_;
+    };
+
+    // stats_counters holds one set of statistics counters per core. It is
+    // empty unless LIBCUCKOO_STATS is set.
+    StatsArray stats_counters{LIBCUCKOO_STATS ? kNumCores : 0};
+
+    // add_stat adds n to the calling thread's copy of the given statistics
+    // counter. It does nothing unless LIBCUCKOO_STATS is set.
+    inline void add_stat(std::atomic<size_t> StatsCounters::*counter,
+                         const size_t n = 1) {
+#if LIBCUCKOO_STATS
+        check_counterid();
+        (stats_counters[counterid].*counter).fetch_add(
+            n, std::memory_order_relaxed);
+#else
+        (void)counter;
+        (void)n;
+#endif
+    }
+
+    // add_path_depth_stat records a cuckoo path of the given depth in the
+    // calling thread's depth histogram.
+    inline void add_path_depth_stat(const int depth) {
+#if LIBCUCKOO_STATS
+        check_counterid();
+        stats_counters[counterid].path_depths[depth].fetch_add(
+            1, std::memory_order_relaxed);
+#else
+        (void)depth;
+#endif
+    }
+
+    // add_expansion_stat records an expansion that held every lock for the
+    // given number of nanoseconds.
+    inline void add_expansion_stat(const size_t nanos) {
+#if LIBCUCKOO_STATS
+        check_counterid();
+        StatsCounters& c = stats_counters[counterid];
+        c.expansions.fetch_add(1, std::memory_order_relaxed);
+        c.expansion_nanos.fetch_add(nanos, std::memory_order_relaxed);
+        size_t max = c.max_expansion_nanos.load(std::memory_order_relaxed);
+        while (nanos > max && !c.max_expansion_nanos.compare_exchange_weak(
+                   max, nanos, std::memory_order_relaxed));
+#else
+        (void)nanos;
+#endif
+    }
+
+    // check_hash throws an std::invalid_argument if hv isn't the hash of key.
+    // It only checks when LIBCUCKOO_CHECK_HASHES is set, since hashing the
+    // key again would undo the point of the _hashed operations.
+    void check_hash(const key_type& key, const size_t hv) const {
+#if LIBCUCKOO_CHECK_HASHES
+        if (hv != hashed_key(key)) {
+            throw std::invalid_argument("hash passed to a _hashed operation "
+                                        "doesn't match its key");
+        }
+#else
+        (void)key;
+        (void)hv;
+#endif
+    }
+
+    // hashfn and eqfn are the hash function and equality predicate the table
+    // was constructed with. They are copied into the temporary table built
+    // during expansion, so every TableInfo of a table hashes keys the same
+    // way.
+    hasher hashfn;
+    key_equal eqfn;
 
     // lock locks the given bucket index.
     static inline void lock(TableInfo* ti, const size_t i) {
@@ -575,6 +1581,21 @@ private:
         ti->locks_[lock_ind(i)].unlock();
     }
 
+    // lock_holding locks the lock at index i of locks_ while holding the
+    // locks at the indexes in held. If it throws because the holder of the
+    // lock died, it releases the held locks first.
+    static void lock_holding(TableInfo* ti, const size_t i,
+                             std::initializer_list<size_t> held) {
+        try {
+            ti->locks_[i].lock();
+        } catch (...) {
+            for (const size_t h : held) {
+                ti->locks_[h].unlock();
+            }
+            throw;
+        }
+    }
+
     // lock_two locks the two bucket indexes, always locking the earlier index
     // first to avoid deadlock. If the two indexes are the same, it just locks
     // one.
@@ -583,10 +1604,10 @@ private:
         i2 = lock_ind(i2);
         if (i1 < i2) {
             ti->locks_[i1].lock();
-            ti->locks_[i2].lock();
+            lock_holding(ti, i2, {i1});
         } else if (i2 < i1) {
             ti->locks_[i2].lock();
-            ti->locks_[i1].lock();
+            lock_holding(ti, i1, {i2});
         } else {
             ti->locks_[i1].lock();
         }
@@ -620,31 +1641,31 @@ private:
             if (i1 < i2) {
                 if (i2 < i3) {
                     ti->locks_[i1].lock();
-                    ti->locks_[i2].lock();
-                    ti->locks_[i3].lock();
+                    lock_holding(ti, i2, {i1});
+                    lock_holding(ti, i3, {i1, i2});
                 } else if (i1 < i3) {
                     ti->locks_[i1].lock();
-                    ti->locks_[i3].lock();
-                    ti->locks_[i2].lock();
+                    lock_holding(ti, i3, {i1});
+                    lock_holding(ti, i2, {i1, i3});
                 } else {
                     ti->locks_[i3].lock();
-                    ti->locks_[i1].lock();
-                    ti->locks_[i2].lock();
+                    lock_holding(ti, i1, {i3});
+                    lock_holding(ti, i2, {i3, i1});
                 }
             } else if (i2 < i3) {
                 if (i1 < i3) {
                     ti->locks_[i2].lock();
-                    ti->locks_[i1].lock();
-                    ti->locks_[i3].lock();
+                    lock_holding(ti, i1, {i2});
+                    lock_holding(ti, i3, {i2, i1});
                 } else {
                     ti->locks_[i2].lock();
-                    ti->locks_[i3].lock();
-                    ti->locks_[i1].lock();
+                    lock_holding(ti, i3, {i2});
+                    lock_holding(ti, i1, {i2, i3});
                 }
             } else {
                 ti->locks_[i3].lock();
-                ti->locks_[i2].lock();
-                ti->locks_[i1].lock();
+                lock_holding(ti, i2, {i3});
+                lock_holding(ti, i1, {i3, i2});
             }
         }
     }
@@ -743,7 +1764,14 @@ private:
                 continue;
             }
             for (size_t i = 0; i < kNumLocks; ++i) {
-                ti->locks_[i].lock();
+                try {
+                    ti->locks_[i].lock();
+                } catch (...) {
+                    while (i > 0) {
+                        ti->locks_[--i].unlock();
+                    }
+                    throw;
+                }
             }
             // If the table info has changed, unlock the locks and try again.
             if (ti != table_info.load()) {
@@ -754,6 +1782,28 @@ private:
         }
     }
 
+    // snapshot_and_lock_stripe is similar to snapshot_and_lock_two, except
+    // that it takes the single lock at index stripe in locks_, which guards
+    // every bucket whose lock_ind is stripe.
+    TableInfo* snapshot_and_lock_stripe(const size_t stripe) {
+        while (true) {
+            TableInfo* ti = table_info.load();
+            *hazard_pointer = ti;
+            // If the table info has changed, ti could have been deleted, so try
+            // again
+            if (ti != table_info.load()) {
+                continue;
+            }
+            ti->locks_[stripe].lock();
+            // If the table info has changed, unlock the stripe and try again.
+            if (ti != table_info.load()) {
+                ti->locks_[stripe].unlock();
+                continue;
+            }
+            return ti;
+        }
+    }
+
     // lock_ind converts an index into buckets_ to an index into locks_.
     static inline size_t lock_ind(const size_t bucket_ind) {
         return bucket_ind & (kNumLocks - 1);
@@ -771,15 +1821,135 @@ private:
         return hashsize(hashpower) - 1;
     }
 
-    // hashed_key hashes the given key.
-    static inline size_t hashed_key(const key_type &key) {
+    // hashed_key hashes the given key, which is a key_type unless the lookup
+    // is transparent.
+    template <class K>
+    inline size_t hashed_key(const K &key) const {
         return hashfn(key);
     }
 
+    // The _with_hash functions hold the bodies of the lookup operations, for
+    // a key that is either a key_type or, with transparent lookup, anything
+    // the hasher and predicate accept.
+    template <class K>
+    bool find_with_hash(const K& key, const size_t hv, mapped_type& val) {
+        check_hazard_pointer();
+        LIBCUCKOO_TRACE_OP(FIND, hv);
+        TableInfo* ti;
+        size_t i1, i2;
+        std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
+        HazardPointerUnsetter hpu;
+
+        const cuckoo_status st = cuckoo_find(key, val, hv, ti, i1, i2);
+        unlock_two(ti, i1, i2);
+        return (st == ok);
+    }
+
+    template <class K, class F>
+    bool find_fn_with_hash(const K& key, const size_t hv, F& fn) {
+        check_hazard_pointer();
+        LIBCUCKOO_TRACE_OP(FIND, hv);
+        TableInfo* ti;
+        size_t i1, i2;
+        std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
+        HazardPointerUnsetter hpu;
+
+        const cuckoo_status st = cuckoo_find_fn(key, fn, hv, ti, i1, i2);
+        unlock_two(ti, i1, i2);
+        return (st == ok);
+    }
+
+    template <class K>
+    bool contains_with_hash(const K& key, const size_t hv) {
+        check_hazard_pointer();
+        LIBCUCKOO_TRACE_OP(FIND, hv);
+        TableInfo* ti;
+        size_t i1, i2;
+        std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
+        HazardPointerUnsetter hpu;
+
+        const cuckoo_status st = cuckoo_contains(key, hv, ti, i1, i2);
+        unlock_two(ti, i1, i2);
+        return (st == ok);
+    }
+
+    // erase_nop is the function erase passes to erase_with_hash, which does
+    // nothing with the erased value.
+    struct erase_nop {
+        void operator()(mapped_type&) const {}
+    };
+
+    template <class K, class F>
+    bool erase_with_hash(const K& key, const size_t hv, F fn) {
+        check_hazard_pointer();
+        check_counterid();
+        LIBCUCKOO_TRACE_OP(ERASE, hv);
+        TableInfo* ti;
+        size_t i1, i2;
+        std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
+        HazardPointerUnsetter hpu;
+
+        const cuckoo_status st = cuckoo_delete(key, hv, ti, i1, i2, fn);
+        unlock_two(ti, i1, i2);
+        return (st == ok);
+    }
+
+    template <class K>
+    bool update_fn_with_hash(const K& key, const size_t hv,
+                             const updater& fn) {
+        check_hazard_pointer();
+        LIBCUCKOO_TRACE_OP(UPDATE_FN, hv);
+        TableInfo* ti;
+        size_t i1, i2;
+        std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
+        HazardPointerUnsetter hpu;
+
+        const cuckoo_status st = cuckoo_update_fn(key, fn, hv, ti, i1, i2);
+        unlock_two(ti, i1, i2);
+        return (st == ok);
+    }
+
+    // has_hash_many checks whether a hasher has a hash_many member function
+    // that hashes an array of keys in one call.
+    template <class H>
+    struct has_hash_many {
+        template <class U>
+        static auto test(int) -> decltype(
+            std::declval<const U&>().hash_many(
+                std::declval<const key_type*>(), size_t(),
+                std::declval<size_t*>()),
+            std::true_type());
+
+        template <class U>
+        static std::false_type test(...);
+
+        static const bool value = decltype(test<H>(0))::value;
+    };
+
+    // hashed_keys hashes the n given keys into hvs, with the hasher's
+    // hash_many if it has one.
+    inline void hashed_keys(const key_type* keys, const size_t n,
+                            size_t* hvs) const {
+        hashed_keys(keys, n, hvs, std::integral_constant<
+                        bool, has_hash_many<hasher>::value>());
+    }
+
+    inline void hashed_keys(const key_type* keys, const size_t n,
+                            size_t* hvs, std::true_type) const {
+        hashfn.hash_many(keys, n, hvs);
+    }
+
+    inline void hashed_keys(const key_type* keys, const size_t n,
+                            size_t* hvs, std::false_type) const {
+        for (size_t i = 0; i < n; i++) {
+            hvs[i] = hashed_key(keys[i]);
+        }
+    }
+
     // index_hash returns the first possible bucket that the given hashed key
     // could be.
     static inline size_t index_hash(const TableInfo* ti, const size_t hv) {
-        return hv & hashmask(ti->hashpower_);
+        return seeded_hash(hv, ti->seed_) & hashmask(ti->hashpower_);
     }
 
     // alt_index returns the other possible bucket that the given hashed key
@@ -790,33 +1960,67 @@ private:
     static inline size_t alt_index(
         const TableInfo* ti, const size_t hv, const size_t index) {
         // ensure tag is nonzero for the multiply
-        const size_t tag = (hv >> ti->hashpower_) + 1;
+        const size_t tag = (seeded_hash(hv, ti->seed_) >> ti->hashpower_) + 1;
         // 0x5bd1e995 is the hash constant from MurmurHash2
         return (index ^ (tag * 0x5bd1e995)) & hashmask(ti->hashpower_);
     }
 
+    // seeded_hash returns the bits the buckets of a hashed key are picked
+    // from, in a table with the given seed. Without a seed, they are the
+    // hashed key itself. With one, the seed is mixed into all the bits of the
+    // hashed key first, so keys whose hashes only differ in a few bits still
+    // spread over the buckets.
+    static inline size_t seeded_hash(const size_t hv, const size_t seed) {
+        if (seed == 0) {
+            return hv;
+        }
+        uint64_t x = (static_cast<uint64_t>(hv) ^ seed) *
+            0x9e3779b97f4a7c15ULL;
+        x ^= x >> 32;
+        x *= 0xd6e8feb86659fd93ULL;
+        x ^= x >> 32;
+        return static_cast<size_t>(x);
+    }
+
+    // next_seed returns a nonzero seed, different from the given one, to
+    // rebuild the table with.
+    static size_t next_seed(const size_t seed) {
+        uint64_t x = seed + 0x9e3779b97f4a7c15ULL +
+            std::chrono::steady_clock::now().time_since_epoch().count();
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        const size_t next = static_cast<size_t>(x);
+        return (next == 0 || next == seed) ? seed + 1 : next;
+    }
+
     // partial_key returns a partial_t representing the upper sizeof(partial_t)
     // bytes of the hashed key. This is used for partial-key cuckoohashing. If
-    // the key type is POD and small, we don't use partial keys, so we just
-    // return 0.
+    // the PartialKey policy turns partial keys off, we just return 0.
     template <class Bogus = void*>
     static inline
-    typename std::enable_if<sizeof(Bogus) && !is_simple, partial_t>::type
+    typename std::enable_if<sizeof(Bogus) && use_partials, partial_t>::type
         partial_key(const size_t hv) {
         return (partial_t)(hv >> ((sizeof(size_t)-sizeof(partial_t)) * 8));
     }
     template <class Bogus = void*>
     static inline
-    typename std::enable_if<sizeof(Bogus) && is_simple, partial_t>::type
+    typename std::enable_if<sizeof(Bogus) && !use_partials, partial_t>::type
         partial_key(const size_t&) {
         return 0;
     }
 
-    // CuckooRecord holds one position in a cuckoo path.
+    // CuckooRecord holds one position in a cuckoo path, along with the hashed
+    // key of the element that was in it when the path was found. Recording
+    // the hash rather than a copy of the key avoids copying keys like long
+    // strings, and means keys are only ever read while their bucket is
+    // locked. The bucket may belong to a table that an expansion has since
+    // replaced, though, so memory a key refers to has to outlive the
+    // replaced tables as well (see reclaim_retired_tables).
     typedef struct  {
         size_t bucket;
         size_t slot;
-        key_type key;
+        size_t hv;
     }  CuckooRecord;
 
     // b_slot holds the information for a BFS path through the table
@@ -870,7 +2074,7 @@ private:
     // starts with the i1 and i2 buckets, and, until it finds a bucket with an
     // empty slot, adds each slot of the bucket in the b_slot. If the queue runs
     // out of space, it fails.
-    static b_slot slot_search(TableInfo* ti, const size_t i1, const size_t i2) {
+    b_slot slot_search(TableInfo* ti, const size_t i1, const size_t i2) {
         b_queue q;
         // The initial pathcode informs cuckoopath_search which bucket the path
         // starts on
@@ -925,8 +2129,8 @@ private:
     // the buckets it searches, the data can change between this function and
     // cuckoopath_move. Thus cuckoopath_move checks that the data matches the
     // cuckoo path before changing it.
-    static int cuckoopath_search(TableInfo* ti, CuckooRecord* cuckoo_path,
-                                 const size_t i1, const size_t i2) {
+    int cuckoopath_search(TableInfo* ti, CuckooRecord* cuckoo_path,
+                          const size_t i1, const size_t i2) {
         b_slot x = slot_search(ti, i1, i2);
         if (x.depth == -1) {
             return -1;
@@ -950,7 +2154,7 @@ private:
                 unlock(ti, curr->bucket);
                 return 0;
             }
-            curr->key = ti->buckets_[curr->bucket].key(curr->slot);
+            curr->hv = hashed_key(ti->buckets_[curr->bucket].key(curr->slot));
             unlock(ti, curr->bucket);
         } else {
             assert(x.pathcode == 1);
@@ -961,12 +2165,12 @@ private:
                 unlock(ti, curr->bucket);
                 return 0;
             }
-            curr->key = ti->buckets_[curr->bucket].key(curr->slot);
+            curr->hv = hashed_key(ti->buckets_[curr->bucket].key(curr->slot));
             unlock(ti, curr->bucket);
         }
         for (int i = 1; i <= x.depth; ++i) {
             CuckooRecord* prev = curr++;
-            const size_t prevhv = hashed_key(prev->key);
+            const size_t prevhv = prev->hv;
             assert(prev->bucket == index_hash(ti, prevhv) ||
                    prev->bucket == alt_index(ti, prevhv, index_hash(ti,
                                                                     prevhv)));
@@ -979,7 +2183,7 @@ private:
                 unlock(ti, curr->bucket);
                 return i;
             }
-            curr->key = ti->buckets_[curr->bucket].key(curr->slot);
+            curr->hv = hashed_key(ti->buckets_[curr->bucket].key(curr->slot));
             unlock(ti, curr->bucket);
         }
         return x.depth;
@@ -993,7 +2197,7 @@ private:
     // the last bucket it looks at (which is either i1 or i2 in run_cuckoo)
     // remains locked. If the function is unsuccessful, then both insert-locked
     // buckets will be unlocked.
-    static bool cuckoopath_move(
+    bool cuckoopath_move(
         TableInfo* ti, CuckooRecord* cuckoo_path, size_t depth,
         const size_t i1, const size_t i2) {
         if (depth == 0) {
@@ -1035,12 +2239,14 @@ private:
 
             // We plan to kick out fs, but let's check if it is still there;
             // there's a small chance we've gotten scooped by a later cuckoo. If
-            // that happened, just... try again. Also the slot we are filling in
-            // may have already been filled in by another thread, or the slot we
-            // are moving from may be empty, both of which invalidate the swap.
-            if (!eqfn(ti->buckets_[fb].key(fs), from->key) ||
-                ti->buckets_[tb].occupied(ts) ||
-                !ti->buckets_[fb].occupied(fs)) {
+            // that happened, just... try again. Any element with the same
+            // hashed key has the same two buckets, so it can be moved along
+            // the path just as well. Also the slot we are filling in may have
+            // already been filled in by another thread, or the slot we are
+            // moving from may be empty, both of which invalidate the swap.
+            if (!ti->buckets_[fb].occupied(fs) ||
+                hashed_key(ti->buckets_[fb].key(fs)) != from->hv ||
+                ti->buckets_[tb].occupied(ts)) {
                 if (depth == 1) {
                     unlock_three(ti, fb, tb, ob);
                 } else {
@@ -1049,7 +2255,7 @@ private:
                 return false;
             }
 
-            if (!is_simple) {
+            if (use_partials) {
                 ti->buckets_[tb].partial(ts) = ti->buckets_[fb].partial(fs);
             }
             ti->buckets_[tb].setKV(ts, ti->buckets_[fb].key(fs),
@@ -1102,13 +2308,16 @@ private:
         // table_info.load() after cuckoopath_move, signaling to the outer
         // insert to try again if the comparison fails.
         unlock_two(ti, i1, i2);
+        add_stat(&StatsCounters::cuckoo_runs);
 
         bool done = false;
         while (!done) {
             int depth = cuckoopath_search(ti, cuckoo_path, i1, i2);
             if (depth < 0) {
+                add_stat(&StatsCounters::path_search_failures);
                 break;
             }
+            add_path_depth_stat(depth);
 
             if (cuckoopath_move(ti, cuckoo_path, depth, i1, i2)) {
                 insert_bucket = cuckoo_path[0].bucket;
@@ -1120,6 +2329,7 @@ private:
                 done = true;
                 break;
             }
+            add_stat(&StatsCounters::path_retries);
         }
 
         if (!done) {
@@ -1135,21 +2345,41 @@ private:
         return ok;
     }
 
-    // try_read_from-bucket will search the bucket for the given key and store
-    // the associated value if it finds it.
-    static bool try_read_from_bucket(const TableInfo* ti,
-                                     const partial_t partial,
-                                     const key_type &key, mapped_type &val,
-                                     const size_t i) {
+    // try_read_from_bucket will search the bucket for the given key and call
+    // fn on the associated value if it finds it.
+    template <class K, class F>
+    bool try_read_from_bucket(const TableInfo* ti,
+                              const partial_t partial,
+                              const K &key, F& fn,
+                              const size_t i) {
+        for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
+            if (!ti->buckets_[i].occupied(j)) {
+                continue;
+            }
+            if (use_partials && partial != ti->buckets_[i].partial(j)) {
+                continue;
+            }
+            if (eqfn(key, ti->buckets_[i].key(j))) {
+                fn(static_cast<const mapped_type&>(ti->buckets_[i].val(j)));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // check_in_bucket will search the bucket for the given key, returning
+    // true if it finds it.
+    template <class K>
+    bool check_in_bucket(const TableInfo* ti, const partial_t partial,
+                         const K &key, const size_t i) {
         for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
             if (!ti->buckets_[i].occupied(j)) {
                 continue;
             }
-            if (!is_simple && partial != ti->buckets_[i].partial(j)) {
+            if (use_partials && partial != ti->buckets_[i].partial(j)) {
                 continue;
             }
             if (eqfn(key, ti->buckets_[i].key(j))) {
-                val = ti->buckets_[i].val(j);
                 return true;
             }
         }
@@ -1161,7 +2391,7 @@ private:
                               const key_type &key, const mapped_type &val,
                               const size_t i, const size_t j) {
         assert(!ti->buckets_[i].occupied(j));
-        if (!is_simple) {
+        if (use_partials) {
             ti->buckets_[i].partial(j) = partial;
         }
         ti->buckets_[i].setKV(j, key, val);
@@ -1172,14 +2402,14 @@ private:
     // empty slot if it finds one, or -1 if it doesn't. Regardless, it will
     // search the entire bucket and return false if it finds the key already in
     // the table (duplicate key error) and true otherwise.
-    static bool try_find_insert_bucket(
+    bool try_find_insert_bucket(
         TableInfo* ti, const partial_t partial,
         const key_type &key, const size_t i, int& j) {
         j = -1;
         bool found_empty = false;
         for (size_t k = 0; k < SLOT_PER_BUCKET; ++k) {
             if (ti->buckets_[i].occupied(k)) {
-                if (!is_simple && partial != ti->buckets_[i].partial(k)) {
+                if (use_partials && partial != ti->buckets_[i].partial(k)) {
                     continue;
                 }
                 if (eqfn(key, ti->buckets_[i].key(k))) {
@@ -1195,18 +2425,46 @@ private:
         return true;
     }
 
+    // BulkRecord holds an element of the range given to bulk_load, along with
+    // the hash of its key.
+    template <class ForwardIt>
+    struct BulkRecord {
+        ForwardIt it;
+        size_t hv;
+        BulkRecord(ForwardIt i, size_t h): it(i), hv(h) {}
+    };
+
+    // bulk_place adds the element of the record to an empty slot in its first
+    // bucket, without taking any locks. It returns false if the bucket is
+    // full or already holds the key. Either way, the element is left for a
+    // regular insert, which will reject it if it is a duplicate.
+    template <class ForwardIt>
+    bool bulk_place(TableInfo* ti, const BulkRecord<ForwardIt>& r) {
+        const size_t i = index_hash(ti, r.hv);
+        const partial_t partial = partial_key(r.hv);
+        int j;
+        if (!try_find_insert_bucket(ti, partial, r.it->first, i, j) ||
+            j == -1) {
+            return false;
+        }
+        add_to_bucket(ti, partial, r.it->first, r.it->second, i, j);
+        return true;
+    }
+
     // try_del_from_bucket will search the bucket for the given key, and set the
-    // slot of the key to empty if it finds it.
-    static bool try_del_from_bucket(TableInfo* ti, const partial_t partial,
-                                    const key_type &key, const size_t i) {
+    // slot of the key to empty if it finds it, after calling fn on its value.
+    template <class K, class F>
+    bool try_del_from_bucket(TableInfo* ti, const partial_t partial,
+                             const K &key, const size_t i, F& fn) {
         for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
             if (!ti->buckets_[i].occupied(j)) {
                 continue;
             }
-            if (!is_simple && ti->buckets_[i].partial(j) != partial) {
+            if (use_partials && ti->buckets_[i].partial(j) != partial) {
                 continue;
             }
             if (eqfn(ti->buckets_[i].key(j), key)) {
+                fn(ti->buckets_[i].val(j));
                 ti->buckets_[i].eraseKV(j);
                 ti->num_deletes[counterid].num.fetch_add(
                     1, std::memory_order_relaxed);
@@ -1218,14 +2476,14 @@ private:
 
     // try_update_bucket will search the bucket for the given key and change its
     // associated value if it finds it.
-    static bool try_update_bucket(TableInfo* ti, const partial_t partial,
-                                  const key_type &key, const mapped_type &value,
-                                  const size_t i) {
+    bool try_update_bucket(TableInfo* ti, const partial_t partial,
+                           const key_type &key, const mapped_type &value,
+                           const size_t i) {
         for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
             if (!ti->buckets_[i].occupied(j)) {
                 continue;
             }
-            if (!is_simple && ti->buckets_[i].partial(j) != partial) {
+            if (use_partials && ti->buckets_[i].partial(j) != partial) {
                 continue;
             }
             if (eqfn(ti->buckets_[i].key(j), key)) {
@@ -1238,14 +2496,15 @@ private:
 
     // try_update_bucket_fn will search the bucket for the given key and change
     // its associated value with the given function if it finds it.
-    static bool try_update_bucket_fn(TableInfo* ti, const partial_t partial,
-                                     const key_type &key, const updater& fn,
-                                     const size_t i) {
+    template <class K>
+    bool try_update_bucket_fn(TableInfo* ti, const partial_t partial,
+                              const K &key, const updater& fn,
+                              const size_t i) {
         for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
             if (!ti->buckets_[i].occupied(j)) {
                 continue;
             }
-            if (!is_simple && ti->buckets_[i].partial(j) != partial) {
+            if (use_partials && ti->buckets_[i].partial(j) != partial) {
                 continue;
             }
             if (eqfn(ti->buckets_[i].key(j), key)) {
@@ -1259,14 +2518,42 @@ private:
     // cuckoo_find searches the table for the given key and value, storing the
     // value in the val if it finds the key. It expects the locks to be taken
     // and released outside the function.
-    static cuckoo_status cuckoo_find(const key_type& key, mapped_type& val,
-                                     const size_t hv, const TableInfo* ti,
-                                     const size_t i1, const size_t i2) {
+    template <class K>
+    cuckoo_status cuckoo_find(const K& key, mapped_type& val,
+                              const size_t hv, const TableInfo* ti,
+                              const size_t i1, const size_t i2) {
+        auto copy = [&val](const mapped_type& v) {
+            val = v;
+        };
+        return cuckoo_find_fn(key, copy, hv, ti, i1, i2);
+    }
+
+    // cuckoo_find_fn searches the table for the given key and calls fn on its
+    // value if it finds it. It expects the locks to be taken and released
+    // outside the function.
+    template <class K, class F>
+    cuckoo_status cuckoo_find_fn(const K& key, F& fn,
+                                 const size_t hv, const TableInfo* ti,
+                                 const size_t i1, const size_t i2) {
         const partial_t partial = partial_key(hv);
-        if (try_read_from_bucket(ti, partial, key, val, i1)) {
+        if (try_read_from_bucket(ti, partial, key, fn, i1)) {
             return ok;
         }
-        if (try_read_from_bucket(ti, partial, key, val, i2)) {
+        if (try_read_from_bucket(ti, partial, key, fn, i2)) {
+            return ok;
+        }
+        return failure_key_not_found;
+    }
+
+    // cuckoo_contains searches the table for the given key, like cuckoo_find,
+    // without reading its value.
+    template <class K>
+    cuckoo_status cuckoo_contains(const K& key, const size_t hv,
+                                  const TableInfo* ti,
+                                  const size_t i1, const size_t i2) {
+        const partial_t partial = partial_key(hv);
+        if (check_in_bucket(ti, partial, key, i1) ||
+            check_in_bucket(ti, partial, key, i2)) {
             return ok;
         }
         return failure_key_not_found;
@@ -1296,11 +2583,13 @@ private:
         if (res1 != -1) {
             add_to_bucket(ti, partial, key, val, i1, res1);
             unlock_two(ti, i1, i2);
+            add_stat(&StatsCounters::insert_fast_path);
             return ok;
         }
         if (res2 != -1) {
             add_to_bucket(ti, partial, key, val, i2, res2);
             unlock_two(ti, i1, i2);
+            add_stat(&StatsCounters::insert_fast_path);
             return ok;
         }
 
@@ -1324,6 +2613,7 @@ private:
             // check for that before doing the insert.
             if (cuckoo_find(key, oldval, hv, ti, i1, i2) == ok) {
                 unlock_two(ti, i1, i2);
+                add_stat(&StatsCounters::duplicate_rechecks);
                 return failure_key_duplicated;
             }
             add_to_bucket(ti, partial, key, val, insert_bucket, insert_slot);
@@ -1337,6 +2627,21 @@ private:
         return failure_table_full;
     }
 
+    // cuckoo_insert_hashed inserts the key-value pair into the table, given
+    // the hash value of the key. It is the body of insert, which is also used
+    // to insert elements into the table that aren't operations of the user,
+    // and so shouldn't be traced.
+    bool cuckoo_insert_hashed(const key_type& key, const mapped_type& val,
+                              const size_t hv) {
+        check_hazard_pointer();
+        check_counterid();
+        TableInfo* ti;
+        size_t i1, i2;
+        std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
+        HazardPointerUnsetter hpu;
+        return cuckoo_insert_loop(key, val, hv, ti, i1, i2);
+    }
+
     // We run cuckoo_insert in a loop until it succeeds in insert and upsert, so
     // we pulled out the loop to avoid duplicating it. This should be called
     // directly after snapshot_and_lock_two, and by the end of the function, the
@@ -1352,11 +2657,22 @@ private:
             // If it failed with failure_under_expansion, the insert operated on
             // an old version of the table, so we just try again. If it's
             // failure_table_full, we have to expand the table before trying
-            // again.
-            if (st == failure_table_full) {
-                if (cuckoo_expand_simple(ti->hashpower_+1) ==
-                    failure_under_expansion) {
+            // again, unless the table is so empty that the hash values are
+            // more likely to blame than its size, in which case we rebuild it
+            // with a new seed first.
+            if (st == failure_under_expansion) {
+                add_stat(&StatsCounters::expansion_retries);
+            } else if (st == failure_table_full) {
+                if (!ti->reseeded_ && !ti->shared_ &&
+                    cuckoo_loadfactor(ti) < RESEED_LOAD_FACTOR) {
+                    st = cuckoo_reseed(ti->hashpower_, ti->seed_);
+                } else {
+                    st = cuckoo_expand_simple(ti->hashpower_+1);
+                }
+                if (st == failure_under_expansion) {
                     LIBCUCKOO_DBG("expansion is on-going\n");
+                } else if (st == failure_function_not_supported) {
+                    throw std::runtime_error("shared table is full");
                 }
             }
             std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
@@ -1366,16 +2682,17 @@ private:
     }
 
     // cuckoo_delete searches the table for the given key and sets the slot with
-    // that key to empty if it finds it. It expects the locks to be taken and
-    // released outside the function.
-    cuckoo_status cuckoo_delete(const key_type &key, const size_t hv,
+    // that key to empty if it finds it, calling fn on its value first. It
+    // expects the locks to be taken and released outside the function.
+    template <class K, class F>
+    cuckoo_status cuckoo_delete(const K &key, const size_t hv,
                                 TableInfo* ti, const size_t i1,
-                                const size_t i2) {
+                                const size_t i2, F& fn) {
         const partial_t partial = partial_key(hv);
-        if (try_del_from_bucket(ti, partial, key, i1)) {
+        if (try_del_from_bucket(ti, partial, key, i1, fn)) {
             return ok;
         }
-        if (try_del_from_bucket(ti, partial, key, i2)) {
+        if (try_del_from_bucket(ti, partial, key, i2, fn)) {
             return ok;
         }
         return failure_key_not_found;
@@ -1401,7 +2718,8 @@ private:
     // function on its value if it finds it, assigning the result of the
     // function to the value. It expects the locks to be taken and released
     // outside the function.
-    cuckoo_status cuckoo_update_fn(const key_type &key, const updater& fn,
+    template <class K>
+    cuckoo_status cuckoo_update_fn(const K &key, const updater& fn,
                                      const size_t hv, TableInfo* ti,
                                      const size_t i1, const size_t i2) {
         const partial_t partial = partial_key(hv);
@@ -1422,14 +2740,319 @@ private:
         return ok;
     }
 
+    static const uint64_t kSharedVersion = 1;
+
+    // cuckoo_open_shared maps the table stored in the file at path, creating
+    // and initializing a table with the given hashpower if the file doesn't
+    // exist. Exactly one process succeeds in creating the file. Any other
+    // process opening it at the same time waits until the creator has marked
+    // the table ready before using it.
+    static TableInfo* cuckoo_open_shared(const std::string& path,
+                                         size_t hashpower) {
+        bool created = true;
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+        if (fd < 0 && errno == EEXIST) {
+            created = false;
+            fd = open(path.c_str(), O_RDWR);
+        }
+        if (fd < 0) {
+            throw std::runtime_error("cannot open " + path + ": " +
+                                     strerror(errno));
+        }
+
+        size_t region_size = TableLayout(hashpower).total;
+        if (created) {
+            if (ftruncate(fd, region_size) != 0) {
+                const int err = errno;
+                close(fd);
+                unlink(path.c_str());
+                throw std::runtime_error("cannot size " + path + ": " +
+                                         strerror(err));
+            }
+        } else {
+            // The creator may not have sized the file yet
+            struct stat st;
+            const auto deadline = std::chrono::steady_clock::now() +
+                std::chrono::seconds(10);
+            while (fstat(fd, &st) == 0 &&
+                   static_cast<size_t>(st.st_size) < sizeof(SharedHeader) &&
+                   std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            region_size = st.st_size;
+        }
+
+        void* addr = region_size < sizeof(SharedHeader) ? MAP_FAILED :
+            mmap(nullptr, region_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) {
+            if (created) {
+                unlink(path.c_str());
+            }
+            throw std::runtime_error("cannot map " + path);
+        }
+        char* region = static_cast<char*>(addr);
+        SharedHeader* header = reinterpret_cast<SharedHeader*>(region);
+
+        if (created) {
+            TableInfo* ti = new TableInfo(hashpower, region, region_size);
+            ti->init();
+            fill_shared_header(header, hashpower);
+            header->ready.store(1, std::memory_order_release);
+            return ti;
+        }
+
+        SharedHeader expected;
+        fill_shared_header(&expected, 0);
+
+        const auto deadline = std::chrono::steady_clock::now() +
+            std::chrono::seconds(10);
+        while (header->ready.load(std::memory_order_acquire) == 0 &&
+               std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (header->ready.load(std::memory_order_acquire) == 0 ||
+            memcmp(header->magic, expected.magic, sizeof(header->magic)) != 0 ||
+            header->version != expected.version ||
+            header->slot_per_bucket != expected.slot_per_bucket ||
+            header->key_size != expected.key_size ||
+            header->mapped_size != expected.mapped_size ||
+            header->bucket_size != expected.bucket_size ||
+            header->num_locks != expected.num_locks ||
+            header->num_counters != expected.num_counters ||
+            header->partial_bits != expected.partial_bits ||
+            header->hashpower >= std::numeric_limits<size_t>::digits ||
+            TableLayout(header->hashpower).total != region_size) {
+            munmap(region, region_size);
+            throw std::runtime_error(path + " does not hold a compatible "
+                                     "shared cuckoohash_map");
+        }
+        return new TableInfo(header->hashpower, region, region_size);
+    }
+
+    // fill_shared_header fills in every field of header except ready, to
+    // describe a shared table of this type with the given hashpower.
+    static void fill_shared_header(SharedHeader* header,
+                                   const size_t hashpower) {
+        memcpy(header->magic, "cuckoosh", sizeof(header->magic));
+        header->version = kSharedVersion;
+        header->slot_per_bucket = SLOT_PER_BUCKET;
+        header->key_size = sizeof(key_type);
+        header->mapped_size = sizeof(mapped_type);
+        header->bucket_size = sizeof(Bucket);
+        header->num_locks = kNumLocks;
+        header->num_counters = kNumCores;
+        header->partial_bits = kPartialBits;
+        header->hashpower = hashpower;
+    }
+
+    // true if the key and mapped types can be saved and loaded by copying the
+    // buckets byte for byte
+    static const bool is_trivially_serializable =
+        std::is_trivially_copyable<key_type>::value &&
+        std::is_trivially_copyable<mapped_type>::value;
+
+    // SaveHeader is written at the start of every file created by save. Apart
+    // from the size of the table, it records enough about the layout of the
+    // buckets for load to reject files written by an incompatible table.
+    struct SaveHeader {
+        char magic[8];
+        uint64_t version;
+        uint64_t trivial;
+        uint64_t slot_per_bucket;
+        uint64_t key_size;
+        uint64_t mapped_size;
+        uint64_t bucket_size;
+        uint64_t hashpower;
+        uint64_t size;
+        uint64_t seed;
+        uint64_t partial_bits;
+    };
+
+    static const uint64_t kSaveVersion = 1;
+
+    // TrivialSerializer selects the save and load routines that copy the
+    // bucket array byte for byte.
+    struct TrivialSerializer {};
+
+    // cuckoo_save writes the table to path, holding all the locks on the
+    // table while it does so.
+    template <class Serializer>
+    void cuckoo_save(const std::string& path, Serializer& serializer) {
+        std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("cannot open " + path + " for writing");
+        }
+        check_hazard_pointer();
+        TableInfo* ti = snapshot_and_lock_all();
+        AllUnlocker au(ti);
+        HazardPointerUnsetter hpu;
+
+        SaveHeader header = save_header<Serializer>();
+        header.hashpower = ti->hashpower_;
+        header.size = cuckoo_size(ti);
+        header.seed = ti->seed_;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        save_buckets(out, ti, serializer);
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("error writing table to " + path);
+        }
+    }
+
+    // cuckoo_load reads a table written by cuckoo_save into a new TableInfo,
+    // putting every element back into the slot it was saved from, and then
+    // replaces the current TableInfo with it, as in cuckoo_expand_simple.
+    template <class Serializer>
+    void cuckoo_load(const std::string& path, Serializer& serializer) {
+        std::ifstream in(path.c_str(), std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("cannot open " + path + " for reading");
+        }
+        SaveHeader header;
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+        const SaveHeader expected = save_header<Serializer>();
+        if (!in || memcmp(header.magic, expected.magic,
+                          sizeof(header.magic)) != 0 ||
+            header.version != expected.version) {
+            throw std::runtime_error(path + " is not a saved cuckoohash_map");
+        }
+        if (header.trivial != expected.trivial ||
+            header.slot_per_bucket != expected.slot_per_bucket ||
+            header.key_size != expected.key_size ||
+            header.mapped_size != expected.mapped_size ||
+            header.bucket_size != expected.bucket_size ||
+            header.partial_bits != expected.partial_bits ||
+            header.hashpower >= std::numeric_limits<size_t>::digits) {
+            throw std::runtime_error(path + " was saved by an incompatible "
+                                     "cuckoohash_map");
+        }
+
+        std::unique_ptr<TableInfo> new_ti(new TableInfo(header.hashpower));
+        new_ti->seed_ = header.seed;
+        load_buckets(in, new_ti.get(), serializer);
+        if (!in) {
+            throw std::runtime_error("error reading table from " + path);
+        }
+        new_ti->num_inserts[0].num.store(header.size);
+
+        check_hazard_pointer();
+        TableInfo* ti = snapshot_and_lock_all();
+        AllUnlocker au(ti);
+        HazardPointerUnsetter hpu;
+        if (ti->shared_) {
+            throw std::runtime_error("cannot load into a shared table");
+        }
+        table_info.store(new_ti.release());
+        old_table_infos.push_back(std::move(std::unique_ptr<TableInfo>(ti)));
+        global_hazard_pointers.delete_unused(old_table_infos);
+    }
+
+    // save_buckets writes the bucket array of a trivially serializable table
+    // as it is laid out in memory.
+    static void save_buckets(std::ostream& out, const TableInfo* ti,
+                             TrivialSerializer&) {
+        out.write(reinterpret_cast<const char*>(&ti->buckets_[0]),
+                  hashsize(ti->hashpower_) * sizeof(Bucket));
+    }
+
+    // load_buckets reads a bucket array written by the trivial save_buckets
+    // straight into the buckets of ti.
+    static void load_buckets(std::istream& in, TableInfo* ti,
+                             TrivialSerializer&) {
+        in.read(reinterpret_cast<char*>(&ti->buckets_[0]),
+                hashsize(ti->hashpower_) * sizeof(Bucket));
+    }
+
+    // This version of save_buckets writes an occupancy mask for each bucket,
+    // followed by the partial key (if the table uses them) and the serialized
+    // key-value pair of each occupied slot.
+    template <class Serializer>
+    static void save_buckets(std::ostream& out, const TableInfo* ti,
+                             Serializer& serializer) {
+        const size_t num_buckets = hashsize(ti->hashpower_);
+        for (size_t i = 0; i < num_buckets && out; ++i) {
+            const Bucket& b = ti->buckets_[i];
+            uint64_t mask = 0;
+            for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
+                if (b.occupied(j)) {
+                    mask |= 1ULL << j;
+                }
+            }
+            out.write(reinterpret_cast<const char*>(&mask), sizeof(mask));
+            for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
+                if (b.occupied(j)) {
+                    if (use_partials) {
+                        out.write(reinterpret_cast<const char*>(
+                                      &b.partial(j)), sizeof(partial_t));
+                    }
+                    serializer.save(out, b.key(j), b.val(j));
+                }
+            }
+        }
+    }
+
+    // This version of load_buckets reads back the buckets written by the
+    // serializer version of save_buckets. It stops at the first failed read,
+    // leaving the slot it was reading empty, and the caller checks the
+    // stream.
+    template <class Serializer>
+    static void load_buckets(std::istream& in, TableInfo* ti,
+                             Serializer& serializer) {
+        const size_t num_buckets = hashsize(ti->hashpower_);
+        key_type k;
+        mapped_type v;
+        for (size_t i = 0; i < num_buckets; ++i) {
+            Bucket& b = ti->buckets_[i];
+            uint64_t mask;
+            in.read(reinterpret_cast<char*>(&mask), sizeof(mask));
+            if (!in) {
+                return;
+            }
+            for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
+                if (mask & (1ULL << j)) {
+                    if (use_partials) {
+                        in.read(reinterpret_cast<char*>(&b.partial(j)),
+                                sizeof(partial_t));
+                    }
+                    serializer.load(in, k, v);
+                    if (!in) {
+                        return;
+                    }
+                    b.setKV(j, k, v);
+                }
+            }
+        }
+    }
+
+    // save_header returns a SaveHeader describing this table type and the
+    // given serializer, with the hashpower and size left for the caller to
+    // fill in.
+    template <class Serializer>
+    static SaveHeader save_header() {
+        SaveHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "cuckoohm", sizeof(header.magic));
+        header.version = kSaveVersion;
+        header.trivial = std::is_same<Serializer, TrivialSerializer>::value;
+        header.slot_per_bucket = SLOT_PER_BUCKET;
+        header.key_size = sizeof(key_type);
+        header.mapped_size = sizeof(mapped_type);
+        header.bucket_size = sizeof(Bucket);
+        header.partial_bits = kPartialBits;
+        return header;
+    }
+
     // cuckoo_clear empties the table, calling the destructors of all the
     // elements it removes from the table. It assumes the locks are taken as
     // necessary.
     cuckoo_status cuckoo_clear(TableInfo* ti) {
-        const size_t num_buckets = ti->buckets_.size();
-        ti->buckets_.clear();
-        ti->buckets_.resize(num_buckets);
-        for (size_t i = 0; i < ti->num_inserts.size(); ++i) {
+        for (size_t i = 0; i < hashsize(ti->hashpower_); ++i) {
+            ti->buckets_[i].~Bucket();
+            new (&ti->buckets_[i]) Bucket();
+        }
+        for (size_t i = 0; i < kNumCores; ++i) {
             ti->num_inserts[i].num.store(0);
             ti->num_deletes[i].num.store(0);
         }
@@ -1440,7 +3063,7 @@ private:
     size_t cuckoo_size(const TableInfo* ti) {
         size_t inserts = 0;
         size_t deletes = 0;
-        for (size_t i = 0; i < ti->num_inserts.size(); ++i) {
+        for (size_t i = 0; i < kNumCores; ++i) {
             inserts += ti->num_inserts[i].num.load();
             deletes += ti->num_deletes[i].num.load();
         }
@@ -1456,24 +3079,89 @@ private:
     // insert_into_table is a helper function used by cuckoo_expand_simple to
     // fill up the new table.
     static void insert_into_table(
-        cuckoohash_map<Key, T, Hash>& new_map, const TableInfo* old_ti,
+        cuckoohash_map& new_map, const TableInfo* old_ti,
         size_t i, size_t end) {
         for (;i < end; ++i) {
             for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
                 if (old_ti->buckets_[i].occupied(j)) {
-                    new_map.insert(old_ti->buckets_[i].key(j),
-                                   old_ti->buckets_[i].val(j));
+                    const key_type& key = old_ti->buckets_[i].key(j);
+                    new_map.cuckoo_insert_hashed(
+                        key, old_ti->buckets_[i].val(j),
+                        new_map.hashed_key(key));
                 }
             }
         }
     }
 
+    // for_each_in_range calls fn on every element in the buckets [begin, end).
+    // Scanning the table is bound by memory bandwidth, so it prefetches the
+    // buckets a few positions ahead of the one it is reading.
+    template <class F>
+    static void for_each_in_range(const TableInfo* ti, size_t begin,
+                                  const size_t end, F& fn) {
+        for (; begin < end; ++begin) {
+            if (begin + kPrefetchDistance < end) {
+                const char* ahead = reinterpret_cast<const char*>(
+                    &ti->buckets_[begin + kPrefetchDistance]);
+                for (size_t off = 0; off < sizeof(Bucket); off += 64) {
+                    __builtin_prefetch(ahead + off);
+                }
+            }
+            const Bucket& b = ti->buckets_[begin];
+            for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
+                if (b.occupied(j)) {
+                    fn(b.key(j), b.val(j));
+                }
+            }
+        }
+    }
+
+    // for_each_key_in_range calls fn on the key of every element in the
+    // buckets [begin, end), passing it by mutable reference.
+    template <class F>
+    static void for_each_key_in_range(TableInfo* ti, size_t begin,
+                                      const size_t end, F& fn) {
+        for (; begin < end; ++begin) {
+            Bucket& b = ti->buckets_[begin];
+            for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
+                if (b.occupied(j)) {
+                    fn(b.key(j));
+                }
+            }
+        }
+    }
+
+    // run_on_bucket_ranges splits the buckets of the table into nthreads
+    // contiguous ranges and calls fn(range_num, begin, end) on each one in
+    // its own thread, returning once all of them have finished. It never uses
+    // more threads than there are buckets. The caller is expected to hold the
+    // locks the ranges need.
+    template <class F>
+    static void run_on_bucket_ranges(const TableInfo* ti, size_t nthreads,
+                                     F fn) {
+        const size_t num_buckets = hashsize(ti->hashpower_);
+        nthreads = std::max<size_t>(1, std::min(nthreads, num_buckets));
+        const size_t buckets_per_thread = num_buckets / nthreads;
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < nthreads-1; ++i) {
+            threads.emplace_back(fn, i, i*buckets_per_thread,
+                                 (i+1)*buckets_per_thread);
+        }
+        threads.emplace_back(fn, nthreads-1, (nthreads-1)*buckets_per_thread,
+                             num_buckets);
+        for (size_t i = 0; i < threads.size(); ++i) {
+            threads[i].join();
+        }
+    }
+
     // cuckoo_expand_simple is a simpler version of expansion than
     // cuckoo_expand, which will double the size of the existing hash table. It
     // needs to take all the bucket locks, since no other operations can change
     // the table during expansion. If some other thread is holding the expansion
-    // thread at the time, then it will return failure_under_expansion.
-    cuckoo_status cuckoo_expand_simple(size_t n) {
+    // thread at the time, then it will return failure_under_expansion. The
+    // elements are moved to the new table by nthreads threads.
+    cuckoo_status cuckoo_expand_simple(size_t n,
+                                       size_t nthreads = kNumCores) {
         TableInfo* ti = snapshot_and_lock_all();
         assert(ti == table_info.load());
         AllUnlocker au(ti);
@@ -1483,25 +3171,57 @@ private:
             // locks
             return failure_under_expansion;
         }
+        if (ti->shared_) {
+            return failure_function_not_supported;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        rebuild_table(ti, n, ti->seed_, false, nthreads);
+        add_expansion_stat(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        return ok;
+    }
 
-        // Creates a new hash table with hashpower n and adds all the
-        // elements from the old buckets
-        cuckoohash_map<Key, T, Hash> new_map(hashsize(n) * SLOT_PER_BUCKET);
-        const size_t threadnum = kNumCores;
-        const size_t buckets_per_thread =
-            hashsize(ti->hashpower_) / threadnum;
-        std::vector<std::thread> insertion_threads(threadnum);
-        for (size_t i = 0; i < threadnum-1; ++i) {
-            insertion_threads[i] = std::thread(
-                insert_into_table, std::ref(new_map),
-                ti, i*buckets_per_thread, (i+1)*buckets_per_thread);
-        }
-        insertion_threads[threadnum-1] = std::thread(
-            insert_into_table, std::ref(new_map), ti,
-            (threadnum-1)*buckets_per_thread, hashsize(ti->hashpower_));
-        for (size_t i = 0; i < threadnum; ++i) {
-            insertion_threads[i].join();
+    // cuckoo_reseed rebuilds the table at the same hashpower with a new seed
+    // mixed into the first bucket of every key. It is run instead of an
+    // expansion when an insert fails while the table is still mostly empty,
+    // which happens when the hashes of many keys agree in the bits that pick
+    // their buckets. The hashed keys themselves don't change, so hashes
+    // computed before the reseed, or passed to the _hashed operations, stay
+    // valid. If the table was changed since the failed insert saw it with the
+    // given hashpower and seed, it returns failure_under_expansion.
+    cuckoo_status cuckoo_reseed(const size_t hashpower, const size_t seed) {
+        TableInfo* ti = snapshot_and_lock_all();
+        assert(ti == table_info.load());
+        AllUnlocker au(ti);
+        HazardPointerUnsetter hpu;
+        if (ti->hashpower_ != hashpower || ti->seed_ != seed) {
+            return failure_under_expansion;
         }
+        if (ti->shared_) {
+            return failure_function_not_supported;
+        }
+        rebuild_table(ti, hashpower, next_seed(seed), true, kNumCores);
+        add_stat(&StatsCounters::reseeds);
+        return ok;
+    }
+
+    // rebuild_table moves the elements of ti into a new table with the given
+    // hashpower and seed, using nthreads threads, and makes it the current
+    // one. The caller must hold all the locks on ti.
+    void rebuild_table(TableInfo* ti, const size_t hashpower,
+                       const size_t seed, const bool reseeded,
+                       const size_t nthreads) {
+        // Creates a new hash table with the same hash function and predicate
+        // and adds all the elements from the old buckets
+        cuckoohash_map new_map(
+            hashsize(hashpower) * SLOT_PER_BUCKET, hashfn, eqfn);
+        new_map.table_info.load()->seed_ = seed;
+        new_map.table_info.load()->reseeded_ = reseeded;
+        run_on_bucket_ranges(ti, nthreads,
+                             [&new_map, ti](size_t, size_t begin, size_t end) {
+                                 insert_into_table(new_map, ti, begin, end);
+                             });
         // Sets this table_info to new_map's. It then sets new_map's
         // table_info to nullptr, so that it doesn't get deleted when
         // new_map goes out of scope
@@ -1512,12 +3232,12 @@ private:
         // run a delete_unused routine to delete all the old table pointers.
         old_table_infos.push_back(std::move(std::unique_ptr<TableInfo>(ti)));
         global_hazard_pointers.delete_unused(old_table_infos);
-        return ok;
     }
 
     // Iterator definitions
     friend class const_iterator;
     friend class iterator;
+    friend class weak_const_iterator;
 
 public:
     //! A const_iterator is an iterator through the table that is thread safe.
@@ -1542,8 +3262,8 @@ public:
         // table, based on the boolean argument. We keep this constructor
         // private (but expose it to the cuckoohash_map class), since we don't
         // want users calling it.
-        const_iterator(cuckoohash_map<Key, T, Hash, Pred>* hm, bool is_end) {
-            cuckoohash_map<Key, T, Hash, Pred>::check_hazard_pointer();
+        const_iterator(cuckoohash_map* hm, bool is_end) {
+            cuckoohash_map::check_hazard_pointer();
             hm_ = hm;
             ti_ = hm_->snapshot_and_lock_all();
             assert(ti_ == hm_->table_info.load());
@@ -1563,7 +3283,7 @@ public:
             }
         }
 
-        friend class cuckoohash_map<Key, T, Hash, Pred>;
+        friend class cuckoohash_map;
 
     public:
         //! This is an rvalue-reference constructor that takes the lock from \p
@@ -1594,7 +3314,7 @@ public:
         void release() {
             if (has_table_lock) {
                 AllUnlocker au(ti_);
-                cuckoohash_map<Key, T, Hash, Pred>::HazardPointerUnsetter hpu;
+                cuckoohash_map::HazardPointerUnsetter hpu;
                 has_table_lock = false;
             }
         }
@@ -1706,10 +3426,10 @@ public:
 
     protected:
         // A pointer to the associated hashmap
-        cuckoohash_map<Key, T, Hash, Pred>* hm_;
+        cuckoohash_map* hm_;
 
         // The hashmap's table info
-        typename cuckoohash_map<Key, T, Hash, Pred>::TableInfo* ti_;
+        typename cuckoohash_map::TableInfo* ti_;
 
         // Indicates whether the iterator has the table lock
         bool has_table_lock;
@@ -1843,10 +3563,10 @@ public:
     class iterator : public const_iterator {
         // This constructor does the same thing as the private const_iterator
         // one.
-        iterator(cuckoohash_map<Key, T, Hash, Pred>* hm, bool is_end)
+        iterator(cuckoohash_map* hm, bool is_end)
             : const_iterator(hm, is_end) {}
 
-        friend class cuckoohash_map<Key, T, Hash, Pred>;
+        friend class cuckoohash_map;
 
     public:
         //! This constructor is identical to the rvalue-reference constructor of
@@ -1884,6 +3604,148 @@ public:
         }
     };
 
+    //! A weak_const_iterator is a weakly consistent iterator through the
+    //! table, meant for scans over tables that are being modified
+    //! concurrently. Unlike \ref const_iterator, it never holds more than one
+    //! lock at a time: it locks a single stripe of the lock array, copies out
+    //! every element in the buckets guarded by that stripe, and unlocks it
+    //! again before handing the elements out. Other operations therefore only
+    //! stall for as long as it takes to copy one stripe. Each stripe is read
+    //! from the most recent version of the table. An expansion, reseed or
+    //! \ref load rebuilds the table, which can move any element to a stripe
+    //! the iterator has already passed, so when the iterator finds the table
+    //! has been rebuilt it starts over from the first stripe of the new
+    //! table. An element that stays in the table for the whole iteration is
+    //! therefore not missed because of a rebuild, but may be returned once
+    //! more for every rebuild. Cuckoo inserts into the current table are not
+    //! tracked, though: an element that an insert displaces from a stripe the
+    //! iterator hasn't reached into one it has passed is missed, and one
+    //! displaced the other way may be returned twice. Elements that are
+    //! inserted or erased while the iterator is in use may or may not be
+    //! returned. Every element it does return was in the table at some point
+    //! during the iteration. The iterator only moves forward.
+    class weak_const_iterator {
+        // The constructor loads the first nonempty stripe of the table. We
+        // keep it private (but expose it to the cuckoohash_map class), since
+        // we don't want users calling it.
+        weak_const_iterator(cuckoohash_map* hm)
+            : hm_(hm), stripe_(0), pos_(0), ti_(nullptr), hashpower_(0),
+              seed_(0) {
+            load_next_stripe();
+        }
+
+        friend class cuckoohash_map;
+
+    public:
+        //! is_end returns true if the iterator has moved past the last stripe
+        //! of the table.
+        bool is_end() const {
+            return pos_ == items_.size();
+        }
+
+        //! The dereference operator returns a reference to the copy of the
+        //! key-value pair under the iterator. It throws an exception if the
+        //! iterator is at the end of the table.
+        const value_type& operator*() const {
+            if (is_end()) {
+                throw const_iterator::end_dereference;
+            }
+            return items_[pos_];
+        }
+
+        //! The arrow dereference operator returns a pointer to the copy of the
+        //! key-value pair under the iterator.
+        const value_type* operator->() const {
+            return &(**this);
+        }
+
+        //! The prefix increment operator moves the iterator to the next
+        //! element, loading more stripes from the table as needed. If there
+        //! are no elements left, it becomes an end iterator. It throws an
+        //! exception if the iterator is already at the end of the table.
+        weak_const_iterator* operator++() {
+            if (is_end()) {
+                throw const_iterator::end_increment;
+            }
+            if (++pos_ == items_.size()) {
+                load_next_stripe();
+            }
+            return this;
+        }
+
+        //! The postfix increment operator behaves identically to the prefix
+        //! increment operator.
+        weak_const_iterator* operator++(int) {
+            return ++(*this);
+        }
+
+    private:
+        // A pointer to the associated hashmap
+        cuckoohash_map* hm_;
+
+        // The index in locks_ of the next stripe to load
+        size_t stripe_;
+
+        // The elements copied out of the most recently loaded stripe
+        std::vector<value_type> items_;
+
+        // The position in items_ of the element being pointed to
+        size_t pos_;
+
+        // The table the previous stripes were read from. It is only compared
+        // against, never dereferenced, since the iterator doesn't hold a
+        // hazard pointer between stripes. Its hashpower and seed are kept
+        // too, because a later table could be allocated at the same address.
+        const TableInfo* ti_;
+        size_t hashpower_;
+        size_t seed_;
+
+        // load_next_stripe replaces items_ with the contents of the next
+        // nonempty stripe, starting at stripe_. If every remaining stripe is
+        // empty, items_ is left empty, which makes this an end iterator. A
+        // table with fewer than kNumLocks buckets only uses its first few
+        // stripes, so the bound is rechecked against each table snapshot,
+        // since the table can grow during the iteration. If the table has
+        // been rebuilt since the previous stripe, the scan starts over from
+        // the first stripe of the new table.
+        void load_next_stripe() {
+            items_.clear();
+            pos_ = 0;
+            cuckoohash_map::check_hazard_pointer();
+            while (items_.empty() && stripe_ < kNumLocks) {
+                TableInfo* ti = hm_->snapshot_and_lock_stripe(stripe_);
+                HazardPointerUnsetter hpu;
+                if (ti != ti_ || ti->hashpower_ != hashpower_ ||
+                    ti->seed_ != seed_) {
+                    const bool rebuilt = ti_ != nullptr;
+                    ti_ = ti;
+                    hashpower_ = ti->hashpower_;
+                    seed_ = ti->seed_;
+                    if (rebuilt && stripe_ != 0) {
+                        ti->locks_[stripe_].unlock();
+                        stripe_ = 0;
+                        continue;
+                    }
+                }
+                const size_t num_buckets = hashsize(ti->hashpower_);
+                if (stripe_ >= num_buckets) {
+                    ti->locks_[stripe_].unlock();
+                    return;
+                }
+                for (size_t i = stripe_; i < num_buckets; i += kNumLocks) {
+                    for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
+                        if (ti->buckets_[i].occupied(j)) {
+                            items_.emplace_back(ti->buckets_[i].key(j),
+                                                ti->buckets_[i].val(j));
+                        }
+                    }
+                }
+                ti->locks_[stripe_].unlock();
+                ++stripe_;
+            }
+        }
+    };
+
 // Public iterator functions
 public:
     //! cbegin returns a const_iterator to the first filled slot in the
@@ -1907,56 +3769,153 @@ public:
         return iterator(this, true);
     }
 
-    //! snapshot_table allocates a vector and, using a const_iterator stores all
-    //! the elements currently in the table.
-    std::vector<value_type> snapshot_table() {
+    //! weak_cbegin returns a weak_const_iterator to the first element of the
+    //! first nonempty stripe of the table.
+    weak_const_iterator weak_cbegin() {
+        return weak_const_iterator(this);
+    }
+
+    //! snapshot_table allocates a vector and stores all the elements
+    //! currently in the table in it. It takes all the locks on the table and
+    //! copies the buckets with \p nthreads threads, each of which copies a
+    //! contiguous range of buckets. Since it stalls concurrent writers for
+    //! the duration of the copy, use a \ref weak_const_iterator for scans of
+    //! tables that are being modified.
+    std::vector<value_type> snapshot_table(size_t nthreads = kNumCores) {
+        check_hazard_pointer();
+        TableInfo* ti = snapshot_and_lock_all();
+        AllUnlocker au(ti);
+        HazardPointerUnsetter hpu;
+        std::vector<std::vector<value_type> > ranges(
+            std::max<size_t>(1, nthreads));
+        run_on_bucket_ranges(
+            ti, nthreads,
+            [ti, &ranges](size_t range, size_t begin, size_t end) {
+                std::vector<value_type>& items = ranges[range];
+                auto copy_fn = [&items](const key_type& k,
+                                        const mapped_type& v) {
+                    items.emplace_back(k, v);
+                };
+                for_each_in_range(ti, begin, end, copy_fn);
+            });
         std::vector<value_type> items;
-        items.reserve(size());
-        for (auto it = cbegin(); !it.is_end(); ++it) {
-            items.push_back(*it);
+        items.reserve(cuckoo_size(ti));
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            std::move(ranges[i].begin(), ranges[i].end(),
+                      std::back_inserter(items));
         }
         return items;
     }
+
+    //! parallel_for_each calls \p fn on every key-value pair in the table,
+    //! using \p nthreads threads that each scan a contiguous range of
+    //! buckets. \p fn must accept arguments of type const key_type& and const
+    //! mapped_type&, must be safe to call from several threads at once, and
+    //! must not throw or call any method of the table. Like \ref
+    //! snapshot_table, it holds all the locks on the table until every thread
+    //! has finished.
+    template <class F>
+    void parallel_for_each(F fn, size_t nthreads = kNumCores) {
+        check_hazard_pointer();
+        TableInfo* ti = snapshot_and_lock_all();
+        AllUnlocker au(ti);
+        HazardPointerUnsetter hpu;
+        run_on_bucket_ranges(
+            ti, nthreads, [ti, &fn](size_t, size_t begin, size_t end) {
+                for_each_in_range(ti, begin, end, fn);
+            });
+    }
+
+    //! parallel_rewrite_keys calls \p fn on every key in the table, passing
+    //! it as a mutable key_type&, using \p nthreads threads like \ref
+    //! parallel_for_each. It is meant for keys that refer to memory outside
+    //! the table, which the owner of that memory needs to move, as
+    //! cuckoohash_string_map does when it compacts its arena. \p fn may
+    //! change how a key is represented, but the key must still hash to the
+    //! same value and compare equal to the same keys afterwards. The same
+    //! restrictions on \p fn and locking apply as for \ref parallel_for_each.
+    template <class F>
+    void parallel_rewrite_keys(F fn, size_t nthreads = kNumCores) {
+        check_hazard_pointer();
+        TableInfo* ti = snapshot_and_lock_all();
+        AllUnlocker au(ti);
+        HazardPointerUnsetter hpu;
+        run_on_bucket_ranges(
+            ti, nthreads, [ti, &fn](size_t, size_t begin, size_t end) {
+                for_each_key_in_range(ti, begin, end, fn);
+            });
+    }
+
+    //! parallel_reduce folds every key-value pair in the table into a single
+    //! result, using \p nthreads threads that each scan a contiguous range of
+    //! buckets. Each thread starts from \p init and folds its elements in with
+    //! \p fn, which is called as fn(acc, key, val) and returns the new
+    //! accumulated value. The per-thread results are then combined with \p
+    //! combine, which is called as combine(acc1, acc2). \p init must therefore
+    //! be an identity of \p combine. The same restrictions on the functions
+    //! and locking apply as for \ref parallel_for_each.
+    template <class R, class F, class C>
+    R parallel_reduce(const R& init, F fn, C combine,
+                      size_t nthreads = kNumCores) {
+        check_hazard_pointer();
+        TableInfo* ti = snapshot_and_lock_all();
+        AllUnlocker au(ti);
+        HazardPointerUnsetter hpu;
+        std::vector<R> results(std::max<size_t>(1, nthreads), init);
+        run_on_bucket_ranges(
+            ti, nthreads,
+            [ti, &fn, &results](size_t range, size_t begin, size_t end) {
+                R& acc = results[range];
+                auto fold_fn = [&acc, &fn](const key_type& k,
+                                           const mapped_type& v) {
+                    acc = fn(acc, k, v);
+                };
+                for_each_in_range(ti, begin, end, fold_fn);
+            });
+        R result = results[0];
+        for (size_t i = 1; i < results.size(); ++i) {
+            result = combine(result, results[i]);
+        }
+        return result;
+    }
 };
 
 // Initializing the static members
-template <class Key, class T, class Hash, class Pred>
-    __thread typename cuckoohash_map<Key, T, Hash, Pred>::TableInfo**
-    cuckoohash_map<Key, T, Hash, Pred>::hazard_pointer = nullptr;
-
-template <class Key, class T, class Hash, class Pred>
-    __thread int cuckoohash_map<Key, T, Hash, Pred>::counterid = -1;
-
-template <class Key, class T, class Hash, class Pred>
-    typename cuckoohash_map<Key, T, Hash, Pred>::hasher
-    cuckoohash_map<Key, T, Hash, Pred>::hashfn;
-
-template <class Key, class T, class Hash, class Pred>
-    typename cuckoohash_map<Key, T, Hash, Pred>::key_equal
-    cuckoohash_map<Key, T, Hash, Pred>::eqfn;
-
-template <class Key, class T, class Hash, class Pred>
-    typename cuckoohash_map<Key, T, Hash, Pred>::GlobalHazardPointerList
-    cuckoohash_map<Key, T, Hash, Pred>::global_hazard_pointers;
-
-template <class Key, class T, class Hash, class Pred>
-    const size_t cuckoohash_map<Key, T, Hash, Pred>::kNumCores =
+template <class Key, class T, class Hash, class Pred, class PartialKey>
+    __thread typename
+    cuckoohash_map<Key, T, Hash, Pred, PartialKey>::TableInfo**
+    cuckoohash_map<Key, T, Hash, Pred, PartialKey>::hazard_pointer = nullptr;
+
+template <class Key, class T, class Hash, class Pred, class PartialKey>
+    __thread int
+    cuckoohash_map<Key, T, Hash, Pred, PartialKey>::counterid = -1;
+
+template <class Key, class T, class Hash, class Pred, class PartialKey>
+    typename
+    cuckoohash_map<Key, T, Hash, Pred, PartialKey>::GlobalHazardPointerList
+    cuckoohash_map<Key, T, Hash, Pred, PartialKey>::global_hazard_pointers;
+
+template <class Key, class T, class Hash, class Pred, class PartialKey>
+    const size_t cuckoohash_map<Key, T, Hash, Pred, PartialKey>::kNumCores =
     std::thread::hardware_concurrency() == 0 ?
     sysconf(_SC_NPROCESSORS_ONLN) : std::thread::hardware_concurrency();
 
-template <class Key, class T, class Hash, class Pred>
+template <class Key, class T, class Hash, class Pred, class PartialKey>
     const std::out_of_range
-    cuckoohash_map<Key, T, Hash, Pred>::const_iterator::end_dereference(
+    cuckoohash_map<Key, T, Hash, Pred, PartialKey>::const_iterator::
+    end_dereference(
         "Cannot dereference: iterator points past the end of the table");
 
-template <class Key, class T, class Hash, class Pred>
+template <class Key, class T, class Hash, class Pred, class PartialKey>
     const std::out_of_range
-    cuckoohash_map<Key, T, Hash, Pred>::const_iterator::end_increment(
+    cuckoohash_map<Key, T, Hash, Pred, PartialKey>::const_iterator::
+    end_increment(
         "Cannot increment: iterator points past the end of the table");
 
-template <class Key, class T, class Hash, class Pred>
+template <class Key, class T, class Hash, class Pred, class PartialKey>
     const std::out_of_range
-    cuckoohash_map<Key, T, Hash, Pred>::const_iterator::begin_decrement(
+    cuckoohash_map<Key, T, Hash, Pred, PartialKey>::const_iterator::
+    begin_decrement(
         "Cannot decrement: iterator points to the beginning of the table");
 
 #endif
@@ -0,0 +1,370 @@
+/*! \file */
+
+#ifndef _CUCKOOHASH_POOLED_MAP_HH
+#define _CUCKOOHASH_POOLED_MAP_HH
+
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "cuckoohash_config.h"
+#include "cuckoohash_map.hh"
+
+/*! cuckoohash_pooled_map is a concurrent hash table for large values. It
+ *  stores each value out of line, in a slot of a pool of fixed-size slabs
+ *  owned by the table, and keeps only the key and a pointer to the slot in
+ *  the bucket. Buckets stay as small as those of a table of pointers, and
+ *  cuckoo displacements and expansions move the pointer instead of copying
+ *  the value. Erased values' slots are reused by later inserts.
+ *
+ *  \ref find_fn and \ref update_fn run a function on the value in place
+ *  while the key's bucket is locked, so a value can be read or changed
+ *  without copying it. Like cuckoohash_map, all operations are safe to run
+ *  concurrently. */
+template <class Key, class T, class Hash = std::hash<Key>,
+          class Pred = std::equal_to<Key>,
+          class PartialKey = default_partial_key<Key> >
+class cuckoohash_pooled_map {
+public:
+    //! key_type is the type of keys.
+    typedef Key               key_type;
+    //! mapped_type is the type of values.
+    typedef T                 mapped_type;
+    //! value_type is the type of key-value pairs.
+    typedef std::pair<Key, T> value_type;
+    //! hasher is the type of the hash function.
+    typedef Hash              hasher;
+    //! key_equal is the type of the equality predicate.
+    typedef Pred              key_equal;
+
+private:
+    // Slot holds one value, or, while it is free, the next free slot of its
+    // shard.
+    union Slot {
+        Slot* next;
+        typename std::aligned_storage<sizeof(T),
+                                      std::alignment_of<T>::value>::type value;
+    };
+
+    typedef cuckoohash_map<Key, Slot*, Hash, Pred, PartialKey> Table;
+
+    // SlabDeleter frees a slab allocated by new_slab.
+    struct SlabDeleter {
+        void operator()(Slot* slab) const {
+            free(slab);
+        }
+    };
+
+    // The pool is split into shards, each with its own lock, and each thread
+    // allocates from and frees to the shard its id hashes to. A shard hands
+    // out the slots on its free list first, and then the unused slots of its
+    // newest slab.
+    struct Shard {
+        std::mutex mutex;
+        Slot* free_list;
+        Slot* fresh;
+        Slot* fresh_end;
+        std::vector<std::unique_ptr<Slot, SlabDeleter> > slabs;
+
+        Shard() : free_list(nullptr), fresh(nullptr), fresh_end(nullptr) {}
+    };
+
+    static const size_t kNumShards = 16;
+    // each slab holds at least this many slots, and more if they fit in
+    // kSlabBytes
+    static const size_t kMinSlabSlots = 16;
+    static const size_t kSlabBytes = 64 * 1024;
+    static const size_t kSlabSlots = kSlabBytes / sizeof(Slot) > kMinSlabSlots
+        ? kSlabBytes / sizeof(Slot) : kMinSlabSlots;
+    // slabs start on a cache line, or at the values' alignment if that is
+    // larger
+    static const size_t kSlabAlign = alignof(Slot) > 64 ? alignof(Slot) : 64;
+
+public:
+    //! The constructor creates a new table with enough space for \p n
+    //! elements, which uses the hasher \p hf and equality predicate \p eql.
+    explicit cuckoohash_pooled_map(size_t n = DEFAULT_SIZE,
+                                   const hasher& hf = hasher(),
+                                   const key_equal& eql = key_equal())
+        : table_(n, hf, eql), shards_(new Shard[kNumShards]) {}
+
+    //! The destructor destroys the values in the table and frees the pool.
+    ~cuckoohash_pooled_map() {
+        table_.parallel_for_each([](const key_type&, Slot* const& slot) {
+                value_of(slot).~T();
+            }, 1);
+    }
+
+    cuckoohash_pooled_map(const cuckoohash_pooled_map&) = delete;
+    cuckoohash_pooled_map& operator=(const cuckoohash_pooled_map&) = delete;
+
+    //! clear removes all the elements in the table, returning their slots to
+    //! the pool. Elements inserted while it runs may be kept.
+    void clear() {
+        std::vector<key_type> keys;
+        table_.parallel_for_each(
+            [&keys](const key_type& k, Slot* const&) {
+                keys.push_back(k);
+            }, 1);
+        for (const key_type& k : keys) {
+            erase(k);
+        }
+    }
+
+    //! size returns the number of items currently in the table.
+    size_t size() {
+        return table_.size();
+    }
+
+    //! empty returns true if the table is empty.
+    bool empty() {
+        return table_.empty();
+    }
+
+    //! hashpower returns the hashpower of the table, which is
+    //! log<SUB>2</SUB>(the number of buckets).
+    size_t hashpower() {
+        return table_.hashpower();
+    }
+
+    //! bucket_count returns the number of buckets in the table.
+    size_t bucket_count() {
+        return table_.bucket_count();
+    }
+
+    //! load_factor returns the ratio of the number of items in the table to
+    //! the total number of available slots in the table.
+    double load_factor() {
+        return table_.load_factor();
+    }
+
+    //! hash_function returns the hasher the table was constructed with.
+    hasher hash_function() const {
+        return table_.hash_function();
+    }
+
+    //! key_eq returns the equality predicate the table was constructed with.
+    key_equal key_eq() const {
+        return table_.key_eq();
+    }
+
+    //! find searches the table for \p key, and copies the associated value it
+    //! finds into \p val.
+    bool find(const key_type& key, mapped_type& val) {
+        return find_fn(key, [&val](const mapped_type& v) { val = v; });
+    }
+
+    //! This version of find returns a copy of the value associated with \p
+    //! key. If the key is not there, it throws \p std::out_of_range.
+    mapped_type find(const key_type& key) {
+        mapped_type val;
+        if (find(key, val)) {
+            return val;
+        } else {
+            throw std::out_of_range("key not found in table");
+        }
+    }
+
+    //! find_fn searches the table for \p key, and calls \p fn on the value it
+    //! finds without copying it. \p fn must accept an argument of type const
+    //! mapped_type&. It runs while the key's bucket is locked, so it should
+    //! be short, must not call any method of the table, and must not keep a
+    //! reference to the value. If \p key is not there, it returns false.
+    template <class F>
+    bool find_fn(const key_type& key, F fn) {
+        return table_.find_fn(key, [&fn](Slot* const& slot) {
+                fn(static_cast<const mapped_type&>(value_of(slot)));
+            });
+    }
+
+    //! contains searches the table for \p key, and returns true if it finds
+    //! it.
+    bool contains(const key_type& key) {
+        return table_.contains(key);
+    }
+
+    //! insert copies \p val into a slot of the pool and puts \p key into the
+    //! table with that slot. If \p key is already there, it returns false and
+    //! the slot goes back to the pool.
+    bool insert(const key_type& key, const mapped_type& val) {
+        Slot* slot = allocate();
+        try {
+            new (&slot->value) mapped_type(val);
+        } catch (...) {
+            release(slot);
+            throw;
+        }
+        bool inserted;
+        try {
+            inserted = table_.insert(key, slot);
+        } catch (...) {
+            destroy(slot);
+            throw;
+        }
+        if (!inserted) {
+            destroy(slot);
+        }
+        return inserted;
+    }
+
+    //! erase removes \p key and its value from the table, destroying the
+    //! value and returning its slot to the pool. If \p key is not there, it
+    //! returns false.
+    bool erase(const key_type& key) {
+        Slot* erased = nullptr;
+        if (!table_.erase_fn(key, [&erased](Slot*& slot) {
+                    erased = slot;
+                })) {
+            return false;
+        }
+        // No other thread can reach the value once its key is gone
+        destroy(erased);
+        return true;
+    }
+
+    //! update assigns \p val to the value associated with \p key. If \p key
+    //! is not there, it returns false.
+    bool update(const key_type& key, const mapped_type& val) {
+        return update_fn(key, [&val](mapped_type& v) { v = val; });
+    }
+
+    //! update_fn calls \p fn on the value associated with \p key, which it
+    //! changes in place. Unlike cuckoohash_map::update_fn, \p fn must accept
+    //! an argument of type mapped_type& and doesn't return a new value, so
+    //! the value is never copied. The same restrictions apply to \p fn as for
+    //! \ref find_fn. If \p key is not there, it returns false.
+    template <class F>
+    bool update_fn(const key_type& key, F fn) {
+        // The slot pointer in the bucket doesn't change, so this only needs
+        // to read it. The value is still changed under the bucket's lock.
+        return table_.find_fn(key, [&fn](Slot* const& slot) {
+                fn(value_of(slot));
+            });
+    }
+
+    //! upsert calls \p fn on the value associated with \p key like
+    //! update_fn, or inserts \p key with the value \p val if it isn't there.
+    template <class F>
+    void upsert(const key_type& key, F fn, const mapped_type& val) {
+        while (!update_fn(key, fn)) {
+            if (insert(key, val)) {
+                return;
+            }
+        }
+    }
+
+    //! rehash changes the number of buckets in the table to
+    //! 2<SUP>\p n</SUP>, as cuckoohash_map::rehash does. The values stay
+    //! where they are in the pool.
+    bool rehash(size_t n) {
+        return table_.rehash(n);
+    }
+
+    //! reserve changes the number of buckets in the table to fit \p n
+    //! elements, as cuckoohash_map::reserve does.
+    bool reserve(size_t n) {
+        return table_.reserve(n);
+    }
+
+    //! snapshot_table returns a vector of copies of all the elements
+    //! currently in the table. It holds all the locks on the table while it
+    //! copies them.
+    std::vector<value_type> snapshot_table() {
+        std::vector<value_type> items;
+        table_.parallel_for_each(
+            [&items](const key_type& k, Slot* const& slot) {
+                items.emplace_back(k, value_of(slot));
+            }, 1);
+        return items;
+    }
+
+    //! pooled_memory_stats is the type returned by \ref memory_usage.
+    struct pooled_memory_stats {
+        //! the memory used by the hash table, as reported by
+        //! cuckoohash_map::memory_usage
+        size_t table;
+        //! the memory allocated for the slabs of the pool
+        size_t pool;
+        //! the sum of table and pool
+        size_t total;
+    };
+
+    //! memory_usage returns the number of bytes the table and its pool have
+    //! allocated.
+    pooled_memory_stats memory_usage() {
+        pooled_memory_stats ms;
+        ms.table = table_.memory_usage().total;
+        ms.pool = 0;
+        for (size_t i = 0; i < kNumShards; ++i) {
+            std::lock_guard<std::mutex> guard(shards_[i].mutex);
+            ms.pool += shards_[i].slabs.size() * kSlabSlots * sizeof(Slot);
+        }
+        ms.total = ms.table + ms.pool;
+        return ms;
+    }
+
+private:
+    Table table_;
+    std::unique_ptr<Shard[]> shards_;
+
+    static mapped_type& value_of(Slot* slot) {
+        return *reinterpret_cast<mapped_type*>(&slot->value);
+    }
+
+    Shard& my_shard() {
+        return shards_[std::hash<std::thread::id>()(
+                std::this_thread::get_id()) % kNumShards];
+    }
+
+    // allocate takes a free slot from the calling thread's shard, adding a
+    // slab to it if it has none left.
+    Slot* allocate() {
+        Shard& sh = my_shard();
+        std::lock_guard<std::mutex> guard(sh.mutex);
+        if (sh.free_list != nullptr) {
+            Slot* slot = sh.free_list;
+            sh.free_list = slot->next;
+            return slot;
+        }
+        if (sh.fresh == sh.fresh_end) {
+            sh.slabs.emplace_back(new_slab());
+            sh.fresh = sh.slabs.back().get();
+            sh.fresh_end = sh.fresh + kSlabSlots;
+        }
+        return sh.fresh++;
+    }
+
+    // new_slab allocates an uninitialized slab of kSlabSlots slots. Like the
+    // table's buckets, it is allocated with posix_memalign, since new doesn't
+    // honor alignments larger than the default before C++17.
+    static Slot* new_slab() {
+        void* mem;
+        if (posix_memalign(&mem, kSlabAlign, kSlabSlots * sizeof(Slot)) != 0) {
+            throw std::bad_alloc();
+        }
+        return static_cast<Slot*>(mem);
+    }
+
+    // release returns a slot to the free list of the calling thread's shard.
+    void release(Slot* slot) {
+        Shard& sh = my_shard();
+        std::lock_guard<std::mutex> guard(sh.mutex);
+        slot->next = sh.free_list;
+        sh.free_list = slot;
+    }
+
+    // destroy destroys the value in a slot and releases the slot.
+    void destroy(Slot* slot) {
+        value_of(slot).~T();
+        release(slot);
+    }
+};
+
+#endif
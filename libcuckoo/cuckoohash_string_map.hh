@@ -0,0 +1,642 @@
+/*! \file */
+
+#ifndef _CUCKOOHASH_STRING_MAP_HH
+#define _CUCKOOHASH_STRING_MAP_HH
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#if __cplusplus >= 201703L
+#  include <string_view>
+#endif
+
+#include "city_hasher.hh"
+#include "cuckoohash_config.h"
+#include "cuckoohash_map.hh"
+
+/*! cuckoohash_string_map is a concurrent hash table keyed by strings, which
+ *  stores its keys more compactly than a cuckoohash_map of std::string. The
+ *  length of each key and its first bytes are stored in the bucket itself:
+ *  keys of up to \ref kInlineLen bytes entirely, and longer keys as their
+ *  first \ref kPrefixLen bytes and a pointer to the rest. The rest of a long
+ *  key is copied into an append-only arena owned by the table, so inserting
+ *  a key never calls malloc, and comparing keys only reads the arena once
+ *  the length and prefix match. Lookups take std::string or C string keys,
+ *  and std::string_view when compiled as C++17, without copying them.
+ *
+ *  Erasing a long key leaves its bytes in the arena. Once those bytes
+ *  outweigh the live ones, the table compacts the arena, copying the keys
+ *  that are still in the table out of the fully written blocks of the
+ *  arena, while it holds all the locks on the table, and freeing the
+ *  blocks once no operation can still be reading the keys of a version of
+ *  the table that an expansion replaced. \ref rehash and \ref reserve
+ *  compact the arena after expanding the table as well. All operations are
+ *  safe to run concurrently. */
+template <class T, class PartialKey = partial_key_bits<16> >
+class cuckoohash_string_map {
+public:
+    //! key_type is the type of keys, as they are returned by \ref
+    //! snapshot_table.
+    typedef std::string       key_type;
+    //! mapped_type is the type of values.
+    typedef T                 mapped_type;
+    //! value_type is the type of key-value pairs.
+    typedef std::pair<std::string, T> value_type;
+    //! updater is the function type for functions passed to update_fn and
+    //! upsert.
+    typedef std::function<mapped_type(const mapped_type&)> updater;
+
+    //! kInlineLen is the length of the longest key that is stored entirely
+    //! in the bucket.
+    static const size_t kInlineLen = 20;
+    //! kPrefixLen is the number of bytes of a longer key that are stored in
+    //! the bucket, next to the pointer to the rest of it.
+    static const size_t kPrefixLen = kInlineLen - sizeof(const char*);
+
+private:
+    // StringKey is the key stored in the buckets. Keys of up to kInlineLen
+    // bytes are held in bytes. Longer keys keep their first kPrefixLen bytes
+    // there, followed by a pointer to the rest of the key in the arena.
+    struct StringKey {
+        uint32_t len;
+        char bytes[kInlineLen];
+
+        const char* rest() const {
+            const char* p;
+            memcpy(&p, bytes + kPrefixLen, sizeof(p));
+            return p;
+        }
+
+        void set_rest(const char* p) {
+            memcpy(bytes + kPrefixLen, &p, sizeof(p));
+        }
+    };
+
+    // StringKeyHasher hashes a StringKey and a string with the same
+    // characters to the same value. Short keys hash to CityHash64 of their
+    // characters. Long keys hash the rest of the key with a hash of the
+    // prefix as the seed, so the prefix and the rest can be hashed where
+    // they are stored.
+    class StringKeyHasher {
+    public:
+        typedef void is_transparent;
+
+        size_t operator()(const StringKey& k) const {
+            if (k.len <= kInlineLen) {
+                return CityHashInline::hash(k.bytes, k.len);
+            }
+            return CityHashInline::hash_with_seed(
+                k.rest(), k.len - kPrefixLen,
+                CityHashInline::hash(k.bytes, kPrefixLen));
+        }
+
+        size_t operator()(const std::string& s) const {
+            return hash_chars(s.data(), s.size());
+        }
+
+        size_t operator()(const char* s) const {
+            return hash_chars(s, strlen(s));
+        }
+
+#if __cplusplus >= 201703L
+        size_t operator()(std::string_view s) const {
+            return hash_chars(s.data(), s.size());
+        }
+#endif
+
+    private:
+        static size_t hash_chars(const char* s, const size_t len) {
+            if (len <= kInlineLen) {
+                return CityHashInline::hash(s, len);
+            }
+            return CityHashInline::hash_with_seed(
+                s + kPrefixLen, len - kPrefixLen,
+                CityHashInline::hash(s, kPrefixLen));
+        }
+    };
+
+    // StringKeyEqual compares StringKeys with each other and with strings.
+    // The lengths and the bytes in the buckets reject most keys that differ
+    // before the arena is read.
+    class StringKeyEqual {
+    public:
+        typedef void is_transparent;
+
+        bool operator()(const StringKey& a, const StringKey& b) const {
+            if (a.len != b.len) {
+                return false;
+            }
+            if (a.len <= kInlineLen) {
+                return memcmp(a.bytes, b.bytes, a.len) == 0;
+            }
+            return memcmp(a.bytes, b.bytes, kPrefixLen) == 0 &&
+                (a.rest() == b.rest() ||
+                 memcmp(a.rest(), b.rest(), a.len - kPrefixLen) == 0);
+        }
+
+        bool operator()(const StringKey& a, const std::string& b) const {
+            return equal_chars(a, b.data(), b.size());
+        }
+
+        bool operator()(const std::string& a, const StringKey& b) const {
+            return equal_chars(b, a.data(), a.size());
+        }
+
+        bool operator()(const StringKey& a, const char* b) const {
+            return equal_chars(a, b, strlen(b));
+        }
+
+        bool operator()(const char* a, const StringKey& b) const {
+            return equal_chars(b, a, strlen(a));
+        }
+
+#if __cplusplus >= 201703L
+        bool operator()(const StringKey& a, std::string_view b) const {
+            return equal_chars(a, b.data(), b.size());
+        }
+
+        bool operator()(std::string_view a, const StringKey& b) const {
+            return equal_chars(b, a.data(), a.size());
+        }
+#endif
+
+    private:
+        static bool equal_chars(const StringKey& k, const char* s,
+                                const size_t len) {
+            if (k.len != len) {
+                return false;
+            }
+            if (len <= kInlineLen) {
+                return memcmp(k.bytes, s, len) == 0;
+            }
+            return memcmp(k.bytes, s, kPrefixLen) == 0 &&
+                memcmp(k.rest(), s + kPrefixLen, len - kPrefixLen) == 0;
+        }
+    };
+
+    typedef cuckoohash_map<StringKey, T, StringKeyHasher, StringKeyEqual,
+                           PartialKey> Table;
+
+    // Chunk is a block of the arena. Its header is followed by size bytes
+    // of key data, of which the first used bytes are filled. pending counts
+    // the keys copied into the chunk whose insert hasn't finished yet.
+    struct Chunk {
+        size_t size;
+        size_t used;
+        std::atomic<size_t> pending;
+
+        char* data() {
+            return reinterpret_cast<char*>(this + 1);
+        }
+    };
+
+    // The arena is split into shards, each with its own lock, and each
+    // thread appends to the shard its id hashes to. A shard appends to its
+    // current chunk until it is full, and then seals it. Keys too long to
+    // share a chunk get a sealed chunk of their own.
+    struct Shard {
+        std::mutex mutex;
+        Chunk* current;
+        std::vector<Chunk*> sealed;
+
+        Shard() : current(nullptr) {}
+    };
+
+    static const size_t kNumShards = 16;
+    static const size_t kChunkSize = 64 * 1024;
+    // compaction doesn't run until at least this many bytes of the arena
+    // are garbage
+    static const size_t kMinCompactBytes = 1 << 20;
+
+public:
+    //! The constructor creates a new table with enough space for \p n
+    //! elements.
+    explicit cuckoohash_string_map(size_t n = DEFAULT_SIZE)
+        : table_(n), shards_(new Shard[kNumShards]), arena_bytes_(0),
+          live_bytes_(0), next_compact_bytes_(kMinCompactBytes) {}
+
+    //! The destructor frees the table and the arena.
+    ~cuckoohash_string_map() {
+        for (size_t i = 0; i < kNumShards; ++i) {
+            free(shards_[i].current);
+            for (Chunk* c : shards_[i].sealed) {
+                free(c);
+            }
+        }
+        for (Chunk* c : retired_) {
+            free(c);
+        }
+    }
+
+    cuckoohash_string_map(const cuckoohash_string_map&) = delete;
+    cuckoohash_string_map& operator=(const cuckoohash_string_map&) = delete;
+
+    //! clear removes all the elements in the table and frees as much of the
+    //! arena as it can.
+    void clear() {
+        table_.clear();
+        live_bytes_.store(0);
+        compact();
+    }
+
+    //! size returns the number of items currently in the table.
+    size_t size() {
+        return table_.size();
+    }
+
+    //! empty returns true if the table is empty.
+    bool empty() {
+        return table_.empty();
+    }
+
+    //! hashpower returns the hashpower of the table, which is
+    //! log<SUB>2</SUB>(the number of buckets).
+    size_t hashpower() {
+        return table_.hashpower();
+    }
+
+    //! bucket_count returns the number of buckets in the table.
+    size_t bucket_count() {
+        return table_.bucket_count();
+    }
+
+    //! load_factor returns the ratio of the number of items in the table to
+    //! the total number of available slots in the table.
+    double load_factor() {
+        return table_.load_factor();
+    }
+
+    //! find searches the table for \p key, which is a std::string, a C
+    //! string, or a std::string_view, and stores the associated value it
+    //! finds in \p val.
+    template <class K>
+    bool find(const K& key, mapped_type& val) {
+        return table_.find(key, val);
+    }
+
+    //! This version of find returns the value associated with \p key. If
+    //! the key is not there, it throws \p std::out_of_range.
+    template <class K>
+    mapped_type find(const K& key) {
+        return table_.find(key);
+    }
+
+    //! contains searches the table for \p key, and returns true if it finds
+    //! it.
+    template <class K>
+    bool contains(const K& key) {
+        return table_.contains(key);
+    }
+
+    //! insert puts the given key-value pair into the table, copying the part
+    //! of the key that doesn't fit in the bucket into the arena. It returns
+    //! false if the key is already in the table.
+    bool insert(const std::string& key, const mapped_type& val) {
+        return insert_chars(key.data(), key.size(), val);
+    }
+
+    bool insert(const char* key, const mapped_type& val) {
+        return insert_chars(key, strlen(key), val);
+    }
+
+    //! erase removes \p key and its value from the table, returning true if
+    //! it finds the key.
+    template <class K>
+    bool erase(const K& key) {
+        if (!table_.erase(key)) {
+            return false;
+        }
+        const size_t len = key_length(key);
+        if (len > kInlineLen) {
+            live_bytes_.fetch_sub(len - kPrefixLen);
+            maybe_compact();
+        }
+        return true;
+    }
+
+    //! update changes the value associated with \p key to \p val. If \p key
+    //! is not there, it returns false.
+    template <class K>
+    bool update(const K& key, const mapped_type& val) {
+        return table_.update_fn(key, [&val](const mapped_type&) {
+                return val;
+            });
+    }
+
+    //! update_fn changes the value associated with \p key with the function
+    //! \p fn. If \p key is not there, it returns false.
+    template <class K>
+    bool update_fn(const K& key, const updater& fn) {
+        return table_.update_fn(key, fn);
+    }
+
+    //! upsert changes the value associated with \p key with the function \p
+    //! fn, or inserts \p key with the value \p val if it isn't there. The
+    //! key is only copied into the arena if it is inserted.
+    template <class K>
+    void upsert(const K& key, const updater& fn, const mapped_type& val) {
+        const char* chars = key_data(key);
+        const size_t len = key_length(key);
+        while (!table_.update_fn(key, fn)) {
+            if (insert_chars(chars, len, val)) {
+                return;
+            }
+        }
+    }
+
+    //! rehash changes the number of buckets in the table to
+    //! 2<SUP>\p n</SUP>, as cuckoohash_map::rehash does, and then compacts
+    //! the arena.
+    bool rehash(size_t n) {
+        const bool res = table_.rehash(n);
+        compact();
+        return res;
+    }
+
+    //! reserve changes the number of buckets in the table to fit \p n
+    //! elements, as cuckoohash_map::reserve does, and then compacts the
+    //! arena.
+    bool reserve(size_t n) {
+        const bool res = table_.reserve(n);
+        compact();
+        return res;
+    }
+
+    //! snapshot_table returns a vector of all the elements currently in the
+    //! table. It holds all the locks on the table while it copies them.
+    std::vector<value_type> snapshot_table() {
+        std::vector<value_type> items;
+        table_.parallel_for_each(
+            [&items](const StringKey& k, const mapped_type& v) {
+                items.emplace_back(key_string(k), v);
+            }, 1);
+        return items;
+    }
+
+    //! string_memory_stats is the type returned by \ref memory_usage.
+    struct string_memory_stats {
+        //! the memory used by the hash table, as reported by
+        //! cuckoohash_map::memory_usage
+        size_t table;
+        //! the memory allocated for the arena
+        size_t arena;
+        //! the bytes of the arena holding keys that are in the table
+        size_t arena_live;
+        //! the sum of table and arena
+        size_t total;
+    };
+
+    //! memory_usage returns the number of bytes the table and its arena have
+    //! allocated.
+    string_memory_stats memory_usage() {
+        string_memory_stats ms;
+        ms.table = table_.memory_usage().total;
+        ms.arena = 0;
+        for (size_t i = 0; i < kNumShards; ++i) {
+            Shard& sh = shards_[i];
+            std::lock_guard<std::mutex> guard(sh.mutex);
+            if (sh.current != nullptr) {
+                ms.arena += sizeof(Chunk) + sh.current->size;
+            }
+            for (const Chunk* c : sh.sealed) {
+                ms.arena += sizeof(Chunk) + c->size;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> guard(compact_mutex_);
+            for (const Chunk* c : retired_) {
+                ms.arena += sizeof(Chunk) + c->size;
+            }
+        }
+        ms.arena_live = live_bytes_.load();
+        ms.total = ms.table + ms.arena;
+        return ms;
+    }
+
+    //! compact copies the keys that are still in the table out of the
+    //! sealed chunks of the arena and frees those chunks, reclaiming the
+    //! space of erased keys. It holds all the locks on the table while it
+    //! copies the keys. If an operation may still be reading the keys of a
+    //! version of the table that an expansion replaced, which can point into
+    //! the chunks, the chunks are kept until a later compaction finds that
+    //! none is. It is run automatically once erased keys take up more of the
+    //! arena than live ones, so it rarely needs to be called directly.
+    void compact() {
+        std::unique_lock<std::mutex> lock(compact_mutex_, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            // Another thread is already compacting
+            return;
+        }
+        // A sealed chunk without pending inserts can't gain any more keys,
+        // and every key copied into it is either in the table, where the
+        // scan below sees it, or garbage.
+        std::vector<Chunk*> victims;
+        for (size_t i = 0; i < kNumShards; ++i) {
+            Shard& sh = shards_[i];
+            std::lock_guard<std::mutex> guard(sh.mutex);
+            std::vector<Chunk*> keep;
+            for (Chunk* c : sh.sealed) {
+                if (c->pending.load(std::memory_order_acquire) == 0) {
+                    victims.push_back(c);
+                } else {
+                    keep.push_back(c);
+                }
+            }
+            sh.sealed.swap(keep);
+        }
+        if (!victims.empty()) {
+            std::sort(victims.begin(), victims.end());
+            // Only the location of the rest of each key changes, so its
+            // hash and equality stay the same
+            table_.parallel_rewrite_keys(
+                [this, &victims](StringKey& k) {
+                    if (k.len > kInlineLen && in_chunks(victims, k.rest())) {
+                        Chunk* c;
+                        k.set_rest(append(k.rest(), k.len - kPrefixLen, c));
+                        c->pending.fetch_sub(1, std::memory_order_release);
+                    }
+                });
+            // The keys of the tables that expansions replaced still point
+            // into the victims, and an insert that started on one of them
+            // can still be reading its keys
+            retired_.insert(retired_.end(), victims.begin(), victims.end());
+        }
+        if (!retired_.empty() && table_.reclaim_retired_tables()) {
+            for (Chunk* c : retired_) {
+                arena_bytes_.fetch_sub(c->used);
+                free(c);
+            }
+            retired_.clear();
+        }
+        const size_t arena = arena_bytes_.load();
+        const size_t live = live_bytes_.load();
+        const size_t garbage = arena > live ? arena - live : 0;
+        next_compact_bytes_.store(
+            garbage + std::max(live, static_cast<size_t>(kMinCompactBytes)));
+    }
+
+private:
+    Table table_;
+    std::unique_ptr<Shard[]> shards_;
+    // the bytes appended to the arena that haven't been freed, and the
+    // bytes of those that belong to keys in the table
+    std::atomic<size_t> arena_bytes_;
+    std::atomic<size_t> live_bytes_;
+    // the number of garbage bytes at which the next compaction runs
+    std::atomic<size_t> next_compact_bytes_;
+    std::mutex compact_mutex_;
+    // chunks whose keys have been copied out, which are freed once no
+    // replaced version of the table is left. It is guarded by
+    // compact_mutex_.
+    std::vector<Chunk*> retired_;
+
+    static const char* key_data(const std::string& key) {
+        return key.data();
+    }
+
+    static const char* key_data(const char* key) {
+        return key;
+    }
+
+    static size_t key_length(const std::string& key) {
+        return key.size();
+    }
+
+    static size_t key_length(const char* key) {
+        return strlen(key);
+    }
+
+#if __cplusplus >= 201703L
+    static const char* key_data(std::string_view key) {
+        return key.data();
+    }
+
+    static size_t key_length(std::string_view key) {
+        return key.size();
+    }
+#endif
+
+    // key_string returns the characters of a StringKey as a std::string.
+    static std::string key_string(const StringKey& k) {
+        if (k.len <= kInlineLen) {
+            return std::string(k.bytes, k.len);
+        }
+        std::string s(k.bytes, kPrefixLen);
+        s.append(k.rest(), k.len - kPrefixLen);
+        return s;
+    }
+
+    // insert_chars inserts the len characters at s with the given value.
+    // The rest of a long key is copied into the arena first, and the chunk
+    // it was copied into is kept from being compacted until the insert has
+    // finished.
+    bool insert_chars(const char* s, const size_t len,
+                      const mapped_type& val) {
+        if (len > std::numeric_limits<uint32_t>::max()) {
+            throw std::length_error("cuckoohash_string_map key too long");
+        }
+        StringKey k;
+        k.len = static_cast<uint32_t>(len);
+        if (len <= kInlineLen) {
+            memcpy(k.bytes, s, len);
+            memset(k.bytes + len, 0, kInlineLen - len);
+            return table_.insert(k, val);
+        }
+        memcpy(k.bytes, s, kPrefixLen);
+        Chunk* c;
+        k.set_rest(append(s + kPrefixLen, len - kPrefixLen, c));
+        bool inserted;
+        try {
+            inserted = table_.insert(k, val);
+        } catch (...) {
+            c->pending.fetch_sub(1, std::memory_order_release);
+            throw;
+        }
+        if (inserted) {
+            live_bytes_.fetch_add(len - kPrefixLen);
+        }
+        c->pending.fetch_sub(1, std::memory_order_release);
+        if (!inserted) {
+            maybe_compact();
+        }
+        return inserted;
+    }
+
+    // append copies the n bytes at s into the shard of the calling thread,
+    // returning where it copied them and the chunk they are in, whose
+    // pending count it increments.
+    const char* append(const char* s, const size_t n, Chunk*& chunk) {
+        Shard& sh = shards_[std::hash<std::thread::id>()(
+                std::this_thread::get_id()) % kNumShards];
+        std::lock_guard<std::mutex> guard(sh.mutex);
+        if (n > kChunkSize / 4) {
+            chunk = new_chunk(n);
+            sh.sealed.push_back(chunk);
+        } else {
+            if (sh.current == nullptr ||
+                sh.current->size - sh.current->used < n) {
+                if (sh.current != nullptr) {
+                    sh.sealed.push_back(sh.current);
+                }
+                sh.current = new_chunk(kChunkSize);
+            }
+            chunk = sh.current;
+        }
+        char* p = chunk->data() + chunk->used;
+        memcpy(p, s, n);
+        chunk->used += n;
+        chunk->pending.fetch_add(1, std::memory_order_relaxed);
+        arena_bytes_.fetch_add(n);
+        return p;
+    }
+
+    static Chunk* new_chunk(const size_t size) {
+        void* mem = malloc(sizeof(Chunk) + size);
+        if (mem == nullptr) {
+            throw std::bad_alloc();
+        }
+        Chunk* c = static_cast<Chunk*>(mem);
+        c->size = size;
+        c->used = 0;
+        new (&c->pending) std::atomic<size_t>(0);
+        return c;
+    }
+
+    // in_chunks returns true if p points into one of the chunks, which are
+    // sorted by address.
+    static bool in_chunks(const std::vector<Chunk*>& chunks, const char* p) {
+        auto it = std::upper_bound(
+            chunks.begin(), chunks.end(), p,
+            [](const char* q, Chunk* c) {
+                return std::less<const char*>()(q, c->data());
+            });
+        if (it == chunks.begin()) {
+            return false;
+        }
+        Chunk* c = *(it - 1);
+        return !std::less<const char*>()(c->data() + c->used, p + 1);
+    }
+
+    // maybe_compact compacts the arena if enough of it is garbage.
+    void maybe_compact() {
+        const size_t arena = arena_bytes_.load();
+        const size_t live = live_bytes_.load();
+        if (arena > live && arena - live >= next_compact_bytes_.load()) {
+            compact();
+        }
+    }
+};
+
+#endif
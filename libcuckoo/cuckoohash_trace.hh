@@ -0,0 +1,230 @@
+/*! \file */
+
+#ifndef _CUCKOOHASH_TRACE_HH
+#define _CUCKOOHASH_TRACE_HH
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "cuckoohash_config.h"
+
+//! cuckoo_trace records the operations run on every cuckoohash_map in the
+//! process, along with the hash values of their keys, to a binary file that
+//! can be replayed against a table later. Operations are only recorded when
+//! the table is compiled with LIBCUCKOO_TRACE set to 1, and only between calls
+//! to \ref start and \ref stop.
+//!
+//! Each thread buffers its records and appends them to the file in chunks, so
+//! recording doesn't take a lock on every operation. The file starts with the
+//! 8 bytes "cuckootr" and a uint32_t version. Each chunk is a uint32_t thread
+//! number, a uint32_t count, count uint8_t operation types, and count uint64_t
+//! hash values, all in the byte order of the machine that recorded them.
+class cuckoo_trace {
+public:
+    //! op_type is the type of a recorded operation.
+    enum op_type {
+        FIND = 0,
+        INSERT = 1,
+        ERASE = 2,
+        UPDATE = 3,
+        UPDATE_FN = 4,
+        UPSERT = 5,
+        NUM_OP_TYPES = 6
+    };
+
+    //! chunk is a batch of operations recorded by one thread, as read by
+    //! \ref read_chunk.
+    struct chunk {
+        //! the number of the recording thread
+        uint32_t thread;
+        //! the types of the operations
+        std::vector<uint8_t> ops;
+        //! the hash values of the operations' keys
+        std::vector<uint64_t> hashes;
+    };
+
+    //! start begins recording operations to the file at \p path, replacing
+    //! it if it exists. It throws an \p std::runtime_error if the file can't
+    //! be opened or a trace is already being recorded.
+    static void start(const std::string& path) {
+        State& s = state();
+        std::lock_guard<std::mutex> lock(s.mtx);
+        if (s.out.is_open()) {
+            throw std::runtime_error("a trace is already being recorded");
+        }
+        s.out.open(path.c_str(), std::ios::binary | std::ios::trunc);
+        if (!s.out) {
+            throw std::runtime_error("cannot open trace file " + path);
+        }
+        const uint32_t version = kVersion;
+        s.out.write(magic(), kMagicSize);
+        s.out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        s.enabled.store(true);
+    }
+
+    //! stop writes out the operations every thread has buffered and closes
+    //! the file. It must not run concurrently with any operations on a
+    //! table. It throws an \p std::runtime_error if writing the file failed.
+    static void stop() {
+        State& s = state();
+        s.enabled.store(false);
+        std::lock_guard<std::mutex> lock(s.mtx);
+        for (auto it = s.buffers.begin(); it != s.buffers.end(); ++it) {
+            write_chunk(**it);
+        }
+        const bool good = s.out.good();
+        s.out.close();
+        if (!good) {
+            throw std::runtime_error("error writing trace file");
+        }
+    }
+
+    //! record adds an operation to the calling thread's buffer, if a trace
+    //! is being recorded. Tables call it through the LIBCUCKOO_TRACE_OP
+    //! macro.
+    static inline void record(const op_type op, const uint64_t hv) {
+        if (state().enabled.load(std::memory_order_relaxed)) {
+            buffer().add(op, hv);
+        }
+    }
+
+    //! read_header checks that \p in starts with a trace header, throwing an
+    //! \p std::runtime_error if it doesn't.
+    static void read_header(std::istream& in) {
+        char file_magic[kMagicSize];
+        uint32_t version;
+        in.read(file_magic, kMagicSize);
+        in.read(reinterpret_cast<char*>(&version), sizeof(version));
+        if (!in || memcmp(file_magic, magic(), kMagicSize) != 0 ||
+            version != kVersion) {
+            throw std::runtime_error("not a trace file of a supported version");
+        }
+    }
+
+    //! read_chunk reads the next chunk of a trace from \p in into \p c. It
+    //! returns false at the end of the trace, and throws an \p
+    //! std::runtime_error if the chunk is truncated.
+    static bool read_chunk(std::istream& in, chunk& c) {
+        uint32_t count;
+        in.read(reinterpret_cast<char*>(&c.thread), sizeof(c.thread));
+        if (in.gcount() == 0) {
+            return false;
+        }
+        in.read(reinterpret_cast<char*>(&count), sizeof(count));
+        c.ops.resize(count);
+        c.hashes.resize(count);
+        in.read(reinterpret_cast<char*>(c.ops.data()), count);
+        in.read(reinterpret_cast<char*>(c.hashes.data()),
+                count * sizeof(uint64_t));
+        if (!in) {
+            throw std::runtime_error("truncated trace file");
+        }
+        return true;
+    }
+
+private:
+    // The first bytes of a trace file
+    static const size_t kMagicSize = 8;
+    static const char* magic() {
+        return "cuckootr";
+    }
+
+    static const uint32_t kVersion = 1;
+
+    // The number of records each thread buffers before appending them to the
+    // file
+    static const size_t kChunkSize = 4096;
+
+    struct ThreadBuffer;
+
+    // State is the process-wide state of the trace. The mutex guards
+    // everything but enabled.
+    struct State {
+        std::mutex mtx;
+        std::ofstream out;
+        std::atomic<bool> enabled;
+        std::set<ThreadBuffer*> buffers;
+        uint32_t next_thread;
+
+        State(): enabled(false), next_thread(0) {}
+    };
+
+    // ThreadBuffer holds one thread's records until they are written. It
+    // registers itself with the state on first use, so that stop can flush
+    // it, and flushes itself when the thread exits.
+    struct ThreadBuffer {
+        bool registered;
+        uint32_t thread;
+        size_t count;
+        uint8_t ops[kChunkSize];
+        uint64_t hashes[kChunkSize];
+
+        ThreadBuffer(): registered(false), thread(0), count(0) {}
+
+        ~ThreadBuffer() {
+            if (registered) {
+                State& s = state();
+                std::lock_guard<std::mutex> lock(s.mtx);
+                write_chunk(*this);
+                s.buffers.erase(this);
+            }
+        }
+
+        inline void add(const op_type op, const uint64_t hv) {
+            if (!registered) {
+                State& s = state();
+                std::lock_guard<std::mutex> lock(s.mtx);
+                thread = s.next_thread++;
+                s.buffers.insert(this);
+                registered = true;
+            }
+            ops[count] = static_cast<uint8_t>(op);
+            hashes[count] = hv;
+            if (++count == kChunkSize) {
+                std::lock_guard<std::mutex> lock(state().mtx);
+                write_chunk(*this);
+            }
+        }
+    };
+
+    static State& state() {
+        static State s;
+        return s;
+    }
+
+    static ThreadBuffer& buffer() {
+        static thread_local ThreadBuffer b;
+        return b;
+    }
+
+    // write_chunk appends the buffered records of b to the file, if one is
+    // open, and empties the buffer. It must be called with the mutex held.
+    static void write_chunk(ThreadBuffer& b) {
+        State& s = state();
+        if (b.count > 0 && s.out.is_open()) {
+            const uint32_t count = b.count;
+            s.out.write(reinterpret_cast<const char*>(&b.thread),
+                        sizeof(b.thread));
+            s.out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+            s.out.write(reinterpret_cast<const char*>(b.ops), count);
+            s.out.write(reinterpret_cast<const char*>(b.hashes),
+                        count * sizeof(uint64_t));
+        }
+        b.count = 0;
+    }
+};
+
+#if LIBCUCKOO_TRACE
+#  define LIBCUCKOO_TRACE_OP(op, hv) cuckoo_trace::record(cuckoo_trace::op, hv)
+#else
+#  define LIBCUCKOO_TRACE_OP(op, hv) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,135 @@
+// Compares ways of storing 16- and 32-byte binary keys. For each key width,
+// it fills tables of std::array<uint8_t, N> with CityHasher and
+// std::equal_to, with BinaryKeyHasher and BinaryKeyEqual, and tables of
+// binary_key<N> with and without partial keys, to --load percent. It looks
+// up every key in each table, and as many keys that aren't in it, and
+// reports the time per lookup and the size of the bucket array, as CSV.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <vector>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include <libcuckoo/binary_key.hh>
+#include <libcuckoo/city_hasher.hh>
+#include "test_util.cc"
+
+// The number of buckets in the tables, expressed as a power of 2. This can
+// be set with the command line flag --power
+size_t power = 14;
+// The load factor to fill each table to, in percent. This can be set with the
+// command line flag --load
+size_t load = 90;
+// The number of times each set of keys is looked up. This can be set with
+// the command line flag --reps
+size_t reps = 5;
+// The seed which the random number generator uses. This can be set with the
+// command line flag --seed
+size_t seed = 0;
+
+// Looks up each of keys in the table, returning the average time per lookup
+// in nanoseconds
+template <class Table, class K>
+double time_lookups(Table& table, const std::vector<K>& keys,
+                    const bool expected) {
+    size_t found = 0;
+    size_t v;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; r++) {
+        for (size_t i = 0; i < keys.size(); i++) {
+            found += table.find(keys[i], v);
+        }
+    }
+    const double nanos = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count();
+    ASSERT_EQ(found, expected ? reps * keys.size() : 0);
+    return nanos / (reps * keys.size());
+}
+
+template <class K, class Hash, class Pred, class PartialKey>
+void bench(const char* name, const std::vector<K>& present,
+           const std::vector<K>& absent) {
+    typedef cuckoohash_map<K, size_t, Hash, Pred, PartialKey> Table;
+    Table table(present.size());
+    for (size_t i = 0; i < present.size(); i++) {
+        table.insert(present[i], i);
+    }
+    ASSERT_EQ(table.hashpower(), power);
+    const double hit_ns = time_lookups(table, present, true);
+    const double miss_ns = time_lookups(table, absent, false);
+    std::cout << name << "," << sizeof(K) << "," << PartialKey::bits << ","
+              << table.load_factor() << "," << hit_ns << "," << miss_ns << ","
+              << table.memory_usage().buckets << std::endl;
+}
+
+template <size_t N>
+void bench_width(std::mt19937_64& gen) {
+    typedef std::array<uint8_t, N> Array;
+    typedef binary_key<N> Key;
+    const size_t numkeys = (1UL << power) * SLOT_PER_BUCKET * load / 100;
+    std::vector<Array> present_arrays(numkeys), absent_arrays(numkeys);
+    std::vector<Key> present(numkeys), absent(numkeys);
+    for (size_t i = 0; i < numkeys; i++) {
+        for (size_t j = 0; j < N; j += 8) {
+            const uint64_t p = gen(), a = gen();
+            memcpy(present_arrays[i].data() + j, &p, sizeof(p));
+            memcpy(absent_arrays[i].data() + j, &a, sizeof(a));
+        }
+        // Present and absent keys differ in their last byte, so no absent
+        // key is in the table
+        present_arrays[i][N - 1] &= 0xfe;
+        absent_arrays[i][N - 1] |= 1;
+        present[i] = Key::from(present_arrays[i].data());
+        absent[i] = Key::from(absent_arrays[i].data());
+    }
+
+    bench<Array, CityHasher<Array>, std::equal_to<Array>,
+          default_partial_key<Array> >(
+        "std::array CityHasher std::equal_to", present_arrays,
+        absent_arrays);
+    bench<Array, BinaryKeyHasher<Array>, BinaryKeyEqual<Array>,
+          default_partial_key<Array> >(
+        "std::array BinaryKeyHasher BinaryKeyEqual", present_arrays,
+        absent_arrays);
+    bench<Key, std::hash<Key>, std::equal_to<Key>, default_partial_key<Key> >(
+        "binary_key", present, absent);
+    bench<Key, std::hash<Key>, std::equal_to<Key>, partial_key_bits<0> >(
+        "binary_key", present, absent);
+}
+
+int main(int argc, char** argv) {
+    const char* args[] = {"--power", "--load", "--reps", "--seed"};
+    size_t* arg_vars[] = {&power, &load, &reps, &seed};
+    const char* arg_help[] = {
+        "The number of buckets in the tables, expressed as a power of 2",
+        "The load factor to fill each table to, in percent",
+        "The number of times each set of keys is looked up",
+        "The seed used by the random number generator"
+    };
+    parse_flags(argc, argv, "A benchmark for binary keys", args, arg_vars,
+                arg_help, sizeof(args)/sizeof(const char*), NULL, NULL, NULL,
+                0);
+    if (load == 0 || load > 95) {
+        std::cerr << "--load must be between 1 and 95" << std::endl;
+        exit(1);
+    }
+
+    if (seed == 0) {
+        seed = std::chrono::system_clock::now().time_since_epoch().count();
+    }
+    std::cerr << "seed = " << seed << std::endl;
+    std::mt19937_64 gen(seed);
+
+    std::cout << "table,key_bytes,partial_bits,load_factor,hit_ns,miss_ns,"
+              << "bucket_bytes" << std::endl;
+    bench_width<16>(gen);
+    bench_width<32>(gen);
+}
@@ -0,0 +1,165 @@
+// Measures the cost of expanding tables of different sizes. For each
+// hashpower in the sweep and each number of expansion threads, it fills a
+// table of that hashpower to --load percent and doubles it with rehash, while
+// reader and writer threads keep running finds and updates on it. It reports
+// how long the expansion held the table, the memory used while the old and new
+// tables coexist, and the longest time a reader or writer was blocked, as CSV.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include "test_util.cc"
+
+typedef uint64_t KeyType;
+typedef uint64_t ValType;
+typedef cuckoohash_map<KeyType, ValType> Table;
+
+// The range of hashpowers to expand from. These can be set with the command
+// line flags --begin-power and --end-power
+size_t begin_power = 14;
+size_t end_power = 18;
+// The largest number of threads the expansion uses. Thread counts double from
+// 1 up to this. This can be set with the command line flag --max-threads
+size_t max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+// The load factor to fill each table to before expanding it. This can be set
+// with the command line flag --load
+size_t load = 90;
+// The number of threads running finds and updates during the expansion. These
+// can be set with the command line flags --readers and --writers
+size_t readers = 1;
+size_t writers = 1;
+// The seed which the random number generator uses. This can be set with the
+// command line flag --seed
+size_t seed = 0;
+
+typedef std::chrono::steady_clock clock_type;
+
+// Runs finds or updates of random keys from keys until finished is set,
+// recording the latency of each one
+void worker_thread(Table& table, const std::vector<KeyType>& keys,
+                   bool update, size_t thread_seed, LatencyHistogram& hist,
+                   std::atomic<size_t>& started, std::atomic<bool>& finished) {
+    std::mt19937_64 gen(thread_seed);
+    ValType v;
+    started.fetch_add(1);
+    while (!finished.load(std::memory_order_acquire)) {
+        const KeyType key = keys[gen() % keys.size()];
+        const clock_type::time_point start = clock_type::now();
+        if (update) {
+            table.update(key, 1);
+        } else {
+            table.find(key, v);
+        }
+        hist.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        clock_type::now() - start).count());
+    }
+}
+
+// Fills a table of hashpower hp and expands it with nthreads threads,
+// printing a line of results
+void measure_expansion(size_t hp, size_t nthreads, std::mt19937_64& gen) {
+    const size_t n = (1UL << hp) * SLOT_PER_BUCKET * load / 100;
+    std::vector<std::pair<KeyType, ValType> > items(n);
+    std::vector<KeyType> keys(n);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = gen();
+        items[i] = std::make_pair(keys[i], i);
+    }
+    Table table(items.begin(), items.end());
+    items.clear();
+    ASSERT_EQ(table.hashpower(), hp);
+    const typename Table::memory_stats before = table.memory_usage();
+
+    std::vector<std::thread> threads;
+    std::vector<LatencyHistogram> hists(readers + writers);
+    std::atomic<size_t> started(0);
+    std::atomic<bool> finished(false);
+    for (size_t i = 0; i < readers + writers; i++) {
+        threads.emplace_back(worker_thread, std::ref(table), std::cref(keys),
+                             i >= readers, seed + i, std::ref(hists[i]),
+                             std::ref(started), std::ref(finished));
+    }
+    while (started.load() < readers + writers);
+
+    const clock_type::time_point start = clock_type::now();
+    ASSERT_TRUE(table.rehash(hp + 1, nthreads));
+    const double expansion_secs = std::chrono::duration<double>(
+        clock_type::now() - start).count();
+    finished.store(true, std::memory_order_release);
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    const typename Table::memory_stats after = table.memory_usage();
+
+    LatencyHistogram reads, writes;
+    for (size_t i = 0; i < hists.size(); i++) {
+        (i < readers ? reads : writes).merge(hists[i]);
+    }
+    // While the elements are moved, the old table and the new one are both
+    // allocated
+    const size_t old_bytes = before.total;
+    const size_t new_bytes = after.total - after.retired_tables;
+    std::cout << hp << "," << nthreads << "," << table.size() << ","
+              << expansion_secs << "," << old_bytes << "," << new_bytes << ","
+              << old_bytes + new_bytes << "," << reads.max() / 1e6 << ","
+              << writes.max() / 1e6 << std::endl;
+}
+
+int main(int argc, char** argv) {
+    const char* args[] = {"--begin-power", "--end-power", "--max-threads",
+                          "--load", "--readers", "--writers", "--seed"};
+    size_t* arg_vars[] = {&begin_power, &end_power, &max_threads, &load,
+                          &readers, &writers, &seed};
+    const char* arg_help[] = {
+        "The smallest hashpower to expand from",
+        "The largest hashpower to expand from",
+        "The largest number of threads the expansion uses",
+        "The load factor to fill each table to before expanding it",
+        "The number of threads running finds during the expansion",
+        "The number of threads running updates during the expansion",
+        "The seed used by the random number generator"
+    };
+    parse_flags(argc, argv, "A benchmark for the cost of expansion", args,
+                arg_vars, arg_help, sizeof(args)/sizeof(const char*), NULL,
+                NULL, NULL, 0);
+
+    if (begin_power == 0 || begin_power > end_power || end_power > 32) {
+        std::cerr << "The hashpowers must satisfy 0 < --begin-power <= "
+                  << "--end-power <= 32" << std::endl;
+        exit(1);
+    } else if (load == 0 || load > 100 || max_threads == 0) {
+        std::cerr << "--load must be between 1 and 100, and --max-threads "
+                  << "must be positive" << std::endl;
+        exit(1);
+    }
+
+    if (seed == 0) {
+        seed = std::chrono::system_clock::now().time_since_epoch().count();
+    }
+    std::cerr << "seed = " << seed << std::endl;
+    std::mt19937_64 gen(seed);
+
+    std::cout << "hashpower,threads,elements,expansion_seconds,old_table_bytes,"
+              << "new_table_bytes,peak_bytes,max_reader_stall_ms,"
+              << "max_writer_stall_ms" << std::endl;
+    for (size_t hp = begin_power; hp <= end_power; hp++) {
+        for (size_t t = 1; ; t = std::min(t * 2, max_threads)) {
+            measure_expansion(hp, t, gen);
+            if (t == max_threads) {
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,281 @@
+// Compares hash functions for the table. For each set of keys and each hash
+// function that applies to it, it measures the time to hash a key, and the
+// load factor a table using the hash function reaches before it has to
+// expand. The results are printed as CSV.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include <libcuckoo/binary_key.hh>
+#include <libcuckoo/city_hasher.hh>
+#include <libcuckoo/crc_hasher.hh>
+#include "test_util.cc"
+
+// The number of keys in each key set, and the number of elements the tables
+// start out sized for, expressed as powers of 2. These can be set with the
+// command line flags --key-power and --table-power
+size_t key_power = 20;
+size_t table_power = 18;
+// The number of times each key set is hashed when timing a hash function.
+// This can be set with the command line flag --reps
+size_t reps = 10;
+// The seed which the random number generator uses. This can be set with the
+// command line flag --seed
+size_t seed = 0;
+
+// CityHash64 of the key's bytes, always called out of line in libcityhash,
+// unlike CityHasher
+template <class Key>
+class CityLibraryHasher {
+public:
+    size_t operator()(const Key& k) const {
+        return CityHash64((const char*) &k, sizeof(k));
+    }
+};
+
+template <>
+class CityLibraryHasher<std::string> {
+public:
+    size_t operator()(const std::string& k) const {
+        return CityHash64(k.c_str(), k.size());
+    }
+};
+
+// CityHash128 of the key's bytes, folded to 64 bits
+template <class Key>
+class City128Hasher {
+public:
+    size_t operator()(const Key& k) const {
+        return Hash128to64(CityHash128((const char*) &k, sizeof(k)));
+    }
+};
+
+template <>
+class City128Hasher<std::string> {
+public:
+    size_t operator()(const std::string& k) const {
+        return Hash128to64(CityHash128(k.c_str(), k.size()));
+    }
+};
+
+// The 64-bit finalizer of MurmurHash3
+class Fmix64Hasher {
+public:
+    size_t operator()(uint64_t k) const {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    }
+};
+
+// The output function of the SplitMix64 generator
+class SplitMix64Hasher {
+public:
+    size_t operator()(uint64_t k) const {
+        k = (k ^ (k >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        k = (k ^ (k >> 27)) * 0x94d049bb133111ebULL;
+        return k ^ (k >> 31);
+    }
+};
+
+// Fibonacci hashing, a single multiply by 2^64 divided by the golden ratio.
+// Only the high bits of the result are well mixed, so the result is rotated
+// to put them where the table picks the bucket from.
+class FibonacciHasher {
+public:
+    size_t operator()(const uint64_t k) const {
+        const uint64_t h = k * 0x9e3779b97f4a7c15ULL;
+        return (h >> 32) | (h << 32);
+    }
+};
+
+// Returns the average time to hash one of keys, in nanoseconds
+template <class K, class H>
+double time_hash(const std::vector<K>& keys) {
+    const H hasher = H();
+    size_t sum = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; r++) {
+        for (size_t i = 0; i < keys.size(); i++) {
+            sum += hasher(keys[i]);
+        }
+    }
+    const double nanos = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count();
+    // Keeps the compiler from optimizing the hashing away
+    if (sum == 42) {
+        std::cerr << "" << std::flush;
+    }
+    return nanos / (reps * keys.size());
+}
+
+// Returns the average time to hash one of keys with the hasher's hash_many,
+// in nanoseconds
+template <class K, class H>
+double time_hash_many(const std::vector<K>& keys) {
+    const H hasher = H();
+    std::vector<size_t> hvs(keys.size());
+    size_t sum = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < reps; r++) {
+        hasher.hash_many(keys.data(), keys.size(), hvs.data());
+        sum += hvs[r % hvs.size()];
+    }
+    const double nanos = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count();
+    if (sum == 42) {
+        std::cerr << "" << std::flush;
+    }
+    return nanos / (reps * keys.size());
+}
+
+// Inserts keys into a table until it expands, returning its load factor right
+// before the expansion, or 0 if it never expanded
+template <class K, class H>
+double load_at_expansion(const std::vector<K>& keys) {
+    cuckoohash_map<K, size_t, H> table(1U << table_power);
+    const size_t hashpower = table.hashpower();
+    double load = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        load = table.load_factor();
+        table.insert(keys[i], i);
+        if (table.hashpower() != hashpower) {
+            return load;
+        }
+    }
+    return 0;
+}
+
+template <class K, class H>
+void bench(const char* key_set, const char* hasher,
+           const std::vector<K>& keys) {
+    std::cout << key_set << "," << hasher << "," << time_hash<K, H>(keys)
+              << "," << load_at_expansion<K, H>(keys) << std::endl;
+}
+
+// The hashes from hash_many are the same as from hashing each key, so the
+// table fills up the same way
+template <class K, class H>
+void bench_many(const char* key_set, const char* hasher,
+                const std::vector<K>& keys) {
+    std::cout << key_set << "," << hasher << ","
+              << time_hash_many<K, H>(keys) << ","
+              << load_at_expansion<K, H>(keys) << std::endl;
+}
+
+typedef std::array<uint8_t, 16> Binary16;
+
+// Runs the benchmarks that apply to integer keys
+template <class K>
+void bench_integers(const char* key_set, const std::vector<K>& keys) {
+    bench<K, std::hash<K> >(key_set, "std::hash", keys);
+    bench<K, CityHasher<K> >(key_set, "CityHasher", keys);
+    bench_many<K, CityHasher<K> >(key_set, "CityHasher hash_many", keys);
+    bench<K, CityLibraryHasher<K> >(key_set, "CityHash64", keys);
+    bench<K, City128Hasher<K> >(key_set, "CityHash128 folded", keys);
+    bench<K, CrcHasher<K> >(key_set, "CrcHasher", keys);
+    bench<K, Fmix64Hasher>(key_set, "fmix64", keys);
+    bench<K, SplitMix64Hasher>(key_set, "splitmix64", keys);
+    bench<K, FibonacciHasher>(key_set, "fibonacci", keys);
+}
+
+// Runs the benchmarks that apply to string keys
+void bench_strings(const char* key_set, const std::vector<std::string>& keys) {
+    bench<std::string, std::hash<std::string> >(key_set, "std::hash", keys);
+    bench<std::string, CityHasher<std::string> >(key_set, "CityHasher", keys);
+    bench<std::string, CityLibraryHasher<std::string> >(
+        key_set, "CityHash64", keys);
+    bench<std::string, City128Hasher<std::string> >(
+        key_set, "CityHash128 folded", keys);
+    bench<std::string, CrcHasher<std::string> >(key_set, "CrcHasher", keys);
+}
+
+// Runs the benchmarks that apply to 16-byte binary keys
+void bench_binary(const char* key_set, const std::vector<Binary16>& keys) {
+    bench<Binary16, CityHasher<Binary16> >(key_set, "CityHasher", keys);
+    bench_many<Binary16, CityHasher<Binary16> >(
+        key_set, "CityHasher hash_many", keys);
+    bench<Binary16, BinaryKeyHasher<Binary16> >(
+        key_set, "BinaryKeyHasher", keys);
+    bench<Binary16, CrcHasher<Binary16> >(key_set, "CrcHasher", keys);
+}
+
+int main(int argc, char** argv) {
+    const char* args[] = {"--key-power", "--table-power", "--reps", "--seed"};
+    size_t* arg_vars[] = {&key_power, &table_power, &reps, &seed};
+    const char* arg_help[] = {
+        "The number of keys in each key set, expressed as a power of 2",
+        "The number of elements the tables start out sized for, expressed as "
+        "a power of 2",
+        "The number of times each key set is hashed when timing",
+        "The seed used by the random number generator"
+    };
+    parse_flags(argc, argv, "A benchmark for hash functions", args, arg_vars,
+                arg_help, sizeof(args)/sizeof(const char*), NULL, NULL, NULL,
+                0);
+    if (key_power <= table_power) {
+        std::cerr << "--key-power must be greater than --table-power, so "
+                  << "that the tables expand" << std::endl;
+        exit(1);
+    }
+
+    if (seed == 0) {
+        seed = std::chrono::system_clock::now().time_since_epoch().count();
+    }
+    std::cerr << "seed = " << seed << std::endl;
+    std::cerr << "AVX2 batch hashing "
+              << (CityHashBatchAccelerated() ? "used" : "not available")
+              << std::endl;
+    std::cerr << "CRC32C instruction "
+              << (CrcHashAccelerated() ? "used" : "not available") << std::endl;
+    std::mt19937_64 gen(seed);
+
+    const size_t numkeys = 1U << key_power;
+    std::vector<uint32_t> sequential32(numkeys), random32(numkeys);
+    std::vector<uint64_t> sequential(numkeys), random(numkeys), strided(numkeys);
+    std::vector<std::string> short_strings(numkeys), long_strings(numkeys);
+    std::vector<Binary16> sequential16(numkeys), random16(numkeys);
+    for (size_t i = 0; i < numkeys; i++) {
+        sequential32[i] = sequential[i] = i;
+        random[i] = gen();
+        random32[i] = random[i];
+        // Keys that differ only in their high bits defeat hashes that don't
+        // mix them into the low bits the table picks buckets with
+        strided[i] = i << 32;
+        short_strings[i] = std::to_string(random[i] % 100000000);
+        long_strings[i] = generateKey<std::string>(random[i]);
+        // Sequential 16-byte keys are counters in their last 8 bytes, like
+        // IPv6 addresses in one /64 subnet
+        const uint64_t zero = 0, other = gen();
+        memcpy(sequential16[i].data(), &zero, sizeof(zero));
+        memcpy(sequential16[i].data() + 8, &sequential[i], sizeof(uint64_t));
+        memcpy(random16[i].data(), &random[i], sizeof(uint64_t));
+        memcpy(random16[i].data() + 8, &other, sizeof(other));
+    }
+
+    std::cout << "key_set,hasher,ns_per_hash,load_factor_at_expansion"
+              << std::endl;
+    bench_integers("sequential uint32", sequential32);
+    bench_integers("random uint32", random32);
+    bench_integers("sequential uint64", sequential);
+    bench_integers("random uint64", random);
+    bench_integers("strided uint64", strided);
+    bench_strings("short strings", short_strings);
+    bench_strings("long strings", long_strings);
+    bench_binary("sequential 16-byte", sequential16);
+    bench_binary("random 16-byte", random16);
+}
@@ -46,6 +46,8 @@ size_t end_load = 90;
 size_t seed = 0;
 // Whether to use strings as the key
 bool use_strings = false;
+// Whether to count hardware events during the inserts
+bool use_perf = false;
 
 template <class T>
 class InsertEnvironment {
@@ -102,8 +104,10 @@ void InsertThroughputTest(InsertEnvironment<T> *env) {
     std::vector<std::thread> threads;
     size_t keys_per_thread = env->numkeys * ((end_load-begin_load) / 100.0) /
         thread_num;
+    PerfCounters perf(use_perf);
     timeval t1, t2;
     gettimeofday(&t1, NULL);
+    perf.start();
     for (size_t i = 0; i < thread_num; i++) {
         threads.emplace_back(
             insert_thread<KType, ValType>, std::ref(env->table),
@@ -113,6 +117,7 @@ void InsertThroughputTest(InsertEnvironment<T> *env) {
     for (size_t i = 0; i < threads.size(); i++) {
         threads[i].join();
     }
+    perf.stop();
     gettimeofday(&t2, NULL);
     double elapsed_time = (t2.tv_sec - t1.tv_sec) * 1000.0; // sec to ms
     elapsed_time += (t2.tv_usec - t1.tv_usec) / 1000.0; // us to ms
@@ -126,6 +131,9 @@ void InsertThroughputTest(InsertEnvironment<T> *env) {
     std::cout << "Throughput: " << std::fixed
               << (double)num_inserts / (elapsed_time/1000)
               << " inserts/sec" << std::endl;
+    if (use_perf) {
+        perf.report(std::cout, num_inserts);
+    }
 }
 
 int main(int argc, char** argv) {
@@ -140,10 +148,11 @@ int main(int argc, char** argv) {
         "throughput",
         "The seed used by the random number generator"
     };
-    const char* flags[] = {"--use-strings"};
-    bool* flag_vars[] = {&use_strings};
+    const char* flags[] = {"--use-strings", "--perf"};
+    bool* flag_vars[] = {&use_strings, &use_perf};
     const char* flag_help[] = {
-        "If set, the key type of the map will be std::string"
+        "If set, the key type of the map will be std::string",
+        "If set, hardware performance counters are reported for the inserts"
     };
     parse_flags(argc, argv, "A benchmark for inserts", args, arg_vars, arg_help,
                 sizeof(args)/sizeof(const char*), flags, flag_vars, flag_help,
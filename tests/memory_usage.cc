@@ -0,0 +1,110 @@
+// Reports how many bytes per entry tables of different key and value types
+// cost at different load factors, using cuckoohash_map::memory_usage. Each
+// table is sized for 2^power elements and filled with random keys to each
+// load factor in the sweep. The results are printed as CSV. Memory allocated
+// by the keys themselves, such as the characters of a std::string, is not
+// counted.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <string>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include "test_util.cc"
+
+// The number of elements to size each table with, expressed as a power of 2.
+// This can be set with the command line flag --power
+size_t power = 20;
+// The load factors to sweep, in percent. These can be set with the command
+// line flags --begin-load, --end-load and --load-step
+size_t begin_load = 5;
+size_t end_load = 95;
+size_t load_step = 15;
+// The seed which the random number generator uses. This can be set with the
+// command line flag --seed
+size_t seed = 0;
+
+// A 32-byte value type, for tables whose values are bigger than their keys
+typedef std::array<char, 32> BigValue;
+
+template <class V>
+V make_value(size_t i) {
+    return V(i);
+}
+
+template <>
+BigValue make_value<BigValue>(size_t i) {
+    BigValue v;
+    v.fill(static_cast<char>(i));
+    return v;
+}
+
+// Fills a table of the given types to each load factor of the sweep and prints
+// a line of its memory usage at each one
+template <class K, class V>
+void sweep_table(const char* key_name, const char* mapped_name,
+                 std::mt19937_64& gen) {
+    typedef cuckoohash_map<K, V> Table;
+    Table table(1U << power);
+    const size_t capacity = table.bucket_count() * SLOT_PER_BUCKET;
+    for (size_t load = begin_load; load <= end_load; load += load_step) {
+        while (table.size() < capacity * load / 100) {
+            const size_t i = gen();
+            table.insert(generateKey<K>(i), make_value<V>(i));
+        }
+        const typename Table::memory_stats ms = table.memory_usage();
+        std::cout << key_name << "," << mapped_name << ","
+                  << sizeof(K) + sizeof(V) << "," << load << ","
+                  << table.load_factor() * 100 << "," << table.size() << ","
+                  << ms.buckets << "," << ms.locks << "," << ms.counters << ","
+                  << ms.overhead << "," << ms.retired_tables << ","
+                  << ms.total << ","
+                  << static_cast<double>(ms.total) / table.size() << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* args[] = {"--power", "--begin-load", "--end-load",
+                          "--load-step", "--seed"};
+    size_t* arg_vars[] = {&power, &begin_load, &end_load, &load_step, &seed};
+    const char* arg_help[] = {
+        "The number of elements to size each table with, expressed as a power "
+        "of 2",
+        "The first load factor of the sweep",
+        "The last load factor of the sweep",
+        "The step between load factors of the sweep",
+        "The seed used by the random number generator"
+    };
+    parse_flags(argc, argv, "A benchmark for memory usage per entry", args,
+                arg_vars, arg_help, sizeof(args)/sizeof(const char*), NULL,
+                NULL, NULL, 0);
+
+    if (begin_load == 0 || end_load > 100 || begin_load > end_load ||
+        load_step == 0) {
+        std::cerr << "The load factors must satisfy 0 < --begin-load <= "
+                  << "--end-load <= 100, and --load-step must be positive"
+                  << std::endl;
+        exit(1);
+    }
+
+    if (seed == 0) {
+        seed = std::chrono::system_clock::now().time_since_epoch().count();
+    }
+    std::cerr << "seed = " << seed << std::endl;
+    std::mt19937_64 gen(seed);
+
+    std::cout << "key_type,mapped_type,payload_bytes,target_load,load_factor,"
+              << "entries,buckets,locks,counters,overhead,retired_tables,"
+              << "total,bytes_per_entry" << std::endl;
+    sweep_table<uint32_t, uint32_t>("uint32_t", "uint32_t", gen);
+    sweep_table<uint64_t, uint64_t>("uint64_t", "uint64_t", gen);
+    sweep_table<uint64_t, BigValue>("uint64_t", "char[32]", gen);
+    sweep_table<std::string, uint64_t>("std::string", "uint64_t", gen);
+}
@@ -0,0 +1,144 @@
+// Compares the partial key widths the table can store. For each set of keys
+// and each width, it fills a table to --load percent and looks up every key
+// in it, and as many keys that aren't in it. It counts the key comparisons
+// that find a different key than the one looked up, which are the ones
+// partial keys are there to avoid, and reports them per lookup along with the
+// time per lookup and the size of the bucket array, as CSV.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include <libcuckoo/city_hasher.hh>
+#include "test_util.cc"
+
+// The number of buckets in the tables, expressed as a power of 2. This can
+// be set with the command line flag --power
+size_t power = 16;
+// The load factor to fill each table to, in percent. This can be set with the
+// command line flag --load
+size_t load = 90;
+// The seed which the random number generator uses. This can be set with the
+// command line flag --seed
+size_t seed = 0;
+
+// An equality predicate that counts the comparisons of different keys it is
+// asked to make. Since every table has its own copy of the predicate, the
+// count is kept where the given pointer points.
+template <class Key>
+class CountingEqual {
+public:
+    explicit CountingEqual(size_t* mismatches = NULL)
+        : mismatches_(mismatches) {}
+
+    bool operator()(const Key& a, const Key& b) const {
+        const bool eq = a == b;
+        if (!eq) {
+            ++*mismatches_;
+        }
+        return eq;
+    }
+
+private:
+    size_t* mismatches_;
+};
+
+// Looks up each of keys in the table, returning the average time per lookup
+// in nanoseconds
+template <class Table, class K>
+double time_lookups(Table& table, const std::vector<K>& keys,
+                    const bool expected) {
+    size_t found = 0;
+    size_t v;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); i++) {
+        found += table.find(keys[i], v);
+    }
+    const double nanos = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count();
+    ASSERT_EQ(found, expected ? keys.size() : 0);
+    return nanos / keys.size();
+}
+
+template <class K, size_t Bits>
+void bench(const char* key_set, const std::vector<K>& present,
+           const std::vector<K>& absent) {
+    typedef cuckoohash_map<K, size_t, CityHasher<K>, CountingEqual<K>,
+                           partial_key_bits<Bits> > Table;
+    size_t mismatches = 0;
+    Table table(present.size(), CityHasher<K>(),
+                CountingEqual<K>(&mismatches));
+    for (size_t i = 0; i < present.size(); i++) {
+        table.insert(present[i], i);
+    }
+    ASSERT_EQ(table.hashpower(), power);
+
+    mismatches = 0;
+    const double hit_ns = time_lookups(table, present, true);
+    const double hit_mismatches =
+        static_cast<double>(mismatches) / present.size();
+    mismatches = 0;
+    const double miss_ns = time_lookups(table, absent, false);
+    const double miss_mismatches =
+        static_cast<double>(mismatches) / absent.size();
+    std::cout << key_set << "," << Bits << "," << table.load_factor() << ","
+              << hit_ns << "," << hit_mismatches << "," << miss_ns << ","
+              << miss_mismatches << "," << table.memory_usage().buckets
+              << std::endl;
+}
+
+template <class K>
+void bench_widths(const char* key_set, const std::vector<K>& present,
+                  const std::vector<K>& absent) {
+    bench<K, 0>(key_set, present, absent);
+    bench<K, 8>(key_set, present, absent);
+    bench<K, 16>(key_set, present, absent);
+}
+
+int main(int argc, char** argv) {
+    const char* args[] = {"--power", "--load", "--seed"};
+    size_t* arg_vars[] = {&power, &load, &seed};
+    const char* arg_help[] = {
+        "The number of buckets in the tables, expressed as a power of 2",
+        "The load factor to fill each table to, in percent",
+        "The seed used by the random number generator"
+    };
+    parse_flags(argc, argv, "A benchmark for partial key widths", args,
+                arg_vars, arg_help, sizeof(args)/sizeof(const char*), NULL,
+                NULL, NULL, 0);
+    if (load == 0 || load > 95) {
+        std::cerr << "--load must be between 1 and 95" << std::endl;
+        exit(1);
+    }
+
+    if (seed == 0) {
+        seed = std::chrono::system_clock::now().time_since_epoch().count();
+    }
+    std::cerr << "seed = " << seed << std::endl;
+    std::mt19937_64 gen(seed);
+
+    // Present and absent keys are drawn from disjoint halves of the random
+    // numbers, so no absent key is in the table
+    const size_t numkeys = (1UL << power) * SLOT_PER_BUCKET * load / 100;
+    std::vector<uint64_t> present(numkeys), absent(numkeys);
+    std::vector<std::string> present_strings(numkeys), absent_strings(numkeys);
+    for (size_t i = 0; i < numkeys; i++) {
+        present[i] = gen() << 1;
+        absent[i] = (gen() << 1) | 1;
+        present_strings[i] = generateKey<std::string>(present[i]);
+        absent_strings[i] = generateKey<std::string>(absent[i]);
+    }
+
+    std::cout << "key_set,partial_bits,load_factor,hit_ns,hit_mismatches,"
+              << "miss_ns,miss_mismatches,bucket_bytes" << std::endl;
+    bench_widths("uint64", present, absent);
+    bench_widths("long strings", present_strings, absent_strings);
+}
@@ -0,0 +1,136 @@
+// Compares cuckoohash_pooled_map with a cuckoohash_map that stores 512-byte
+// values in its buckets. For each table, it fills a table of 2^power buckets
+// to --load percent, which takes many cuckoo displacements near the end, and
+// then reads one word of every value, with find for the inline table and
+// find_fn for the pooled one. It reports the time per insert and per lookup,
+// and the memory of the hash table with and without the pool, as CSV.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <vector>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include <libcuckoo/cuckoohash_pooled_map.hh>
+#include <libcuckoo/city_hasher.hh>
+#include "test_util.cc"
+
+// The number of buckets in the tables, expressed as a power of 2. This can
+// be set with the command line flag --power
+size_t power = 12;
+// The load factor to fill each table to, in percent. This can be set with the
+// command line flag --load
+size_t load = 90;
+// The seed which the random number generator uses. This can be set with the
+// command line flag --seed
+size_t seed = 0;
+
+struct Value {
+    uint64_t words[64];
+};
+
+typedef cuckoohash_map<uint64_t, Value, CityHasher<uint64_t> > InlineTable;
+typedef cuckoohash_pooled_map<uint64_t, Value, CityHasher<uint64_t> >
+    PooledTable;
+
+// Reads the first word of the value of each key
+uint64_t read_values(InlineTable& table, const std::vector<uint64_t>& keys) {
+    uint64_t sum = 0;
+    Value v = Value();
+    for (size_t i = 0; i < keys.size(); i++) {
+        table.find(keys[i], v);
+        sum += v.words[0];
+    }
+    return sum;
+}
+
+uint64_t read_values(PooledTable& table, const std::vector<uint64_t>& keys) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        table.find_fn(keys[i], [&sum](const Value& v) {
+                sum += v.words[0];
+            });
+    }
+    return sum;
+}
+
+// Returns the bytes of the hash table itself, without the pool
+size_t table_bytes(InlineTable& table) {
+    return table.memory_usage().total;
+}
+
+size_t table_bytes(PooledTable& table) {
+    return table.memory_usage().table;
+}
+
+size_t total_bytes(InlineTable& table) {
+    return table.memory_usage().total;
+}
+
+size_t total_bytes(PooledTable& table) {
+    return table.memory_usage().total;
+}
+
+template <class Table>
+void bench(const char* name, const std::vector<uint64_t>& keys) {
+    Table table((1UL << power) * SLOT_PER_BUCKET);
+    Value v;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); i++) {
+        v.words[0] = i;
+        table.insert(keys[i], v);
+    }
+    const double insert_ns = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count() / keys.size();
+    ASSERT_EQ(table.hashpower(), power);
+
+    start = std::chrono::steady_clock::now();
+    const uint64_t sum = read_values(table, keys);
+    const double find_ns = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count() / keys.size();
+    ASSERT_EQ(sum, keys.size() * (keys.size() - 1) / 2);
+
+    std::cout << name << "," << sizeof(Value) << "," << table.load_factor()
+              << "," << insert_ns << "," << find_ns << ","
+              << table_bytes(table) << "," << total_bytes(table)
+              << std::endl;
+}
+
+int main(int argc, char** argv) {
+    const char* args[] = {"--power", "--load", "--seed"};
+    size_t* arg_vars[] = {&power, &load, &seed};
+    const char* arg_help[] = {
+        "The number of buckets in the tables, expressed as a power of 2",
+        "The load factor to fill each table to, in percent",
+        "The seed used by the random number generator"
+    };
+    parse_flags(argc, argv, "A benchmark for pooled values", args, arg_vars,
+                arg_help, sizeof(args)/sizeof(const char*), NULL, NULL, NULL,
+                0);
+    if (load == 0 || load > 95) {
+        std::cerr << "--load must be between 1 and 95" << std::endl;
+        exit(1);
+    }
+
+    if (seed == 0) {
+        seed = std::chrono::system_clock::now().time_since_epoch().count();
+    }
+    std::cerr << "seed = " << seed << std::endl;
+    std::mt19937_64 gen(seed);
+
+    const size_t numkeys = (1UL << power) * SLOT_PER_BUCKET * load / 100;
+    std::vector<uint64_t> keys(numkeys);
+    for (size_t i = 0; i < numkeys; i++) {
+        keys[i] = gen();
+    }
+
+    std::cout << "table,value_bytes,load_factor,insert_ns,find_ns,"
+              << "table_bytes,total_bytes" << std::endl;
+    bench<InlineTable>("inline", keys);
+    bench<PooledTable>("pooled", keys);
+}
@@ -46,6 +46,8 @@ size_t seed = 0;
 size_t test_len = 10;
 // Whether to use strings as the key
 bool use_strings = false;
+// Whether to count hardware events during the reads
+bool use_perf = false;
 
 template <class T>
 class ReadEnvironment {
@@ -112,6 +114,8 @@ void ReadThroughputTest(ReadEnvironment<T> *env) {
         second_threadnum;
     // When set to true, it signals to the threads to stop running
     std::atomic<bool> finished(false);
+    PerfCounters perf(use_perf);
+    perf.start();
     for (size_t i = 0; i < first_threadnum; i++) {
         threads.emplace_back(read_thread<KType, ValType>, std::ref(env->table),
                              env->keys.begin() + (i*in_keys_per_thread),
@@ -130,6 +134,7 @@ void ReadThroughputTest(ReadEnvironment<T> *env) {
     for (size_t i = 0; i < threads.size(); i++) {
         threads[i].join();
     }
+    perf.stop();
     size_t total_reads = 0;
     for (size_t i = 0; i < counters.size(); i++) {
         total_reads += counters[i].num;
@@ -140,6 +145,9 @@ void ReadThroughputTest(ReadEnvironment<T> *env) {
     std::cout << "Time elapsed:\t" << test_len << " seconds" << std::endl;
     std::cout << "Throughput: " << std::fixed << total_reads / (double)test_len
               << " reads/sec" << std::endl;
+    if (use_perf) {
+        perf.report(std::cout, total_reads);
+    }
 }
 
 int main(int argc, char** argv) {
@@ -153,10 +161,11 @@ int main(int argc, char** argv) {
         "The number of seconds to run the test for",
         "The seed used by the random number generator"
     };
-    const char* flags[] = {"--use-strings"};
-    bool* flag_vars[] = {&use_strings};
+    const char* flags[] = {"--use-strings", "--perf"};
+    bool* flag_vars[] = {&use_strings, &use_perf};
     const char* flag_help[] = {
-        "If set, the key type of the map will be std::string"
+        "If set, the key type of the map will be std::string",
+        "If set, hardware performance counters are reported for the reads"
     };
     parse_flags(argc, argv, "A benchmark for reads", args, arg_vars,
                 arg_help, sizeof(args)/sizeof(const char*), flags,
@@ -0,0 +1,262 @@
+// Measures how insert and find throughput scale with the number of threads.
+// For each band of load factors and each thread count, it fills a fresh table
+// to the start of the band, times the inserts that fill it to the end of the
+// band, and then times finds of the same keys. The results are printed as CSV
+// or JSON with the throughput, the speedup over one thread, and the variance
+// of throughput between threads.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <sched.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include "test_util.cc"
+
+typedef uint32_t KeyType;
+typedef uint32_t ValType;
+typedef cuckoohash_map<KeyType, ValType> Table;
+
+// The number of keys to size the table with, expressed as a power of 2. This
+// can be set with the command line flag --power
+size_t power = 20;
+// The largest number of threads to measure. Thread counts double from 1 up to
+// this. This can be set with the command line flag --max-threads
+size_t max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+// The load factors to sweep, in percent. Each band goes from a multiple of
+// load_step to the next one. These can be set with the command line flags
+// --begin-load, --end-load and --load-step
+size_t begin_load = 0;
+size_t end_load = 90;
+size_t load_step = 30;
+// The seed which the random number generator uses. This can be set with the
+// command line flag --seed
+size_t seed = 0;
+// Whether to pin thread i to core i modulo the number of cores
+bool pin_threads = false;
+// Whether to print JSON instead of CSV
+bool use_json = false;
+
+typedef std::chrono::steady_clock clock_type;
+
+// Pins the calling thread to the given core, if supported
+void pin_to_core(size_t core) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % sysconf(_SC_NPROCESSORS_ONLN), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)core;
+#endif
+}
+
+// The result of running one operation with some number of threads
+struct SweepResult {
+    const char* op;
+    size_t load_begin;
+    size_t load_end;
+    size_t threads;
+    double ops_per_sec;
+    double speedup;
+    double thread_mean;
+    double thread_stddev;
+};
+
+// Runs fn(thread, begin, end) on thread_count threads, splitting [0, n)
+// between them. The threads wait for each other before starting. It fills in
+// res with the throughput of the whole run along with the mean and standard
+// deviation of the threads' individual throughputs.
+template <class F>
+void run_threads(size_t thread_count, size_t n, F fn, SweepResult& res) {
+    std::vector<std::thread> threads;
+    std::vector<double> thread_secs(thread_count);
+    std::atomic<size_t> ready(0);
+    std::atomic<bool> go(false);
+    for (size_t t = 0; t < thread_count; t++) {
+        threads.emplace_back([&, t]() {
+                if (pin_threads) {
+                    pin_to_core(t);
+                }
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire));
+                const clock_type::time_point start = clock_type::now();
+                fn(t, n*t/thread_count, n*(t+1)/thread_count);
+                thread_secs[t] = std::chrono::duration<double>(
+                    clock_type::now() - start).count();
+            });
+    }
+    while (ready.load() < thread_count);
+    const clock_type::time_point start = clock_type::now();
+    go.store(true, std::memory_order_release);
+    for (size_t t = 0; t < thread_count; t++) {
+        threads[t].join();
+    }
+    const double secs = std::chrono::duration<double>(
+        clock_type::now() - start).count();
+    res.threads = thread_count;
+    res.ops_per_sec = n / secs;
+    double sum = 0, sum_sq = 0;
+    for (size_t t = 0; t < thread_count; t++) {
+        const double ops = (n*(t+1)/thread_count - n*t/thread_count) /
+            thread_secs[t];
+        sum += ops;
+        sum_sq += ops * ops;
+    }
+    res.thread_mean = sum / thread_count;
+    res.thread_stddev = std::sqrt(
+        std::max(0.0, sum_sq / thread_count - res.thread_mean*res.thread_mean));
+}
+
+// Measures inserts and finds in the given load band with thread_count threads
+void sweep_point(const std::vector<KeyType>& keys, size_t load_begin,
+                 size_t load_end, size_t thread_count,
+                 std::vector<SweepResult>& results) {
+    const size_t numkeys = keys.size();
+    Table table(numkeys);
+    const size_t prefill = numkeys * load_begin / 100;
+    const size_t band = numkeys * load_end / 100 - prefill;
+    SweepResult res = SweepResult();
+    run_threads(max_threads, prefill,
+                [&](size_t, size_t begin, size_t end) {
+                    for (size_t i = begin; i < end; i++) {
+                        ASSERT_TRUE(table.insert(keys[i], 0));
+                    }
+                }, res);
+
+    res.load_begin = load_begin;
+    res.load_end = load_end;
+    res.op = "insert";
+    run_threads(thread_count, band,
+                [&](size_t, size_t begin, size_t end) {
+                    for (size_t i = prefill + begin; i < prefill + end; i++) {
+                        ASSERT_TRUE(table.insert(keys[i], 0));
+                    }
+                }, res);
+    results.push_back(res);
+
+    res.op = "find";
+    run_threads(thread_count, band,
+                [&](size_t, size_t begin, size_t end) {
+                    ValType v;
+                    for (size_t i = prefill + begin; i < prefill + end; i++) {
+                        ASSERT_TRUE(table.find(keys[i], v));
+                    }
+                }, res);
+    results.push_back(res);
+}
+
+void print_results(const std::vector<SweepResult>& results) {
+    if (use_json) {
+        std::cout << "[" << std::endl;
+    } else {
+        std::cout << "op,load_begin,load_end,threads,ops_per_sec,speedup,"
+                  << "thread_ops_per_sec_mean,thread_ops_per_sec_stddev"
+                  << std::endl;
+    }
+    for (size_t i = 0; i < results.size(); i++) {
+        const SweepResult& r = results[i];
+        if (use_json) {
+            std::cout << "  {\"op\": \"" << r.op << "\", \"load_begin\": "
+                      << r.load_begin << ", \"load_end\": " << r.load_end
+                      << ", \"threads\": " << r.threads
+                      << ", \"ops_per_sec\": " << r.ops_per_sec
+                      << ", \"speedup\": " << r.speedup
+                      << ", \"thread_ops_per_sec_mean\": " << r.thread_mean
+                      << ", \"thread_ops_per_sec_stddev\": "
+                      << r.thread_stddev << "}"
+                      << (i+1 < results.size() ? "," : "") << std::endl;
+        } else {
+            std::cout << r.op << "," << r.load_begin << "," << r.load_end
+                      << "," << r.threads << "," << r.ops_per_sec << ","
+                      << r.speedup << "," << r.thread_mean << ","
+                      << r.thread_stddev << std::endl;
+        }
+    }
+    if (use_json) {
+        std::cout << "]" << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* args[] = {"--power", "--max-threads", "--begin-load",
+                          "--end-load", "--load-step", "--seed"};
+    size_t* arg_vars[] = {&power, &max_threads, &begin_load, &end_load,
+                          &load_step, &seed};
+    const char* arg_help[] = {
+        "The number of keys to size the table with, expressed as a power of 2",
+        "The largest number of threads to measure",
+        "The load factor the sweep starts at",
+        "The load factor the sweep ends at",
+        "The size of each band of load factors",
+        "The seed used by the random number generator"
+    };
+    const char* flags[] = {"--pin", "--json"};
+    bool* flag_vars[] = {&pin_threads, &use_json};
+    const char* flag_help[] = {
+        "If set, thread i is pinned to core i modulo the number of cores",
+        "If set, results are printed as JSON instead of CSV"
+    };
+    parse_flags(argc, argv, "A thread scalability sweep", args, arg_vars,
+                arg_help, sizeof(args)/sizeof(const char*), flags, flag_vars,
+                flag_help, sizeof(flags)/sizeof(const char*));
+
+    if (end_load > 100 || begin_load >= end_load) {
+        std::cerr << "--end-load must be greater than --begin-load and at "
+                  << "most 100" << std::endl;
+        exit(1);
+    } else if (load_step == 0 || max_threads == 0) {
+        std::cerr << "--load-step and --max-threads must be positive"
+                  << std::endl;
+        exit(1);
+    }
+
+    if (seed == 0) {
+        seed = std::chrono::system_clock::now().time_since_epoch().count();
+    }
+    std::cerr << "seed = " << seed << std::endl;
+    std::mt19937_64 gen(seed);
+    const size_t numkeys = 1U << power;
+    std::vector<KeyType> keys(numkeys);
+    for (size_t i = 0; i < numkeys; i++) {
+        keys[i] = i;
+    }
+    std::shuffle(keys.begin(), keys.end(), gen);
+
+    std::vector<size_t> thread_counts;
+    for (size_t t = 1; t < max_threads; t *= 2) {
+        thread_counts.push_back(t);
+    }
+    thread_counts.push_back(max_threads);
+
+    std::vector<SweepResult> results;
+    for (size_t load = begin_load; load < end_load; load += load_step) {
+        const size_t load_band_end = std::min(load + load_step, end_load);
+        const size_t first = results.size();
+        for (size_t i = 0; i < thread_counts.size(); i++) {
+            std::cerr << "load " << load << "-" << load_band_end << "%, "
+                      << thread_counts[i] << " threads" << std::endl;
+            sweep_point(keys, load, load_band_end, thread_counts[i], results);
+        }
+        // The speedup is relative to the single-threaded run of the same
+        // operation in the same band
+        for (size_t i = first; i < results.size(); i++) {
+            results[i].speedup =
+                results[i].ops_per_sec / results[first + (i - first) % 2].ops_per_sec;
+        }
+    }
+    print_results(results);
+}
@@ -190,14 +190,22 @@ void iterator_thread(AllEnvironment<KType> *env, size_t seed) {
     if (env->finished.load()) {
         return;
     }
-    if (gen() & 1) {
+    switch (gen() % 3) {
+    case 0:
         for (auto it = env->table2.begin(); !it.is_end(); it++) {
             if (gen() & 1) {
                 it.set_value((*it).second + 1);
             }
         }
-    } else {
+        break;
+    case 1: {
         auto res = env->table.snapshot_table();
+        break;
+    }
+    case 2:
+        for (auto it = env->table.weak_cbegin(); !it.is_end(); it++) {
+            env->table.update(it->first, it->second + 1);
+        }
     }
 }
 
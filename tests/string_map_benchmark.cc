@@ -0,0 +1,140 @@
+// Compares cuckoohash_string_map with a cuckoohash_map of std::string on
+// URL-like keys. For each table, it inserts the keys, looks every one of them
+// up, and reports the time per insert and per lookup, the number of calls to
+// operator new made by the inserts, and the bytes the table holds once it is
+// full, including the characters of its keys, as CSV.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include <libcuckoo/cuckoohash_string_map.hh>
+#include <libcuckoo/city_hasher.hh>
+#include "test_util.cc"
+
+// The number of elements to insert, expressed as a power of 2. This can be set
+// with the command line flag --power
+size_t power = 16;
+// The seed which the random number generator uses. This can be set with the
+// command line flag --seed
+size_t seed = 0;
+
+// Counts the calls to operator new and the bytes they hold. Each allocation is
+// prefixed with its size, so operator delete can subtract it.
+std::atomic<size_t> num_allocations(0);
+std::atomic<size_t> allocated_bytes(0);
+
+const size_t kAllocHeader = 16;
+
+void* operator new(size_t size) {
+    num_allocations.fetch_add(1);
+    allocated_bytes.fetch_add(size);
+    char* p = static_cast<char*>(malloc(size + kAllocHeader));
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    *reinterpret_cast<size_t*>(p) = size;
+    return p + kAllocHeader;
+}
+
+void operator delete(void* p) noexcept {
+    if (p != NULL) {
+        char* base = static_cast<char*>(p) - kAllocHeader;
+        allocated_bytes.fetch_sub(*reinterpret_cast<size_t*>(base));
+        free(base);
+    }
+}
+
+void operator delete(void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+// Returns the bytes of the table's arena, which it allocates with malloc
+template <class Table>
+size_t arena_bytes(Table&) {
+    return 0;
+}
+
+template <class T>
+size_t arena_bytes(cuckoohash_string_map<T>& table) {
+    return table.memory_usage().arena;
+}
+
+template <class Table>
+void bench(const char* name, const std::vector<std::string>& keys) {
+    const size_t bytes_before = allocated_bytes.load();
+    Table table(keys.size());
+    const size_t allocations_before = num_allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); i++) {
+        table.insert(keys[i], i);
+    }
+    const double insert_ns = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count() / keys.size();
+    const size_t allocations = num_allocations.load() - allocations_before;
+    const size_t bytes =
+        allocated_bytes.load() - bytes_before + arena_bytes(table);
+
+    size_t found = 0;
+    size_t v;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); i++) {
+        found += table.find(keys[i], v);
+    }
+    const double find_ns = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count() / keys.size();
+    ASSERT_EQ(found, keys.size());
+
+    std::cout << name << "," << keys.size() << "," << insert_ns << ","
+              << find_ns << "," << allocations << "," << bytes << ","
+              << static_cast<double>(bytes) / keys.size() << std::endl;
+}
+
+int main(int argc, char** argv) {
+    const char* args[] = {"--power", "--seed"};
+    size_t* arg_vars[] = {&power, &seed};
+    const char* arg_help[] = {
+        "The number of elements to insert, expressed as a power of 2",
+        "The seed used by the random number generator"
+    };
+    parse_flags(argc, argv, "A benchmark for string keyed tables", args,
+                arg_vars, arg_help, sizeof(args)/sizeof(const char*), NULL,
+                NULL, NULL, 0);
+
+    if (seed == 0) {
+        seed = std::chrono::system_clock::now().time_since_epoch().count();
+    }
+    std::cerr << "seed = " << seed << std::endl;
+    std::mt19937_64 gen(seed);
+
+    // Keys share a host and differ in a path of 8 to 80 characters
+    const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789/-_.";
+    const size_t numkeys = 1UL << power;
+    std::vector<std::string> keys(numkeys);
+    for (size_t i = 0; i < numkeys; i++) {
+        keys[i] = "https://example.com/";
+        const size_t len = 8 + gen() % 73;
+        for (size_t j = 0; j < len; j++) {
+            keys[i] += alphabet[gen() % (sizeof(alphabet) - 1)];
+        }
+        keys[i] += std::to_string(i);
+    }
+
+    std::cout << "table,entries,insert_ns,find_ns,allocations,bytes,"
+              << "bytes_per_entry" << std::endl;
+    bench<cuckoohash_map<std::string, size_t, CityHasher<std::string>,
+                         StringEqual, partial_key_bits<16> > >(
+        "cuckoohash_map<std::string>", keys);
+    bench<cuckoohash_string_map<size_t> >("cuckoohash_string_map", keys);
+}
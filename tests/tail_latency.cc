@@ -0,0 +1,231 @@
+// Tests the latency of individual inserts and finds in a mixed workload,
+// reporting the median, tail percentiles, and maximum of each operation. With
+// --expansions, the table starts out too small for the keys, so the run
+// crosses that many expansions.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include "test_util.cc"
+
+typedef uint32_t KeyType;
+typedef std::string KeyType2;
+typedef uint32_t ValType;
+
+// The number of keys to fill the table with, expressed as a power of 2. This
+// can be set with the command line flag --power
+size_t power = 20;
+// The number of threads running operations. This can be set with the command
+// line flag --thread-num
+size_t thread_num = sysconf(_SC_NPROCESSORS_ONLN);
+// The load factor to fill the table up to before measuring latency. This can
+// be set with the command line flag --begin-load.
+size_t begin_load = 0;
+// The load factor to fill the table up to while measuring latency. This can be
+// set with the command line flag --end-load.
+size_t end_load = 90;
+// The percentage of operations that are finds rather than inserts. This can be
+// set with the command line flag --read-percentage
+size_t read_percentage = 50;
+// The number of times the table has to double in size to hold the keys, which
+// is the number of expansions the run will cross. This can be set with the
+// command line flag --expansions
+size_t expansions = 0;
+// The seed which the random number generator uses. This can be set with the
+// command line flag --seed
+size_t seed = 0;
+// Whether to use strings as the key
+bool use_strings = false;
+// Whether to count hardware events during the measured operations
+bool use_perf = false;
+
+typedef std::chrono::steady_clock clock_type;
+
+inline uint64_t nanos_since(const clock_type::time_point& start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        clock_type::now() - start).count();
+}
+
+template <class T>
+class LatencyEnvironment {
+    typedef typename T::key_type KType;
+public:
+    LatencyEnvironment()
+        : numkeys(1U << power), table(numkeys >> expansions), keys(numkeys) {
+        // Sets up the random number generator
+        if (seed == 0) {
+            seed = std::chrono::system_clock::now().time_since_epoch().count();
+        }
+        std::cout << "seed = " << seed << std::endl;
+        gen.seed(seed);
+
+        // We fill the keys array with integers between numkeys and
+        // 2*numkeys, shuffled randomly
+        keys[0] = numkeys;
+        for (size_t i = 1; i < numkeys; i++) {
+            const size_t swapind = gen() % i;
+            keys[i] = keys[swapind];
+            keys[swapind] = generateKey<KType>(i+numkeys);
+        }
+
+        // We prefill the table to begin_load with thread_num threads,
+        // giving each thread enough keys to insert
+        std::vector<std::thread> threads;
+        size_t keys_per_thread = numkeys * (begin_load / 100.0) / thread_num;
+        for (size_t i = 0; i < thread_num; i++) {
+            threads.emplace_back(insert_thread<KType, ValType>, std::ref(table),
+                                 keys.begin()+i*keys_per_thread,
+                                 keys.begin()+(i+1)*keys_per_thread);
+        }
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+
+        init_size = table.size();
+        ASSERT_TRUE(init_size == keys_per_thread * thread_num);
+
+        std::cout << "Table with capacity " << (numkeys >> expansions) <<
+            " prefilled with " << init_size << " keys" << std::endl;
+    }
+
+    size_t numkeys;
+    T table;
+    std::vector<KType> keys;
+    std::mt19937_64 gen;
+    size_t init_size;
+};
+
+// Inserts the keys in [begin, end), mixing in a find of a random key before
+// or after the range for every read_percentage out of 100 operations, and
+// records the latency of each operation.
+template <class T>
+void latency_thread(T& table, const std::vector<typename T::key_type>& keys,
+                    size_t begin, size_t end, size_t thread_seed,
+                    LatencyHistogram& inserts, LatencyHistogram& finds) {
+    std::mt19937_64 gen(thread_seed);
+    ValType v;
+    size_t i = begin;
+    while (i < end) {
+        if (gen() % 100 < read_percentage) {
+            const typename T::key_type& key = keys[gen() % keys.size()];
+            const clock_type::time_point start = clock_type::now();
+            table.find(key, v);
+            finds.record(nanos_since(start));
+        } else {
+            const clock_type::time_point start = clock_type::now();
+            const bool inserted = table.insert(keys[i], 0);
+            inserts.record(nanos_since(start));
+            ASSERT_TRUE(inserted);
+            ++i;
+        }
+    }
+}
+
+template <class T>
+void TailLatencyTest(LatencyEnvironment<T> *env) {
+    std::vector<std::thread> threads;
+    std::vector<LatencyHistogram> inserts(thread_num), finds(thread_num);
+    const size_t keys_per_thread = env->numkeys *
+        ((end_load-begin_load) / 100.0) / thread_num;
+    const size_t hashpower = env->table.hashpower();
+    PerfCounters perf(use_perf);
+    const clock_type::time_point start = clock_type::now();
+    perf.start();
+    for (size_t i = 0; i < thread_num; i++) {
+        threads.emplace_back(
+            latency_thread<T>, std::ref(env->table), std::cref(env->keys),
+            env->init_size + i*keys_per_thread,
+            env->init_size + (i+1)*keys_per_thread, seed + i + 1,
+            std::ref(inserts[i]), std::ref(finds[i]));
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    perf.stop();
+    const double elapsed_time = nanos_since(start) / 1e9;
+    for (size_t i = 1; i < thread_num; i++) {
+        inserts[0].merge(inserts[i]);
+        finds[0].merge(finds[i]);
+    }
+    const size_t num_ops = inserts[0].count() + finds[0].count();
+    // Reports the results
+    std::cout << "----------Results----------" << std::endl;
+    std::cout << "Final load factor:\t" << env->table.load_factor() * 100
+              << "%" << std::endl;
+    std::cout << "Expansions crossed:\t"
+              << env->table.hashpower() - hashpower << std::endl;
+    std::cout << "Number of operations:\t" << num_ops << std::endl;
+    std::cout << "Time elapsed:\t" << elapsed_time << " seconds" << std::endl;
+    std::cout << "Throughput: " << std::fixed << num_ops / elapsed_time
+              << " ops/sec" << std::endl;
+    inserts[0].report(std::cout, "Insert");
+    finds[0].report(std::cout, "Find");
+    if (use_perf) {
+        perf.report(std::cout, num_ops);
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* args[] = {"--power", "--thread-num", "--begin-load",
+                          "--end-load", "--read-percentage", "--expansions",
+                          "--seed"};
+    size_t* arg_vars[] = {&power, &thread_num, &begin_load, &end_load,
+                          &read_percentage, &expansions, &seed};
+    const char* arg_help[] = {
+        "The number of keys to fill the table with, expressed as a power of 2",
+        "The number of threads to spawn",
+        "The load factor to fill the table up to before measuring latency",
+        "The load factor to fill the table up to while measuring latency",
+        "The percentage of operations that are finds rather than inserts",
+        "The number of expansions the run should cross, by starting with a "
+        "table that is 2^expansions times too small",
+        "The seed used by the random number generator"
+    };
+    const char* flags[] = {"--use-strings", "--perf"};
+    bool* flag_vars[] = {&use_strings, &use_perf};
+    const char* flag_help[] = {
+        "If set, the key type of the map will be std::string",
+        "If set, hardware performance counters are reported for the "
+        "measured operations"
+    };
+    parse_flags(argc, argv, "A benchmark for per-operation latency", args,
+                arg_vars, arg_help, sizeof(args)/sizeof(const char*), flags,
+                flag_vars, flag_help, sizeof(flags)/sizeof(const char*));
+
+    if (begin_load >= 100) {
+        std::cerr << "--begin-load must be between 0 and 99" << std::endl;
+        exit(1);
+    } else if (begin_load >= end_load) {
+        std::cerr << "--end-load must be greater than --begin-load"
+                  << std::endl;
+        exit(1);
+    } else if (read_percentage >= 100) {
+        std::cerr << "--read-percentage must be between 0 and 99" << std::endl;
+        exit(1);
+    } else if (expansions >= power) {
+        std::cerr << "--expansions must be less than --power" << std::endl;
+        exit(1);
+    }
+
+    if (use_strings) {
+        auto *env = new LatencyEnvironment<cuckoohash_map<KeyType2, ValType>>;
+        TailLatencyTest(env);
+        delete env;
+    } else {
+        auto *env = new LatencyEnvironment<cuckoohash_map<KeyType, ValType>>;
+        TailLatencyTest(env);
+        delete env;
+    }
+}
@@ -0,0 +1,124 @@
+// Tests the hasher and equality predicate for 16- and 32-byte binary keys,
+// and tables of binary_key, whose keys should be 16-byte aligned.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <array>
+#include <iostream>
+#include <set>
+#include <stdint.h>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include <libcuckoo/binary_key.hh>
+#include "test_util.cc"
+
+// Keys that differ in any one bit should compare unequal, and a std::array
+// and a binary_key with the same bytes should hash to the same value.
+template <size_t N>
+void check_equal_and_hash() {
+    typedef std::array<uint8_t, N> Array;
+    typedef binary_key<N> Key;
+    Array a;
+    for (size_t i = 0; i < N; i++) {
+        a[i] = static_cast<uint8_t>(i * 37 + 1);
+    }
+    const Key k = Key::from(a.data());
+    const BinaryKeyEqual<Array> array_eq = BinaryKeyEqual<Array>();
+    const BinaryKeyHasher<Array> array_hash = BinaryKeyHasher<Array>();
+    EXPECT_TRUE(array_eq(a, a));
+    EXPECT_TRUE(k == Key::from(a.data()));
+    EXPECT_EQ(array_hash(a), std::hash<Key>()(k));
+
+    std::set<size_t> hashes;
+    hashes.insert(array_hash(a));
+    for (size_t i = 0; i < N; i++) {
+        for (size_t bit = 0; bit < 8; bit++) {
+            Array b = a;
+            b[i] ^= static_cast<uint8_t>(1 << bit);
+            EXPECT_FALSE(array_eq(a, b));
+            EXPECT_FALSE(array_eq(b, a));
+            EXPECT_TRUE(k != Key::from(b.data()));
+            hashes.insert(array_hash(b));
+        }
+    }
+    EXPECT_EQ(hashes.size(), N * 8 + 1);
+}
+
+// BinaryKeyHasher multiplies each pair of words after xoring them with a
+// constant. Keys in which one word of a pair equals its constant must still
+// hash apart by the other word.
+template <size_t N>
+void check_cancelled_words() {
+    typedef std::array<uint8_t, N> Array;
+    const uint64_t constants[] = {
+        0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+        0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+    };
+    const BinaryKeyHasher<Array> array_hash = BinaryKeyHasher<Array>();
+    const uint64_t nkeys = 1000;
+    for (size_t word = 0; word < N / 8; word++) {
+        std::set<size_t> hashes;
+        Array a = Array();
+        memcpy(a.data() + word * 8, &constants[word], 8);
+        for (uint64_t i = 0; i < nkeys; i++) {
+            memcpy(a.data() + (word ^ 1) * 8, &i, sizeof(i));
+            hashes.insert(array_hash(a));
+        }
+        EXPECT_EQ(hashes.size(), nkeys);
+    }
+}
+
+void EqualAndHashBinaryKeys() {
+    check_equal_and_hash<16>();
+    check_equal_and_hash<32>();
+    check_cancelled_words<16>();
+    check_cancelled_words<32>();
+}
+
+// Tables of binary_key use std::hash and operator== by default, and store
+// their keys 16-byte aligned.
+template <size_t N>
+void check_table() {
+    typedef binary_key<N> Key;
+    static_assert(alignof(Key) == 16, "binary keys must be 16-byte aligned");
+    cuckoohash_map<Key, uint64_t> table(1);
+    const uint64_t nkeys = 10000;
+    Key k = Key();
+    for (uint64_t i = 0; i < nkeys; i++) {
+        // Only the last 8 bytes differ, like IPv6 addresses in one subnet
+        memcpy(k.bytes + N - 8, &i, sizeof(i));
+        EXPECT_TRUE(table.insert(k, i));
+    }
+    for (uint64_t i = 0; i < 2 * nkeys; i++) {
+        memcpy(k.bytes + N - 8, &i, sizeof(i));
+        uint64_t v = 0;
+        EXPECT_EQ(table.find(k, v), i < nkeys);
+        if (i < nkeys) {
+            EXPECT_EQ(v, i);
+        }
+    }
+    size_t misaligned = 0;
+    table.parallel_for_each([&misaligned](const Key& key, const uint64_t&) {
+            misaligned += reinterpret_cast<uintptr_t>(&key) % 16 != 0;
+        }, 1);
+    EXPECT_EQ(misaligned, static_cast<size_t>(0));
+    for (uint64_t i = 0; i < nkeys; i += 2) {
+        memcpy(k.bytes + N - 8, &i, sizeof(i));
+        EXPECT_TRUE(table.erase(k));
+    }
+    EXPECT_EQ(table.size(), nkeys / 2);
+}
+
+void BinaryKeyTables() {
+    check_table<16>();
+    check_table<32>();
+}
+
+int main() {
+    std::cout << "Running EqualAndHashBinaryKeys" << std::endl;
+    EqualAndHashBinaryKeys();
+    std::cout << "Running BinaryKeyTables" << std::endl;
+    BinaryKeyTables();
+}
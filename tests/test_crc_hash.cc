@@ -0,0 +1,75 @@
+// Tests that CrcHash64 gives the same hashes whether it uses the CRC32C
+// instruction or the portable implementation, and that CrcHasher spreads keys
+// well enough to fill a table.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <iostream>
+#include <random>
+#include <set>
+#include <stdint.h>
+#include <string>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include <libcuckoo/crc_hasher.hh>
+#include "test_util.cc"
+
+// Every length up to a few times the 16 bytes the hash consumes per round,
+// at every alignment, should hash the same way in both implementations.
+void AcceleratedMatchesPortable() {
+    std::mt19937_64 gen(1);
+    char buf[128];
+    for (size_t rep = 0; rep < 100; rep++) {
+        for (size_t i = 0; i < sizeof(buf); i++) {
+            buf[i] = static_cast<char>(gen());
+        }
+        const uint64_t seed = (rep == 0) ? 0 : gen();
+        for (size_t offset = 0; offset < 8; offset++) {
+            for (size_t len = 0; len + offset <= sizeof(buf); len++) {
+                EXPECT_EQ(CrcHash64WithSeed(buf + offset, len, seed),
+                          CrcHash64Portable(buf + offset, len, seed));
+            }
+        }
+        EXPECT_EQ(CrcHash64(buf, sizeof(buf)),
+                  CrcHash64WithSeed(buf, sizeof(buf), 0));
+    }
+}
+
+// Different seeds, different lengths of zeros, and keys differing in a single
+// bit should all give different hashes.
+void HashesDiffer() {
+    const char zeros[64] = {0};
+    std::set<uint64_t> hashes;
+    for (size_t len = 0; len <= sizeof(zeros); len++) {
+        EXPECT_TRUE(hashes.insert(CrcHash64(zeros, len)).second);
+        EXPECT_TRUE(hashes.insert(CrcHash64WithSeed(zeros, len, 1)).second);
+    }
+    for (size_t bit = 0; bit < sizeof(zeros) * 8; bit++) {
+        char key[sizeof(zeros)] = {0};
+        key[bit / 8] = static_cast<char>(1 << (bit % 8));
+        EXPECT_TRUE(hashes.insert(CrcHash64(key, sizeof(key))).second);
+    }
+}
+
+// Keys that are sequential, or only differ in their high bits, should fill a
+// table to a high load factor before it has to expand, as should strings.
+void CrcHasherFillsTables() {
+    check_fill<CrcHasher<uint32_t>, uint32_t>();
+    check_fill<CrcHasher<uint32_t>, uint32_t>(14);
+    check_fill<CrcHasher<uint64_t>, uint64_t>();
+    check_fill<CrcHasher<uint64_t>, uint64_t>(40);
+    check_fill<CrcHasher<std::string>, std::string>();
+}
+
+int main() {
+    std::cout << "CRC32C instruction "
+              << (CrcHashAccelerated() ? "used" : "not available") << std::endl;
+    std::cout << "Running AcceleratedMatchesPortable" << std::endl;
+    AcceleratedMatchesPortable();
+    std::cout << "Running HashesDiffer" << std::endl;
+    HashesDiffer();
+    std::cout << "Running CrcHasherFillsTables" << std::endl;
+    CrcHasherFillsTables();
+}
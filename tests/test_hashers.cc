@@ -0,0 +1,138 @@
+// Tests that CityHasher computes the same hashes as CityHash64, whether it
+// hashes a key inline, through the library, or in a batch, and that it spreads
+// keys that only differ in a few bits well enough to fill a table.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include <libcuckoo/city_hasher.hh>
+#include "test_util.cc"
+
+// A fixed-size key of n bytes
+template <size_t n>
+struct Bytes {
+    char data[n];
+};
+
+template <class Key>
+void check_key(const Key& k) {
+    EXPECT_EQ(CityHasher<Key>()(k),
+              CityHash64(reinterpret_cast<const char*>(&k), sizeof(k)));
+}
+
+template <size_t n>
+void check_bytes(std::mt19937_64& gen) {
+    Bytes<n> k;
+    for (size_t i = 0; i < n; i++) {
+        k.data[i] = static_cast<char>(gen());
+    }
+    check_key(k);
+}
+
+// Every length CityHashInline hashes inline, and a few it passes on to
+// CityHash64, should give the same hash as CityHash64.
+void InlineHashesMatchCityHash64() {
+    std::mt19937_64 gen(1);
+    char buf[64];
+    for (size_t rep = 0; rep < 100; rep++) {
+        for (size_t i = 0; i < sizeof(buf); i++) {
+            buf[i] = static_cast<char>(gen());
+        }
+        for (size_t len = 0; len <= sizeof(buf); len++) {
+            EXPECT_EQ(CityHashInline::hash(buf, len), CityHash64(buf, len));
+        }
+        // Unaligned keys
+        for (size_t len = 0; len < sizeof(buf); len++) {
+            EXPECT_EQ(CityHashInline::hash(buf + 1, len),
+                      CityHash64(buf + 1, len));
+        }
+    }
+}
+
+// The hashers for integral types, fixed-size keys and strings should give the
+// same hash as CityHash64 on the bytes of the key.
+void HashersMatchCityHash64() {
+    std::mt19937_64 gen(2);
+    for (size_t rep = 0; rep < 1000; rep++) {
+        const uint64_t r = gen();
+        check_key(static_cast<uint8_t>(r));
+        check_key(static_cast<uint16_t>(r));
+        check_key(static_cast<uint32_t>(r));
+        check_key(r);
+        check_key(static_cast<int>(r));
+        check_bytes<3>(gen);
+        check_bytes<12>(gen);
+        check_bytes<16>(gen);
+        check_bytes<24>(gen);
+        check_bytes<32>(gen);
+        check_bytes<48>(gen);
+        const std::string s(r % 80, static_cast<char>(r));
+        EXPECT_EQ(CityHasher<std::string>()(s), CityHash64(s.data(), s.size()));
+    }
+}
+
+template <class Key>
+void check_hash_many(std::mt19937_64& gen) {
+    // Enough keys to cover every remainder after the vectorized groups
+    const size_t n = 39;
+    std::vector<Key> keys(n);
+    for (size_t i = 0; i < n; i++) {
+        char* p = reinterpret_cast<char*>(&keys[i]);
+        for (size_t j = 0; j < sizeof(Key); j++) {
+            p[j] = static_cast<char>(gen());
+        }
+    }
+    const CityHasher<Key> hasher;
+    for (size_t len = 0; len <= n; len++) {
+        std::vector<size_t> hvs(len + 1, 0);
+        hasher.hash_many(keys.data(), len, hvs.data());
+        for (size_t i = 0; i < len; i++) {
+            EXPECT_EQ(hvs[i], hasher(keys[i]));
+        }
+        // Nothing past the end of the output should be written
+        EXPECT_EQ(hvs[len], static_cast<size_t>(0));
+    }
+}
+
+// hash_many should give the same hashes as hashing each key, both for the key
+// sizes it vectorizes and for others.
+void HashManyMatchesHashes() {
+    std::cout << "AVX2 batch hashing "
+              << (CityHashBatchAccelerated() ? "used" : "not available")
+              << std::endl;
+    std::mt19937_64 gen(3);
+    for (size_t rep = 0; rep < 10; rep++) {
+        check_hash_many<uint64_t>(gen);
+        check_hash_many<Bytes<16> >(gen);
+        check_hash_many<uint32_t>(gen);
+        check_hash_many<Bytes<12> >(gen);
+    }
+}
+
+// Keys that are sequential, or only differ in their high bits, should fill a
+// table to a high load factor before it has to expand.
+void HashersFillTables() {
+    check_fill<CityHasher<uint32_t>, uint32_t>();
+    check_fill<CityHasher<uint32_t>, uint32_t>(14);
+    check_fill<CityHasher<uint64_t>, uint64_t>();
+    check_fill<CityHasher<uint64_t>, uint64_t>(40);
+}
+
+int main() {
+    std::cout << "Running InlineHashesMatchCityHash64" << std::endl;
+    InlineHashesMatchCityHash64();
+    std::cout << "Running HashersMatchCityHash64" << std::endl;
+    HashersMatchCityHash64();
+    std::cout << "Running HashManyMatchesHashes" << std::endl;
+    HashManyMatchesHashes();
+    std::cout << "Running HashersFillTables" << std::endl;
+    HashersFillTables();
+}
@@ -8,9 +8,12 @@
 #include <limits>
 #include <memory>
 #include <random>
+#include <stdexcept>
 #include <utility>
+#include <vector>
 
 #include <libcuckoo/cuckoohash_map.hh>
+#include <libcuckoo/city_hasher.hh>
 #include "test_util.cc"
 
 typedef uint32_t KeyType;
@@ -82,10 +85,203 @@ void FindNonkeysInTables() {
     }
 }
 
+// Looks up keys and nonkeys together with find_batch, with a hasher that
+// hashes one key at a time and with one that hashes many keys at once
+void FindBatchInTables() {
+    const size_t n = 1000;
+    std::vector<KeyType> batch(n);
+    for (size_t i = 0; i < n; i++) {
+        batch[i] = (i % 3 == 0) ? env->nonkeys[i] : env->keys[i];
+    }
+    std::unique_ptr<ValType[]> vals(new ValType[n]);
+    std::unique_ptr<bool[]> found(new bool[n]);
+    EXPECT_EQ(env->smalltable.find_batch(batch.data(), n, vals.get(),
+                                         found.get()), n - (n + 2) / 3);
+    for (size_t i = 0; i < n; i++) {
+        EXPECT_EQ(found[i], i % 3 != 0);
+        if (found[i]) {
+            EXPECT_EQ(vals[i], env->vals[i]);
+        }
+    }
+
+    cuckoohash_map<uint64_t, ValType, CityHasher<uint64_t> > city_table;
+    std::vector<uint64_t> city_batch(n);
+    for (size_t i = 0; i < n; i++) {
+        city_batch[i] = static_cast<uint64_t>(env->keys[i]) << 32;
+        if (i % 3 != 0) {
+            EXPECT_TRUE(city_table.insert(city_batch[i], env->vals[i]));
+        }
+    }
+    EXPECT_EQ(city_table.find_batch(city_batch.data(), n, vals.get(),
+                                    found.get()), n - (n + 2) / 3);
+    for (size_t i = 0; i < n; i++) {
+        EXPECT_EQ(found[i], i % 3 != 0);
+        if (found[i]) {
+            EXPECT_EQ(vals[i], env->vals[i]);
+        }
+    }
+}
+
+// Runs the _hashed operations on two tables with a hash computed once
+void HashedOperationsOnTables() {
+    cuckoohash_map<KeyType, ValType> t1, t2;
+    const auto hasher = t1.hash_function();
+    const auto incr = [](const ValType& v) {
+        return v + 1;
+    };
+    ValType v;
+    for (size_t i = 0; i < 1000; i++) {
+        const KeyType k = env->keys[i];
+        const size_t hv = hasher(k);
+        EXPECT_TRUE(t1.insert_hashed(k, hv, env->vals[i]));
+        EXPECT_FALSE(t1.insert_hashed(k, hv, env->vals[i]));
+        EXPECT_TRUE(t2.upsert_hashed(k, hv, incr, env->vals[i]));
+        EXPECT_TRUE(t2.upsert_hashed(k, hv, incr, env->vals[i]));
+        EXPECT_TRUE(t1.find_hashed(k, hv, v));
+        EXPECT_EQ(v, env->vals[i]);
+        EXPECT_TRUE(t2.find_hashed(k, hv, v));
+        EXPECT_EQ(v, static_cast<ValType>(env->vals[i] + 1));
+        EXPECT_EQ(t1.find(k), env->vals[i]);
+    }
+    for (size_t i = 0; i < 1000; i += 2) {
+        const size_t hv = hasher(env->keys[i]);
+        EXPECT_TRUE(t1.erase_hashed(env->keys[i], hv));
+        EXPECT_FALSE(t1.erase_hashed(env->keys[i], hv));
+        EXPECT_FALSE(t1.find_hashed(env->keys[i], hv, v));
+    }
+    EXPECT_EQ(t1.size(), static_cast<size_t>(500));
+    EXPECT_EQ(t2.size(), static_cast<size_t>(1000));
+}
+
+// This test is built with LIBCUCKOO_CHECK_HASHES, so every _hashed
+// operation given a hash that doesn't match its key should throw, without
+// changing the table.
+void WrongHashesAreRejected() {
+    cuckoohash_map<KeyType, ValType> table;
+    const auto hasher = table.hash_function();
+    const KeyType k = env->keys[0];
+    const size_t wrong = hasher(k) ^ 1;
+    EXPECT_TRUE(table.insert(k, env->vals[0]));
+    size_t threw = 0;
+    ValType v;
+    try {
+        table.find_hashed(k, wrong, v);
+    } catch (const std::invalid_argument&) {
+        threw++;
+    }
+    try {
+        table.insert_hashed(env->keys[1], hasher(env->keys[1]) ^ 1,
+                            env->vals[1]);
+    } catch (const std::invalid_argument&) {
+        threw++;
+    }
+    try {
+        table.upsert_hashed(k, wrong, [](const ValType& x) {
+                return x + 1;
+            }, env->vals[0]);
+    } catch (const std::invalid_argument&) {
+        threw++;
+    }
+    try {
+        table.erase_hashed(k, wrong);
+    } catch (const std::invalid_argument&) {
+        threw++;
+    }
+    EXPECT_EQ(threw, static_cast<size_t>(4));
+    EXPECT_EQ(table.size(), static_cast<size_t>(1));
+    EXPECT_EQ(table.find(k), env->vals[0]);
+}
+
+// Builds tables from the keys with the bulk-loading constructor and with
+// bulk_load on a table that already has elements, some of which are
+// duplicates of the loaded ones.
+void BulkLoadTables() {
+    std::vector<KVPair> items(numkeys);
+    for (size_t i = 0; i < numkeys; i++) {
+        items[i] = KVPair(env->keys[i], env->vals[i]);
+    }
+    cuckoohash_map<KeyType, ValType> loaded(items.begin(), items.end());
+    ASSERT_EQ(loaded.size(), numkeys);
+    for (size_t i = 0; i < numkeys; i++) {
+        EXPECT_EQ(loaded.find(env->keys[i]), env->vals[i]);
+    }
+
+    cuckoohash_map<KeyType, ValType> partial_table(numkeys / 4);
+    for (size_t i = 0; i < numkeys / 2; i++) {
+        EXPECT_TRUE(partial_table.insert(env->keys[i], env->vals[i]));
+    }
+    EXPECT_EQ(partial_table.bulk_load(items.begin(), items.end(), 3),
+              numkeys - numkeys / 2);
+    ASSERT_EQ(partial_table.size(), numkeys);
+    for (size_t i = 0; i < numkeys; i++) {
+        EXPECT_EQ(partial_table.find(env->keys[i]), env->vals[i]);
+    }
+}
+
+// The memory usage of a table should add up, and grow with the number of
+// buckets
+void MemoryUsageOfTables() {
+    cuckoohash_map<KeyType, ValType> table(numkeys);
+    auto ms = table.memory_usage();
+    EXPECT_EQ(ms.buckets + ms.locks + ms.counters + ms.overhead +
+              ms.retired_tables, ms.total);
+    EXPECT_TRUE(ms.buckets >= table.bucket_count() * SLOT_PER_BUCKET *
+                (sizeof(KeyType) + sizeof(ValType)));
+    EXPECT_TRUE(ms.locks > 0);
+    EXPECT_TRUE(ms.counters > 0);
+    EXPECT_EQ(ms.retired_tables, static_cast<size_t>(0));
+
+    EXPECT_TRUE(table.rehash(table.hashpower() + 1));
+    auto grown = table.memory_usage();
+    EXPECT_EQ(grown.buckets, ms.buckets * 2);
+    EXPECT_EQ(grown.locks, ms.locks);
+}
+
+// Tables storing partial keys of each width should find every key, whatever
+// the default for the key type would be, and keep them through erases and
+// expansion.
+template <size_t Bits>
+void check_partial_key_width() {
+    typedef cuckoohash_map<KeyType, ValType, CityHasher<KeyType>,
+                           std::equal_to<KeyType>, partial_key_bits<Bits> >
+        Table;
+    const size_t n = numkeys / 16;
+    Table table(n / 4);
+    for (size_t i = 0; i < n; i++) {
+        EXPECT_TRUE(table.insert(env->keys[i], env->vals[i]));
+    }
+    for (size_t i = 0; i < n; i += 2) {
+        EXPECT_TRUE(table.erase(env->keys[i]));
+    }
+    ValType v;
+    for (size_t i = 0; i < n; i++) {
+        EXPECT_EQ(table.find(env->keys[i], v), i % 2 == 1);
+        EXPECT_FALSE(table.find(env->nonkeys[i], v));
+    }
+}
+
+void PartialKeyWidths() {
+    check_partial_key_width<0>();
+    check_partial_key_width<8>();
+    check_partial_key_width<16>();
+}
+
 int main() {
     env = new InsertFindEnvironment;
     std::cout << "Running FindKeysInTables" << std::endl;
     FindKeysInTables();
     std::cout << "Running FindNonkeysInTables" << std::endl;
     FindNonkeysInTables();
+    std::cout << "Running FindBatchInTables" << std::endl;
+    FindBatchInTables();
+    std::cout << "Running HashedOperationsOnTables" << std::endl;
+    HashedOperationsOnTables();
+    std::cout << "Running WrongHashesAreRejected" << std::endl;
+    WrongHashesAreRejected();
+    std::cout << "Running BulkLoadTables" << std::endl;
+    BulkLoadTables();
+    std::cout << "Running MemoryUsageOfTables" << std::endl;
+    MemoryUsageOfTables();
+    std::cout << "Running PartialKeyWidths" << std::endl;
+    PartialKeyWidths();
 }
@@ -3,12 +3,15 @@
 #endif
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <iostream>
 #include <limits>
 #include <random>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include <libcuckoo/cuckoohash_map.hh>
 #include "test_util.cc"
@@ -112,6 +115,165 @@ void FilledTableIncrementItems() {
     }
 }
 
+void FilledTableWeakIterForwards() {
+    bool visited[size] = {};
+    for (auto t = iter_env->table.weak_cbegin(); !t.is_end(); ++t) {
+        auto itemiter = std::find(iter_env->items, iter_env->items_end, *t);
+        EXPECT_NE(itemiter, iter_env->items_end);
+        visited[iter_env->items_end-itemiter-1] = true;
+    }
+    // Checks that all the items were visited
+    for (size_t i = 0; i < size; i++) {
+        EXPECT_TRUE(visited[i]);
+    }
+    EXPECT_TRUE(iter_env->emptytable.weak_cbegin().is_end());
+}
+
+// Iterates with a weak_const_iterator while another thread inserts enough
+// items to expand the table several times. Every item the iterator returns
+// must be one that was inserted.
+void WeakIterConcurrentInserts() {
+    const size_t num_inserts = size * SLOT_PER_BUCKET * 64;
+    Table table(size);
+    for (size_t i = 0; i < size; i++) {
+        table.insert(i, i);
+    }
+    std::thread inserter([&table, num_inserts]() {
+            for (size_t i = size; i < num_inserts; i++) {
+                ASSERT_TRUE(table.insert(i, i));
+            }
+        });
+    for (auto t = table.weak_cbegin(); !t.is_end(); ++t) {
+        EXPECT_TRUE(t->first < num_inserts);
+        EXPECT_EQ(t->first, t->second);
+    }
+    inserter.join();
+    EXPECT_EQ(table.size(), num_inserts);
+}
+
+// Iterates with a weak_const_iterator while another thread rebuilds the
+// table with rehash, starting once the iterator is halfway through. No
+// element is inserted or erased, so the iterator must return every element,
+// even though the rebuilds move elements that were in their second bucket
+// to stripes it has already passed. The keys are random, so that many of
+// them are in their second bucket, and each element's value is its index.
+void WeakIterConcurrentRehash() {
+    const size_t num_items = 1U << 16;
+    Table table(num_items * 2);
+    std::mt19937 gen(1);
+    size_t inserted = 0;
+    while (inserted < num_items) {
+        inserted += table.insert(gen(), inserted);
+    }
+    const size_t hashpower = table.hashpower();
+    std::atomic<bool> halfway(false);
+    std::thread rehasher([&table, &halfway, hashpower]() {
+            while (!halfway.load()) {
+                std::this_thread::yield();
+            }
+            for (size_t hp = hashpower + 1; hp < hashpower + 4; hp++) {
+                ASSERT_TRUE(table.rehash(hp));
+            }
+        });
+    std::vector<bool> visited(num_items);
+    size_t returned = 0;
+    for (auto t = table.weak_cbegin(); !t.is_end(); ++t) {
+        ASSERT_TRUE(t->second < num_items);
+        visited[t->second] = true;
+        if (++returned == num_items / 2) {
+            halfway.store(true);
+        }
+        // Gives the rehashes a chance to run in the middle of the scan
+        std::this_thread::yield();
+    }
+    rehasher.join();
+    EXPECT_EQ(std::count(visited.begin(), visited.end(), true),
+              static_cast<std::ptrdiff_t>(num_items));
+}
+
+// Checks the parallel bulk operations against a table large enough to be split
+// between several threads.
+void ParallelBulkOperations() {
+    const size_t num_items = 1U << 16;
+    Table table(num_items);
+    size_t expected_sum = 0;
+    for (size_t i = 0; i < num_items; i++) {
+        table.insert(i, i*2);
+        expected_sum += i*2;
+    }
+    for (size_t nthreads = 1; nthreads <= 8; nthreads *= 2) {
+        std::atomic<size_t> count(0);
+        table.parallel_for_each(
+            [&count](const KeyType& k, const ValType& v) {
+                EXPECT_EQ(k*2, v);
+                count.fetch_add(1);
+            }, nthreads);
+        EXPECT_EQ(count.load(), num_items);
+
+        const size_t sum = table.parallel_reduce(
+            static_cast<size_t>(0),
+            [](size_t acc, const KeyType&, const ValType& v) {
+                return acc + v;
+            },
+            [](size_t a, size_t b) { return a + b; }, nthreads);
+        EXPECT_EQ(sum, expected_sum);
+
+        std::vector<Table::value_type> items = table.snapshot_table(nthreads);
+        EXPECT_EQ(items.size(), num_items);
+        std::vector<bool> seen(num_items);
+        for (size_t i = 0; i < items.size(); i++) {
+            EXPECT_EQ(items[i].first*2, items[i].second);
+            seen[items[i].first] = true;
+        }
+        EXPECT_TRUE(std::find(seen.begin(), seen.end(), false) == seen.end());
+    }
+}
+
+// A key whose tag isn't hashed or compared, so parallel_rewrite_keys may
+// change it
+struct TaggedKey {
+    KeyType k;
+    uint32_t tag;
+};
+
+struct TaggedKeyHasher {
+    size_t operator()(const TaggedKey& key) const {
+        return std::hash<KeyType>()(key.k);
+    }
+};
+
+struct TaggedKeyEqual {
+    bool operator()(const TaggedKey& a, const TaggedKey& b) const {
+        return a.k == b.k;
+    }
+};
+
+// parallel_rewrite_keys should hand every key to the function by mutable
+// reference, and the rewritten keys should still be found.
+void ParallelRewriteKeys() {
+    const size_t num_items = 1U << 16;
+    cuckoohash_map<TaggedKey, ValType, TaggedKeyHasher, TaggedKeyEqual>
+        table(num_items);
+    for (size_t i = 0; i < num_items; i++) {
+        const TaggedKey key = {static_cast<KeyType>(i), 0};
+        table.insert(key, i);
+    }
+    table.parallel_rewrite_keys([](TaggedKey& key) {
+            key.tag = key.k + 1;
+        }, 4);
+    std::atomic<size_t> rewritten(0);
+    table.parallel_for_each(
+        [&rewritten](const TaggedKey& key, const ValType& v) {
+            EXPECT_EQ(key.k, v);
+            rewritten.fetch_add(key.tag == key.k + 1);
+        }, 4);
+    EXPECT_EQ(rewritten.load(), num_items);
+    for (size_t i = 0; i < num_items; i++) {
+        const TaggedKey key = {static_cast<KeyType>(i), 0};
+        EXPECT_TRUE(table.contains(key));
+    }
+}
+
 int main() {
     iter_env = new IteratorEnvironment;
     std::cout << "Running EmptyTableBeginEndIterator" << std::endl;
@@ -122,4 +284,14 @@ int main() {
     FilledTableIterForwards();
     std::cout << "Running FilledTableIncrementItems" << std::endl;
     FilledTableIncrementItems();
+    std::cout << "Running FilledTableWeakIterForwards" << std::endl;
+    FilledTableWeakIterForwards();
+    std::cout << "Running WeakIterConcurrentInserts" << std::endl;
+    WeakIterConcurrentInserts();
+    std::cout << "Running WeakIterConcurrentRehash" << std::endl;
+    WeakIterConcurrentRehash();
+    std::cout << "Running ParallelBulkOperations" << std::endl;
+    ParallelBulkOperations();
+    std::cout << "Running ParallelRewriteKeys" << std::endl;
+    ParallelRewriteKeys();
 }
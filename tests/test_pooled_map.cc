@@ -0,0 +1,255 @@
+// Tests cuckoohash_pooled_map with values too large to store in the buckets,
+// that every value it constructs is destroyed exactly once, and that erased
+// values' slots are reused. Also tests cuckoohash_map::erase_fn and
+// find_fn, which the pooled map relies on.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include <libcuckoo/cuckoohash_pooled_map.hh>
+#include <libcuckoo/city_hasher.hh>
+#include "test_util.cc"
+
+// The number of BigValues currently constructed
+std::atomic<int64_t> live_values(0);
+
+// A 512-byte value that counts its instances and can check that its bytes
+// haven't been torn or overwritten
+class BigValue {
+public:
+    BigValue(const uint64_t id = 0) {
+        set(id);
+        live_values.fetch_add(1);
+    }
+
+    BigValue(const BigValue& other) {
+        set(other.id());
+        live_values.fetch_add(1);
+    }
+
+    BigValue& operator=(const BigValue& other) {
+        set(other.id());
+        return *this;
+    }
+
+    ~BigValue() {
+        live_values.fetch_sub(1);
+    }
+
+    uint64_t id() const {
+        return words_[0];
+    }
+
+    bool intact() const {
+        for (size_t i = 1; i < kWords; i++) {
+            if (words_[i] != words_[0] + i) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void set(const uint64_t id) {
+        for (size_t i = 0; i < kWords; i++) {
+            words_[i] = id + i;
+        }
+    }
+
+private:
+    static const size_t kWords = 64;
+    uint64_t words_[kWords];
+};
+
+typedef cuckoohash_pooled_map<uint64_t, BigValue, CityHasher<uint64_t> >
+    Table;
+
+// erase_fn should hand the value of the erased key to the function, and not
+// call it for a key that isn't there.
+void EraseFnSeesErasedValue() {
+    cuckoohash_map<uint64_t, std::string> table;
+    table.insert(1, "one");
+    table.insert(2, "two");
+    std::string erased;
+    EXPECT_TRUE(table.erase_fn(1, [&erased](std::string& v) {
+                erased.swap(v);
+            }));
+    EXPECT_EQ(erased, std::string("one"));
+    EXPECT_FALSE(table.erase_fn(1, [&erased](std::string&) {
+                erased = "called";
+            }));
+    EXPECT_EQ(erased, std::string("one"));
+    EXPECT_FALSE(table.contains(1));
+    EXPECT_EQ(table.size(), static_cast<size_t>(1));
+}
+
+// find_fn should hand a reference to the stored value to the function,
+// without copying it, and not call it for a key that isn't there.
+void FindFnReadsInPlace() {
+    cuckoohash_map<uint64_t, BigValue> table;
+    table.insert(1, BigValue(1));
+    const int64_t live = live_values.load();
+    uint64_t id = 0;
+    EXPECT_TRUE(table.find_fn(1, [&id](const BigValue& v) { id = v.id(); }));
+    EXPECT_EQ(id, static_cast<uint64_t>(1));
+    EXPECT_FALSE(table.find_fn(2, [&id](const BigValue&) { id = 0; }));
+    EXPECT_EQ(id, static_cast<uint64_t>(1));
+    EXPECT_EQ(live_values.load(), live);
+}
+
+// A value aligned to more than the default alignment of new
+struct alignas(64) AlignedValue {
+    uint64_t words[8];
+};
+
+// Values more aligned than new guarantees should still be stored at their
+// alignment.
+void OverAlignedValues() {
+    cuckoohash_pooled_map<uint64_t, AlignedValue, CityHasher<uint64_t> >
+        table(1);
+    const uint64_t nkeys = 5000;
+    for (uint64_t i = 0; i < nkeys; i++) {
+        AlignedValue v = AlignedValue();
+        v.words[0] = i;
+        EXPECT_TRUE(table.insert(i, v));
+    }
+    size_t misaligned = 0;
+    for (uint64_t i = 0; i < nkeys; i++) {
+        EXPECT_TRUE(table.find_fn(i, [&misaligned, i](const AlignedValue& v) {
+                    misaligned += reinterpret_cast<uintptr_t>(&v) %
+                        alignof(AlignedValue) != 0;
+                    EXPECT_EQ(v.words[0], i);
+                }));
+    }
+    EXPECT_EQ(misaligned, static_cast<size_t>(0));
+}
+
+// Runs the operations of the pooled map on one thread, through expansions.
+void PooledOperations() {
+    {
+        Table table(1);
+        const uint64_t nkeys = 10000;
+        for (uint64_t i = 0; i < nkeys; i++) {
+            EXPECT_TRUE(table.insert(i, BigValue(i)));
+            EXPECT_FALSE(table.insert(i, BigValue(0)));
+        }
+        EXPECT_EQ(table.size(), nkeys);
+        EXPECT_EQ(live_values.load(), static_cast<int64_t>(nkeys));
+        for (uint64_t i = 0; i < nkeys; i++) {
+            uint64_t id = 0;
+            EXPECT_TRUE(table.find_fn(i, [&id](const BigValue& v) {
+                        EXPECT_TRUE(v.intact());
+                        id = v.id();
+                    }));
+            EXPECT_EQ(id, i);
+            EXPECT_EQ(table.find(i).id(), i);
+        }
+        EXPECT_FALSE(table.find_fn(nkeys, [](const BigValue&) {}));
+        bool threw = false;
+        try {
+            table.find(nkeys);
+        } catch (const std::out_of_range&) {
+            threw = true;
+        }
+        EXPECT_TRUE(threw);
+
+        EXPECT_TRUE(table.update_fn(5, [](BigValue& v) { v.set(v.id() * 2); }));
+        EXPECT_EQ(table.find(5).id(), static_cast<uint64_t>(10));
+        EXPECT_TRUE(table.update(6, BigValue(60)));
+        EXPECT_EQ(table.find(6).id(), static_cast<uint64_t>(60));
+        table.upsert(7, [](BigValue& v) { v.set(v.id() + 1); }, BigValue(0));
+        table.upsert(nkeys, [](BigValue& v) { v.set(v.id() + 1); },
+                     BigValue(nkeys));
+        EXPECT_EQ(table.find(7).id(), static_cast<uint64_t>(8));
+        EXPECT_EQ(table.find(nkeys).id(), nkeys);
+        EXPECT_EQ(table.snapshot_table().size(), nkeys + 1);
+
+        // Erased slots are reused, so erasing and inserting as many keys
+        // again doesn't grow the pool
+        for (uint64_t i = 0; i < nkeys / 2; i++) {
+            EXPECT_TRUE(table.erase(i));
+            EXPECT_FALSE(table.erase(i));
+        }
+        EXPECT_EQ(live_values.load(), static_cast<int64_t>(nkeys / 2 + 1));
+        const size_t pool = table.memory_usage().pool;
+        EXPECT_TRUE(pool >= (nkeys + 1) * sizeof(BigValue));
+        for (uint64_t i = 0; i < nkeys / 2; i++) {
+            EXPECT_TRUE(table.insert(i + 2 * nkeys, BigValue(i)));
+        }
+        EXPECT_EQ(table.memory_usage().pool, pool);
+        EXPECT_TRUE(table.rehash(table.hashpower() + 1));
+        EXPECT_EQ(table.find(2 * nkeys + 3).id(), static_cast<uint64_t>(3));
+
+        table.clear();
+        EXPECT_TRUE(table.empty());
+        EXPECT_EQ(live_values.load(), static_cast<int64_t>(0));
+        table.insert(1, BigValue(1));
+    }
+    // The destructor destroys the values left in the table
+    EXPECT_EQ(live_values.load(), static_cast<int64_t>(0));
+}
+
+// Threads inserting, updating and erasing their own keys should never see a
+// torn value, and should leave exactly the keys they didn't erase.
+void ConcurrentPooledOperations() {
+    {
+        Table table(1);
+        const size_t nthreads = 4;
+        const uint64_t nkeys = 20000;
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < nthreads; t++) {
+            threads.emplace_back([&table, t, nkeys]() {
+                    for (uint64_t i = 0; i < nkeys; i++) {
+                        const uint64_t k = i * nthreads + t;
+                        EXPECT_TRUE(table.insert(k, BigValue(k)));
+                        EXPECT_TRUE(table.update_fn(k, [](BigValue& v) {
+                                    v.set(v.id() + 1);
+                                }));
+                        if (i % 2 == 1) {
+                            EXPECT_TRUE(table.erase(k - nthreads));
+                        }
+                        table.find_fn(k / 2, [](const BigValue& v) {
+                                EXPECT_TRUE(v.intact());
+                            });
+                    }
+                });
+        }
+        for (std::thread& t : threads) {
+            t.join();
+        }
+        EXPECT_EQ(table.size(), nthreads * nkeys / 2);
+        EXPECT_EQ(live_values.load(),
+                  static_cast<int64_t>(nthreads * nkeys / 2));
+        for (uint64_t k = 0; k < nthreads * nkeys; k++) {
+            BigValue v;
+            const bool kept = (k / nthreads) % 2 == 1;
+            EXPECT_EQ(table.find(k, v), kept);
+            if (kept) {
+                EXPECT_EQ(v.id(), k + 1);
+            }
+        }
+    }
+    EXPECT_EQ(live_values.load(), static_cast<int64_t>(0));
+}
+
+int main() {
+    std::cout << "Running EraseFnSeesErasedValue" << std::endl;
+    EraseFnSeesErasedValue();
+    std::cout << "Running FindFnReadsInPlace" << std::endl;
+    FindFnReadsInPlace();
+    std::cout << "Running OverAlignedValues" << std::endl;
+    OverAlignedValues();
+    std::cout << "Running PooledOperations" << std::endl;
+    PooledOperations();
+    std::cout << "Running ConcurrentPooledOperations" << std::endl;
+    ConcurrentPooledOperations();
+}
@@ -0,0 +1,152 @@
+// Tests that tables use the hasher and predicate objects they are constructed
+// with, and that a table whose inserts fail while it is mostly empty is
+// rebuilt with a new seed rather than expanded. This file is compiled with
+// LIBCUCKOO_STATS=1.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <cstdio>
+#include <iostream>
+#include <stdint.h>
+#include <string>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include <libcuckoo/city_hasher.hh>
+#include "test_util.cc"
+
+const char* save_path = "test_reseed.tmp";
+
+// Hashes a key to itself, so keys that only differ in their high bits all
+// have the same first bucket without a seed
+class IdentityHasher {
+public:
+    size_t operator()(const uint64_t k) const {
+        return k;
+    }
+};
+
+// Hashes and compares keys modulo the given number
+class ModHasher {
+public:
+    explicit ModHasher(const uint64_t mod = 1) : mod_(mod) {}
+
+    size_t operator()(const uint64_t k) const {
+        return CityHasher<uint64_t>()(k % mod_);
+    }
+
+private:
+    uint64_t mod_;
+};
+
+class ModEqual {
+public:
+    explicit ModEqual(const uint64_t mod = 1) : mod_(mod) {}
+
+    bool operator()(const uint64_t a, const uint64_t b) const {
+        return a % mod_ == b % mod_;
+    }
+
+private:
+    uint64_t mod_;
+};
+
+// SeededCityHasher should give the same hashes as CityHash64WithSeed, and
+// different seeds should give different hashes.
+void SeededHashersMatchCityHash64WithSeed() {
+    const SeededCityHasher<uint64_t> h1(1), h2(2);
+    const SeededCityHasher<std::string> s1(1);
+    EXPECT_EQ(h1.seed(), static_cast<uint64>(1));
+    size_t differ = 0;
+    for (uint64_t i = 0; i < 1000; i++) {
+        EXPECT_EQ(h1(i), CityHash64WithSeed(
+                      reinterpret_cast<const char*>(&i), sizeof(i), 1));
+        differ += h1(i) != h2(i);
+        const std::string s(i % 80, static_cast<char>('a' + i % 26));
+        EXPECT_EQ(s1(s), CityHash64WithSeed(s.data(), s.size(), 1));
+        EXPECT_EQ(s1(s.c_str()), s1(s));
+    }
+    EXPECT_EQ(differ, static_cast<size_t>(1000));
+}
+
+// Two tables of the same type should each use their own hasher and
+// predicate, and keep using them after they expand.
+void TablesUseTheirOwnHashers() {
+    typedef cuckoohash_map<uint64_t, uint64_t, ModHasher, ModEqual> Table;
+    Table t1(1, ModHasher(1000), ModEqual(1000));
+    Table t2(1, ModHasher(10), ModEqual(10));
+    for (uint64_t i = 0; i < 10000; i++) {
+        t1.insert(i, i);
+        t2.insert(i, i);
+    }
+    // Only the first key of each class modulo the table's number is inserted
+    EXPECT_EQ(t1.size(), static_cast<size_t>(1000));
+    EXPECT_EQ(t2.size(), static_cast<size_t>(10));
+    for (uint64_t i = 0; i < 10000; i++) {
+        EXPECT_EQ(t1.find(i), i % 1000);
+        EXPECT_EQ(t2.find(i), i % 10);
+    }
+
+    typedef cuckoohash_map<uint64_t, uint64_t, SeededCityHasher<uint64_t> >
+        SeededTable;
+    SeededTable s1(1, SeededCityHasher<uint64_t>(1));
+    SeededTable s2(1, SeededCityHasher<uint64_t>(2));
+    for (uint64_t i = 0; i < 1000; i++) {
+        s1.insert(i, i);
+        s2.insert(i, i);
+    }
+    EXPECT_EQ(s1.hash_function().seed(), static_cast<uint64>(1));
+    EXPECT_EQ(s2.hash_function().seed(), static_cast<uint64>(2));
+    for (uint64_t i = 0; i < 1000; i++) {
+        uint64_t v = 0;
+        EXPECT_TRUE(s1.find_hashed(i, s1.hash_function()(i), v));
+        EXPECT_EQ(v, i);
+        EXPECT_TRUE(s2.find_hashed(i, s2.hash_function()(i), v));
+        EXPECT_EQ(v, i);
+    }
+}
+
+// Keys that only differ in bits above the hashpower fill their one pair of
+// buckets right away. The table should reseed itself instead of expanding
+// until the hashpower covers those bits, and hashes computed before the
+// reseed should still find the keys.
+void ReseedOnLowLoadFailure() {
+    typedef cuckoohash_map<uint64_t, uint64_t, IdentityHasher> Table;
+    Table table(1U << 16);
+    const size_t hashpower = table.hashpower();
+    const size_t numkeys = 1U << 15;
+    for (uint64_t i = 0; i < numkeys; i++) {
+        EXPECT_TRUE(table.insert(i << 40, i));
+    }
+    EXPECT_EQ(table.hashpower(), hashpower);
+    EXPECT_EQ(table.stats().reseeds, static_cast<size_t>(1));
+    EXPECT_EQ(table.stats().expansions, static_cast<size_t>(0));
+    for (uint64_t i = 0; i < numkeys; i++) {
+        uint64_t v = 0;
+        EXPECT_TRUE(table.find_hashed(i << 40, i << 40, v));
+        EXPECT_EQ(v, i);
+    }
+
+    // The seed is kept when the table expands and is saved and loaded
+    EXPECT_TRUE(table.rehash(hashpower + 1));
+    EXPECT_EQ(table.find(static_cast<uint64_t>(7) << 40),
+              static_cast<uint64_t>(7));
+    table.save(save_path);
+    Table loaded(1);
+    loaded.load(save_path);
+    remove(save_path);
+    EXPECT_EQ(loaded.size(), numkeys);
+    for (uint64_t i = 0; i < numkeys; i++) {
+        EXPECT_EQ(loaded.find(i << 40), i);
+    }
+}
+
+int main() {
+    std::cout << "Running SeededHashersMatchCityHash64WithSeed" << std::endl;
+    SeededHashersMatchCityHash64WithSeed();
+    std::cout << "Running TablesUseTheirOwnHashers" << std::endl;
+    TablesUseTheirOwnHashers();
+    std::cout << "Running ReseedOnLowLoadFailure" << std::endl;
+    ReseedOnLowLoadFailure();
+}
@@ -0,0 +1,152 @@
+// Tests saving tables to a file and loading them back, both for trivially
+// copyable types and through a serializer.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <unistd.h>
+#include <utility>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include "test_util.cc"
+
+typedef uint32_t KeyType;
+typedef std::string KeyType2;
+typedef uint64_t ValType;
+
+const size_t power = 18;
+const size_t numkeys = 1U << power;
+const char* save_path = "test_save_load.tmp";
+
+// StringSerializer writes each key-value pair as the length of the key, the
+// characters of the key, and the value.
+class StringSerializer {
+public:
+    void save(std::ostream& out, const KeyType2& k, const ValType& v) {
+        const uint64_t len = k.size();
+        out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+        out.write(k.data(), len);
+        out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    void load(std::istream& in, KeyType2& k, ValType& v) {
+        uint64_t len;
+        in.read(reinterpret_cast<char*>(&len), sizeof(len));
+        k.resize(len);
+        in.read(&k[0], len);
+        in.read(reinterpret_cast<char*>(&v), sizeof(v));
+    }
+};
+
+// Fills a table, saves it, and loads it into a table of a different size,
+// which should end up with the same size, hashpower and contents.
+void SaveLoadTrivialTable() {
+    cuckoohash_map<KeyType, ValType> table(numkeys);
+    for (size_t i = 0; i < numkeys; i++) {
+        EXPECT_TRUE(table.insert(i, i*3));
+    }
+    table.save(save_path);
+
+    cuckoohash_map<KeyType, ValType> loaded(1);
+    loaded.insert(numkeys, 0);
+    loaded.load(save_path);
+    EXPECT_EQ(loaded.size(), numkeys);
+    EXPECT_EQ(loaded.hashpower(), table.hashpower());
+    ValType v = 0;
+    for (size_t i = 0; i < numkeys; i++) {
+        EXPECT_TRUE(loaded.find(i, v));
+        EXPECT_EQ(v, i*3);
+    }
+    EXPECT_FALSE(loaded.find(numkeys, v));
+
+    // The loaded table should keep working normally
+    EXPECT_TRUE(loaded.insert(numkeys, 1));
+    EXPECT_TRUE(loaded.erase(0));
+    EXPECT_EQ(loaded.size(), numkeys);
+}
+
+void SaveLoadSerializedTable() {
+    cuckoohash_map<KeyType2, ValType> table(numkeys);
+    for (size_t i = 0; i < numkeys; i++) {
+        EXPECT_TRUE(table.insert(generateKey<KeyType2>(i), i));
+    }
+    table.save(save_path, StringSerializer());
+
+    cuckoohash_map<KeyType2, ValType> loaded;
+    loaded.load(save_path, StringSerializer());
+    EXPECT_EQ(loaded.size(), numkeys);
+    ValType v = 0;
+    for (size_t i = 0; i < numkeys; i++) {
+        EXPECT_TRUE(loaded.find(generateKey<KeyType2>(i), v));
+        EXPECT_EQ(v, i);
+    }
+}
+
+// Loading a file saved by a table with a different layout or a file that
+// isn't a saved table at all should throw.
+void LoadRejectsBadFiles() {
+    cuckoohash_map<KeyType, ValType> table(numkeys);
+    table.insert(1, 1);
+    table.save(save_path);
+
+    cuckoohash_map<KeyType, uint32_t> other_table;
+    bool threw = false;
+    try {
+        other_table.load(save_path);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    EXPECT_TRUE(threw);
+
+    threw = false;
+    try {
+        table.load("test_save_load.nonexistent");
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    EXPECT_TRUE(threw);
+    EXPECT_EQ(table.size(), static_cast<size_t>(1));
+
+    // A serialized table cut off partway through a key should throw, rather
+    // than load the keys before the cut and a stale copy of the last one
+    cuckoohash_map<KeyType2, ValType> strings(1);
+    for (size_t i = 0; i < 1000; i++) {
+        strings.insert(generateKey<KeyType2>(i), i);
+    }
+    strings.save(save_path, StringSerializer());
+    FILE* f = fopen(save_path, "rb");
+    fseek(f, 0, SEEK_END);
+    const long saved_size = ftell(f);
+    fclose(f);
+    EXPECT_EQ(truncate(save_path, saved_size - 3), 0);
+    cuckoohash_map<KeyType2, ValType> loaded_strings;
+    loaded_strings.insert("kept", 1);
+    threw = false;
+    try {
+        loaded_strings.load(save_path, StringSerializer());
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    EXPECT_TRUE(threw);
+    EXPECT_EQ(loaded_strings.size(), static_cast<size_t>(1));
+    EXPECT_TRUE(loaded_strings.contains("kept"));
+}
+
+int main() {
+    std::cout << "Running SaveLoadTrivialTable" << std::endl;
+    SaveLoadTrivialTable();
+    std::cout << "Running SaveLoadSerializedTable" << std::endl;
+    SaveLoadSerializedTable();
+    std::cout << "Running LoadRejectsBadFiles" << std::endl;
+    LoadRejectsBadFiles();
+    remove(save_path);
+}
@@ -0,0 +1,190 @@
+// Tests tables that live in a shared mapping of a file, operated on by several
+// processes at once.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <iostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include "test_util.cc"
+
+typedef uint64_t KeyType;
+typedef uint64_t ValType;
+typedef cuckoohash_map<KeyType, ValType> Table;
+
+const size_t numkeys = 1U << 16;
+const size_t num_procs = 4;
+const char* shared_path = "test_shared_map.tmp";
+
+// Forks num_procs processes, each of which opens the table itself and inserts
+// its share of the keys, then checks that the parent's table sees them all.
+void ProcessesShareTable() {
+    unlink(shared_path);
+    Table table(shared_path, numkeys*2);
+    const size_t keys_per_proc = numkeys / num_procs;
+    std::vector<pid_t> children;
+    for (size_t p = 0; p < num_procs; p++) {
+        pid_t pid = fork();
+        ASSERT_TRUE(pid >= 0);
+        if (pid == 0) {
+            Table child_table(shared_path);
+            for (size_t i = p*keys_per_proc; i < (p+1)*keys_per_proc; i++) {
+                if (!child_table.insert(i, i+1)) {
+                    _exit(1);
+                }
+                child_table.update_fn(i/2, [](const ValType& v) {
+                        return v;
+                    });
+            }
+            _exit(0);
+        }
+        children.push_back(pid);
+    }
+    for (size_t p = 0; p < children.size(); p++) {
+        int status;
+        ASSERT_TRUE(waitpid(children[p], &status, 0) == children[p]);
+        EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    EXPECT_EQ(table.size(), numkeys);
+    ValType v = 0;
+    for (size_t i = 0; i < numkeys; i++) {
+        EXPECT_TRUE(table.find(i, v));
+        EXPECT_EQ(v, i+1);
+    }
+}
+
+// The contents of the table should outlive the processes using it, and an
+// insert that doesn't fit should throw instead of expanding the table.
+void SharedTableIsPersistentAndFixedSize() {
+    {
+        Table table(shared_path);
+        EXPECT_EQ(table.size(), numkeys);
+        EXPECT_FALSE(table.reserve(numkeys*8));
+    }
+    Table table(shared_path);
+    const size_t hashpower = table.hashpower();
+    bool threw = false;
+    try {
+        for (size_t i = numkeys; i < numkeys*4; i++) {
+            table.insert(i, i+1);
+        }
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    EXPECT_TRUE(threw);
+    EXPECT_EQ(table.hashpower(), hashpower);
+    table.clear();
+    EXPECT_EQ(table.size(), static_cast<size_t>(0));
+
+    // A table of a different type shouldn't be able to open the file
+    threw = false;
+    try {
+        cuckoohash_map<KeyType, uint32_t> other(shared_path);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    EXPECT_TRUE(threw);
+    unlink(shared_path);
+}
+
+// A key aligned to more than a cache line, which raises the alignment of
+// the bucket array past 64 bytes
+struct alignas(128) WideKey {
+    uint64_t k;
+};
+
+struct WideKeyHasher {
+    size_t operator()(const WideKey& key) const {
+        return std::hash<uint64_t>()(key.k);
+    }
+};
+
+struct WideKeyEqual {
+    bool operator()(const WideKey& a, const WideKey& b) const {
+        return a.k == b.k;
+    }
+};
+
+typedef cuckoohash_map<WideKey, ValType, WideKeyHasher, WideKeyEqual>
+    WideTable;
+
+// Counts the keys of table that aren't aligned to their type's alignment
+size_t misaligned_keys(WideTable& table) {
+    size_t misaligned = 0;
+    table.parallel_for_each([&misaligned](const WideKey& key, const ValType&) {
+            misaligned += reinterpret_cast<uintptr_t>(&key) %
+                alignof(WideKey) != 0;
+        }, 1);
+    return misaligned;
+}
+
+// The bucket array of both an allocated and a shared table should be
+// aligned to the buckets' alignment, even when it's more than 64 bytes.
+void OverAlignedKeysStayAligned() {
+    unlink(shared_path);
+    WideTable allocated(1);
+    WideTable shared(shared_path, 1000);
+    for (uint64_t i = 0; i < 1000; i++) {
+        WideKey key;
+        key.k = i;
+        EXPECT_TRUE(allocated.insert(key, i));
+        EXPECT_TRUE(shared.insert(key, i));
+    }
+    EXPECT_EQ(misaligned_keys(allocated), static_cast<size_t>(0));
+    EXPECT_EQ(misaligned_keys(shared), static_cast<size_t>(0));
+    unlink(shared_path);
+}
+
+// A process that dies holding a lock of the table should make the other
+// processes' operations on the buckets it guards throw, rather than wait
+// forever.
+void DeadLockHolderIsDetected() {
+    unlink(shared_path);
+    Table table(shared_path, 1000);
+    EXPECT_TRUE(table.insert(1, 1));
+    pid_t pid = fork();
+    ASSERT_TRUE(pid >= 0);
+    if (pid == 0) {
+        // Exits while update_fn holds the locks on the key's buckets
+        table.update_fn(1, [](const ValType&) -> ValType { _exit(0); });
+        _exit(1);
+    }
+    int status;
+    ASSERT_TRUE(waitpid(pid, &status, 0) == pid);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    bool threw = false;
+    try {
+        table.find(1);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    EXPECT_TRUE(threw);
+    threw = false;
+    try {
+        table.insert(1, 2);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    EXPECT_TRUE(threw);
+    unlink(shared_path);
+}
+
+int main() {
+    std::cout << "Running ProcessesShareTable" << std::endl;
+    ProcessesShareTable();
+    std::cout << "Running SharedTableIsPersistentAndFixedSize" << std::endl;
+    SharedTableIsPersistentAndFixedSize();
+    std::cout << "Running OverAlignedKeysStayAligned" << std::endl;
+    OverAlignedKeysStayAligned();
+    std::cout << "Running DeadLockHolderIsDetected" << std::endl;
+    DeadLockHolderIsDetected();
+}
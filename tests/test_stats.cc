@@ -0,0 +1,56 @@
+// Tests the operation statistics the table collects when LIBCUCKOO_STATS is
+// set. This file is compiled with LIBCUCKOO_STATS=1.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <iostream>
+#include <numeric>
+#include <stdint.h>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include <libcuckoo/city_hasher.hh>
+#include "test_util.cc"
+
+typedef uint32_t KeyType;
+typedef uint32_t ValType;
+// The identity hash of std::hash fills the buckets of sequential keys evenly,
+// so the table would never need to move anything
+typedef cuckoohash_map<KeyType, ValType, CityHasher<KeyType> > Table;
+
+const size_t numkeys = 1U << 18;
+
+// Filling a small table should go through the fast path, cuckoo hashing and
+// expansion, and the counters should add up to the inserts that were done.
+void StatsCountInserts() {
+    Table table(1);
+    for (size_t i = 0; i < numkeys; i++) {
+        EXPECT_TRUE(table.insert(i, i));
+    }
+    EXPECT_FALSE(table.insert(0, 0));
+    Table::cuckoo_stats st = table.stats();
+    const size_t paths = std::accumulate(st.path_depths.begin(),
+                                         st.path_depths.end(),
+                                         static_cast<size_t>(0));
+    EXPECT_TRUE(st.insert_fast_path > 0);
+    EXPECT_TRUE(st.insert_fast_path <= numkeys);
+    EXPECT_TRUE(st.cuckoo_runs > 0);
+    EXPECT_TRUE(paths > 0);
+    EXPECT_TRUE(paths >= st.cuckoo_runs - st.path_search_failures);
+    EXPECT_TRUE(st.expansions > 0);
+    EXPECT_EQ(st.expansions, st.path_search_failures);
+    EXPECT_EQ(st.path_retries, static_cast<size_t>(0));
+    EXPECT_EQ(st.duplicate_rechecks, static_cast<size_t>(0));
+    EXPECT_TRUE(st.expansion_seconds > 0);
+    EXPECT_TRUE(st.max_expansion_seconds <= st.expansion_seconds);
+
+    // Growing the table with reserve also counts as an expansion
+    EXPECT_TRUE(table.reserve(numkeys*4));
+    EXPECT_EQ(table.stats().expansions, st.expansions+1);
+}
+
+int main() {
+    std::cout << "Running StatsCountInserts" << std::endl;
+    StatsCountInserts();
+}
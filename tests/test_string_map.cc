@@ -0,0 +1,224 @@
+// Tests cuckoohash_string_map with keys stored inline and keys with part of
+// them in the arena, from several threads at once, and that compacting the
+// arena, also while the table is rehashed, keeps every key and frees the
+// space of erased ones.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libcuckoo/cuckoohash_string_map.hh>
+#include "test_util.cc"
+
+typedef cuckoohash_string_map<uint64_t> Table;
+
+// Returns a key of the given length that differs from the other keys of that
+// length in its last 8 characters, so long keys share their prefix
+std::string make_key(const uint64_t i, const size_t len) {
+    std::string s(len, 'x');
+    for (size_t j = 0; j < 8 && j < len; j++) {
+        s[len - 1 - j] = static_cast<char>('a' + (i >> (4 * j)) % 16);
+    }
+    return s;
+}
+
+// Returns how many distinct keys make_key can make of the given length, up to
+// 100
+uint64_t keys_of_length(const size_t len) {
+    return len == 0 ? 1 : len == 1 ? 16 : 100;
+}
+
+// Keys on either side of the inline length should be found by std::string and
+// by C string, and keys that only differ past the prefix shouldn't match.
+void InlineAndArenaKeys() {
+    Table table;
+    const size_t lens[] = {0, 1, 7, 12, 19, Table::kInlineLen,
+                           Table::kInlineLen + 1, 64, 300, 100000};
+    for (size_t len : lens) {
+        for (uint64_t i = 0; i < keys_of_length(len); i++) {
+            EXPECT_TRUE(table.insert(make_key(i, len), len * 1000 + i));
+        }
+    }
+    for (size_t len : lens) {
+        for (uint64_t i = 0; i < keys_of_length(len); i++) {
+            const std::string key = make_key(i, len);
+            EXPECT_EQ(table.find(key), len * 1000 + i);
+            EXPECT_EQ(table.find(key.c_str()), len * 1000 + i);
+            EXPECT_FALSE(table.insert(key, 0));
+        }
+        if (len > 1) {
+            EXPECT_FALSE(table.contains(make_key(100, len)));
+        }
+    }
+    EXPECT_FALSE(table.contains(std::string(Table::kInlineLen + 1, 'y')));
+
+    const std::vector<Table::value_type> items = table.snapshot_table();
+    EXPECT_EQ(items.size(), table.size());
+    for (const Table::value_type& item : items) {
+        EXPECT_EQ(table.find(item.first), item.second);
+    }
+
+    const std::string long_key = make_key(3, 64);
+    EXPECT_TRUE(table.update(long_key, 5));
+    EXPECT_EQ(table.find(long_key), static_cast<uint64_t>(5));
+    table.upsert(long_key, [](const uint64_t& v) { return v + 1; }, 0);
+    EXPECT_EQ(table.find(long_key), static_cast<uint64_t>(6));
+    table.upsert(make_key(200, 64), [](const uint64_t& v) { return v + 1; },
+                 7);
+    EXPECT_EQ(table.find(make_key(200, 64)), static_cast<uint64_t>(7));
+    EXPECT_TRUE(table.erase(long_key));
+    EXPECT_FALSE(table.erase(long_key));
+    EXPECT_FALSE(table.contains(long_key.c_str()));
+    bool threw = false;
+    try {
+        table.find(long_key);
+    } catch (const std::out_of_range&) {
+        threw = true;
+    }
+    EXPECT_TRUE(threw);
+}
+
+// Threads inserting and erasing their own keys, while the table expands and
+// compacts its arena, should leave exactly the keys they didn't erase.
+void ConcurrentInsertErase() {
+    Table table(1);
+    const size_t nthreads = 4;
+    const uint64_t nkeys = 20000;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < nthreads; t++) {
+        threads.emplace_back([&table, t, nkeys]() {
+                for (uint64_t i = 0; i < nkeys; i++) {
+                    const uint64_t k = i * nthreads + t;
+                    EXPECT_TRUE(table.insert(make_key(k, 16 + k % 100), k));
+                    if (i % 2 == 1) {
+                        const uint64_t prev = k - nthreads;
+                        EXPECT_TRUE(
+                            table.erase(make_key(prev, 16 + prev % 100)));
+                    }
+                }
+            });
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    EXPECT_EQ(table.size(), nthreads * nkeys / 2);
+    for (uint64_t i = 0; i < nkeys; i++) {
+        for (size_t t = 0; t < nthreads; t++) {
+            const uint64_t k = i * nthreads + t;
+            EXPECT_EQ(table.contains(make_key(k, 16 + k % 100)), i % 2 == 1);
+        }
+    }
+}
+
+// Threads inserting and erasing long keys while another thread keeps
+// rehashing the table and compacting the arena. Inserts that were running on
+// a table a rehash replaced read that table's keys, which point at the arena
+// as it was before compacting, so the compacted chunks mustn't be freed
+// under them. Every key that wasn't erased should be left with its value.
+void ConcurrentInsertRehashCompact() {
+    Table table(1);
+    const size_t nthreads = 4;
+    const uint64_t nkeys = 10000;
+    std::atomic<size_t> running(nthreads);
+    std::thread compactor([&table, &running]() {
+            while (running.load() > 0) {
+                if (table.hashpower() < 16) {
+                    table.rehash(table.hashpower() + 1);
+                }
+                table.compact();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < nthreads; t++) {
+        threads.emplace_back([&table, &running, t, nkeys]() {
+                for (uint64_t i = 0; i < nkeys; i++) {
+                    const uint64_t k = i * nthreads + t;
+                    EXPECT_TRUE(table.insert(make_key(k, 64 + k % 200), k));
+                    if (i % 2 == 1) {
+                        const uint64_t prev = k - nthreads;
+                        EXPECT_TRUE(
+                            table.erase(make_key(prev, 64 + prev % 200)));
+                    }
+                }
+                running.fetch_sub(1);
+            });
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    compactor.join();
+    table.compact();
+    EXPECT_EQ(table.size(), nthreads * nkeys / 2);
+    for (uint64_t k = 0; k < nthreads * nkeys; k++) {
+        uint64_t v = 0;
+        const bool kept = (k / nthreads) % 2 == 1;
+        EXPECT_EQ(table.find(make_key(k, 64 + k % 200), v), kept);
+        if (kept) {
+            EXPECT_EQ(v, k);
+        }
+    }
+}
+
+// Compacting should free the chunks holding erased keys without losing the
+// keys still in the table.
+void CompactReclaimsErasedKeys() {
+    Table table;
+    const uint64_t nkeys = 50000;
+    const size_t len = 400;
+    for (uint64_t i = 0; i < nkeys; i++) {
+        EXPECT_TRUE(table.insert(make_key(i, len), i));
+    }
+    const Table::string_memory_stats full = table.memory_usage();
+    EXPECT_EQ(full.arena_live, nkeys * (len - Table::kPrefixLen));
+    EXPECT_TRUE(full.arena >= full.arena_live);
+
+    for (uint64_t i = 0; i < nkeys; i++) {
+        if (i % 10 != 0) {
+            EXPECT_TRUE(table.erase(make_key(i, len)));
+        }
+    }
+    table.compact();
+    const Table::string_memory_stats compacted = table.memory_usage();
+    EXPECT_EQ(compacted.arena_live, nkeys / 10 * (len - Table::kPrefixLen));
+    EXPECT_TRUE(compacted.arena < full.arena / 4);
+    for (uint64_t i = 0; i < nkeys; i++) {
+        if (i % 10 == 0) {
+            EXPECT_EQ(table.find(make_key(i, len)), i);
+        } else {
+            EXPECT_FALSE(table.contains(make_key(i, len)));
+        }
+    }
+
+    // Expanding the table compacts the arena as well
+    for (uint64_t i = 0; i < nkeys; i++) {
+        if (i % 10 == 0) {
+            EXPECT_TRUE(table.erase(make_key(i, len)));
+        }
+    }
+    EXPECT_TRUE(table.rehash(table.hashpower() + 1));
+    EXPECT_TRUE(table.empty());
+    EXPECT_EQ(table.memory_usage().arena_live, static_cast<size_t>(0));
+    EXPECT_TRUE(table.memory_usage().arena < compacted.arena);
+}
+
+int main() {
+    std::cout << "Running InlineAndArenaKeys" << std::endl;
+    InlineAndArenaKeys();
+    std::cout << "Running ConcurrentInsertErase" << std::endl;
+    ConcurrentInsertErase();
+    std::cout << "Running ConcurrentInsertRehashCompact" << std::endl;
+    ConcurrentInsertRehashCompact();
+    std::cout << "Running CompactReclaimsErasedKeys" << std::endl;
+    CompactReclaimsErasedKeys();
+}
@@ -0,0 +1,107 @@
+// Tests looking up std::string keys by C string with a transparent hasher and
+// equality predicate, and that doing so doesn't allocate.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include <libcuckoo/city_hasher.hh>
+#include "test_util.cc"
+
+// Counts every allocation made through operator new. The replacements aren't
+// inlined, so the compiler doesn't pair the malloc and free inside them with
+// the new and delete expressions that call them.
+std::atomic<size_t> num_allocations(0);
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    num_allocations.fetch_add(1);
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+typedef cuckoohash_map<std::string, size_t, CityHasher<std::string>,
+                       StringEqual> Table;
+
+const size_t numkeys = 1000;
+
+// Keys long enough that a std::string of them has to allocate
+std::string long_key(const size_t i) {
+    return "a key that is too long for the small string buffer " +
+        std::to_string(i);
+}
+
+// C strings should hash to the same value as the equal std::string
+void HashesMatch() {
+    const CityHasher<std::string> hasher;
+    for (size_t i = 0; i < numkeys; i++) {
+        const std::string k = long_key(i);
+        EXPECT_EQ(hasher(k.c_str()), hasher(k));
+    }
+    EXPECT_EQ(hasher(""), hasher(std::string()));
+}
+
+// find, find_fn, contains, update_fn and erase should work on C strings,
+// without allocating a temporary std::string
+void LookupByCString() {
+    Table table;
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < numkeys; i++) {
+        keys.push_back(long_key(i));
+        EXPECT_TRUE(table.insert(keys[i], i));
+    }
+    // Converting the lambda to a std::function may allocate, so it is done
+    // before counting
+    const Table::updater incr = [](const size_t& v) {
+        return v + 1;
+    };
+
+    size_t v = 0;
+    const size_t before = num_allocations.load();
+    for (size_t i = 0; i < numkeys; i++) {
+        const char* k = keys[i].c_str();
+        EXPECT_TRUE(table.find(k, v));
+        EXPECT_EQ(v, i);
+        EXPECT_TRUE(table.contains(k));
+        EXPECT_TRUE(table.update_fn(k, incr));
+        EXPECT_EQ(table.find(k), i + 1);
+        EXPECT_TRUE(table.find_fn(k, [&v](const size_t& x) { v = x; }));
+        EXPECT_EQ(v, i + 1);
+    }
+    EXPECT_FALSE(table.find("not a key", v));
+    EXPECT_FALSE(table.contains("not a key"));
+    EXPECT_FALSE(table.erase("not a key"));
+    for (size_t i = 0; i < numkeys; i += 2) {
+        EXPECT_TRUE(table.erase(keys[i].c_str()));
+    }
+    EXPECT_EQ(num_allocations.load(), before);
+
+    EXPECT_EQ(table.size(), numkeys / 2);
+    for (size_t i = 0; i < numkeys; i++) {
+        EXPECT_EQ(table.contains(keys[i]), i % 2 == 1);
+    }
+}
+
+int main() {
+    std::cout << "Running HashesMatch" << std::endl;
+    HashesMatch();
+    std::cout << "Running LookupByCString" << std::endl;
+    LookupByCString();
+}
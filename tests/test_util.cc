@@ -2,12 +2,22 @@
 #define _TEST_UTIL_CC
 
 // Utilities for running tests
+#include <algorithm>
 #include <array>
 #include <cerrno>
+#include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <mutex>
+#include <stdint.h>
+#include <unistd.h>
+#include <vector>
+#ifdef __linux__
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#endif
 #include <libcuckoo/cuckoohash_map.hh>
 
 std::mutex print_lock;
@@ -157,6 +167,21 @@ std::string generateKey<std::string>(size_t i) {
     return ret;
 }
 
+// check_fill inserts the keys generateKey<Key>(i << shift) into a table
+// hashed by Hasher until it expands, and checks that they filled it to a high
+// load factor first. With a shift, the keys only differ in their high bits.
+template <class Hasher, class Key>
+void check_fill(const size_t shift = 0) {
+    cuckoohash_map<Key, size_t, Hasher> table(1U << 16);
+    const size_t hashpower = table.hashpower();
+    size_t i = 0;
+    while (table.hashpower() == hashpower) {
+        table.insert(generateKey<Key>(i << shift), i);
+        i++;
+    }
+    EXPECT_TRUE(static_cast<double>(i) / (1U << 16) > 0.9);
+}
+
 // An overloaded function that does the inserts for different table types.
 // Inserts with a value of 0.
 template <class KType, class VType>
@@ -176,6 +201,213 @@ struct cacheint {
     }
 } __attribute__((aligned(64)));
 
+// The number of bits of each latency below its leading bit that
+// LatencyHistogram keeps, which splits every power of 2 into 16 buckets.
+const size_t kLatencySubBucketBits = 4;
+const size_t kLatencySubBuckets = 1U << kLatencySubBucketBits;
+
+// LatencyHistogram records latencies in nanoseconds into log-linear buckets.
+// Latencies are grouped by their power of 2, and each power of 2 is split into
+// kLatencySubBuckets equal buckets, so a reported percentile is within 1/16 of
+// the real value no matter how large it is, while the histogram stays small
+// enough to give each thread its own.
+class LatencyHistogram {
+public:
+    LatencyHistogram()
+        : counts_((64 - kLatencySubBucketBits + 1) * kLatencySubBuckets, 0),
+          count_(0), max_(0) {}
+
+    void record(uint64_t nanos) {
+        ++counts_[bucket_of(nanos)];
+        ++count_;
+        max_ = std::max(max_, nanos);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < counts_.size(); i++) {
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    size_t count() const {
+        return count_;
+    }
+
+    uint64_t max() const {
+        return max_;
+    }
+
+    // percentile returns an upper bound on the latency that p percent of the
+    // recorded latencies are at or below.
+    uint64_t percentile(double p) const {
+        const size_t rank = std::ceil(count_ * p / 100.0);
+        size_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); i++) {
+            seen += counts_[i];
+            if (seen >= rank && seen > 0) {
+                return std::min(bucket_upper(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    // Prints the median, tail percentiles, and maximum of the latencies
+    void report(std::ostream& out, const char* name) const {
+        out << name << " latency (ns):\tcount " << count()
+            << "\tp50 " << percentile(50) << "\tp99 " << percentile(99)
+            << "\tp99.9 " << percentile(99.9) << "\tmax " << max()
+            << std::endl;
+    }
+
+private:
+    static size_t bucket_of(uint64_t v) {
+        if (v < kLatencySubBuckets) {
+            return v;
+        }
+        const size_t shift = 63 - __builtin_clzll(v) - kLatencySubBucketBits;
+        return (shift + 1) * kLatencySubBuckets +
+            ((v >> shift) - kLatencySubBuckets);
+    }
+
+    static uint64_t bucket_upper(size_t i) {
+        if (i < kLatencySubBuckets) {
+            return i;
+        }
+        const size_t shift = i / kLatencySubBuckets - 1;
+        const uint64_t base =
+            (uint64_t)(i % kLatencySubBuckets + kLatencySubBuckets) << shift;
+        return base + ((uint64_t)1 << shift) - 1;
+    }
+
+    std::vector<size_t> counts_;
+    size_t count_;
+    uint64_t max_;
+};
+
+// The hardware events PerfCounters measures
+const size_t kNumPerfEvents = 5;
+const char* perf_event_names[kNumPerfEvents] = {
+    "cycles", "instructions", "LLC misses", "dTLB misses", "branch misses"
+};
+
+// PerfCounters counts hardware events with perf_event_open over a measured
+// phase of a benchmark. The counters are opened when the object is
+// constructed, and count the calling thread and any threads it creates
+// afterwards, once those threads have exited. If a counter can't be opened,
+// because the kernel or the machine doesn't support it or the process isn't
+// allowed to use it, it is reported as unavailable and the benchmark runs as
+// usual. If enabled is false, no counters are opened.
+class PerfCounters {
+public:
+    explicit PerfCounters(bool enabled = true) {
+        for (size_t i = 0; i < kNumPerfEvents; i++) {
+            fds_[i] = -1;
+            values_[i] = 0;
+        }
+#ifdef __linux__
+        if (!enabled) {
+            return;
+        }
+        const uint32_t types[kNumPerfEvents] = {
+            PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+            PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE
+        };
+        const uint64_t configs[kNumPerfEvents] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_BRANCH_MISSES
+        };
+        for (size_t i = 0; i < kNumPerfEvents; i++) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = types[i];
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds_[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+#else
+        (void)enabled;
+#endif
+    }
+
+    ~PerfCounters() {
+        for (size_t i = 0; i < kNumPerfEvents; i++) {
+            if (fds_[i] >= 0) {
+                close(fds_[i]);
+            }
+        }
+    }
+
+    // Returns true if at least one counter could be opened
+    bool available() const {
+        for (size_t i = 0; i < kNumPerfEvents; i++) {
+            if (fds_[i] >= 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void start() {
+#ifdef __linux__
+        for (size_t i = 0; i < kNumPerfEvents; i++) {
+            if (fds_[i] >= 0) {
+                ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    // Stops counting and reads the counters, scaling each one up if the
+    // kernel had to multiplex it with other counters
+    void stop() {
+#ifdef __linux__
+        for (size_t i = 0; i < kNumPerfEvents; i++) {
+            if (fds_[i] < 0) {
+                continue;
+            }
+            ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+            // value, time enabled, and time running
+            uint64_t data[3];
+            if (read(fds_[i], data, sizeof(data)) != sizeof(data) ||
+                data[2] == 0) {
+                values_[i] = 0;
+            } else {
+                values_[i] = data[0] * ((double)data[1] / data[2]);
+            }
+        }
+#endif
+    }
+
+    // Prints the total and per-operation count of each event
+    void report(std::ostream& out, size_t num_ops) const {
+        for (size_t i = 0; i < kNumPerfEvents; i++) {
+            out << perf_event_names[i] << ":\t";
+            if (fds_[i] < 0) {
+                out << "not available" << std::endl;
+            } else {
+                out << values_[i] << " (" << (double)values_[i] / num_ops
+                    << " per operation)" << std::endl;
+            }
+        }
+    }
+
+private:
+    int fds_[kNumPerfEvents];
+    uint64_t values_[kNumPerfEvents];
+};
+
 // An overloaded function that does the reads for different table types. It
 // repeatedly searches for the keys in the given range until the time is up. All
 // the keys in the given range should either be in the table or not in the
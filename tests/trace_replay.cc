@@ -0,0 +1,251 @@
+// Replays a trace of table operations recorded with cuckoo_trace, reporting
+// the throughput of the replay. Since a trace only holds the hash values of
+// the keys, the replay uses them as the keys of a table with an identity
+// hash, which places them in the same buckets as the recorded keys. The
+// operations recorded by each thread are replayed in order, with the recorded
+// threads spread over --thread-num replay threads.
+//
+// Run with --trace FILE to replay a recorded trace. Without it, the benchmark
+// records a trace of a mixed workload itself and checks that replaying it
+// produces a table of the same size. This file is compiled with
+// LIBCUCKOO_TRACE=1.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include "test_util.cc"
+
+typedef uint64_t KeyType;
+typedef uint64_t ValType;
+
+// IdentityHasher uses a recorded hash value as its own hash
+class IdentityHasher {
+public:
+    size_t operator()(const uint64_t hv) const {
+        return hv;
+    }
+};
+
+typedef cuckoohash_map<KeyType, ValType, IdentityHasher> ReplayTable;
+
+// The number of elements to size the replay table with, expressed as a power
+// of 2. This can be set with the command line flag --power
+size_t power = 16;
+// The number of threads that replay the trace. If 0, each recorded thread is
+// replayed by its own thread. This can be set with the command line flag
+// --thread-num
+size_t thread_num = 0;
+// The number of threads and the number of operations per thread of the trace
+// recorded when no trace file is given. These can be set with the command line
+// flags --record-threads and --record-ops
+size_t record_threads = 4;
+size_t record_ops = 1U << 18;
+// The seed which the random number generator uses. This can be set with the
+// command line flag --seed
+size_t seed = 0;
+
+const char* recorded_path = "trace_replay.tmp";
+
+// The operations recorded by one thread, in order
+struct ThreadTrace {
+    std::vector<uint8_t> ops;
+    std::vector<uint64_t> hashes;
+};
+
+// Reads the trace at path, grouping the operations by recording thread
+std::vector<ThreadTrace> read_trace(const std::string& path) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in) {
+        std::cerr << "Cannot open trace file " << path << std::endl;
+        exit(1);
+    }
+    cuckoo_trace::read_header(in);
+    std::map<uint32_t, ThreadTrace> by_thread;
+    cuckoo_trace::chunk c;
+    while (cuckoo_trace::read_chunk(in, c)) {
+        ThreadTrace& t = by_thread[c.thread];
+        t.ops.insert(t.ops.end(), c.ops.begin(), c.ops.end());
+        t.hashes.insert(t.hashes.end(), c.hashes.begin(), c.hashes.end());
+    }
+    std::vector<ThreadTrace> traces;
+    for (auto it = by_thread.begin(); it != by_thread.end(); ++it) {
+        traces.push_back(std::move(it->second));
+    }
+    return traces;
+}
+
+void replay_thread(ReplayTable& table, const ThreadTrace& trace) {
+    const auto incr = [](const ValType& v) {
+        return v + 1;
+    };
+    ValType v;
+    for (size_t i = 0; i < trace.ops.size(); i++) {
+        const uint64_t hv = trace.hashes[i];
+        switch (trace.ops[i]) {
+        case cuckoo_trace::FIND:
+            table.find(hv, v);
+            break;
+        case cuckoo_trace::INSERT:
+            table.insert(hv, 0);
+            break;
+        case cuckoo_trace::ERASE:
+            table.erase(hv);
+            break;
+        case cuckoo_trace::UPDATE:
+            table.update(hv, 0);
+            break;
+        case cuckoo_trace::UPDATE_FN:
+            table.update_fn(hv, incr);
+            break;
+        case cuckoo_trace::UPSERT:
+            table.upsert(hv, incr, 0);
+            break;
+        }
+    }
+}
+
+// Replays the traces into table, giving replay thread r every recorded
+// thread whose index is r modulo the number of replay threads
+void replay(ReplayTable& table, const std::vector<ThreadTrace>& traces) {
+    const size_t nthreads = (thread_num == 0) ? traces.size() : thread_num;
+    size_t num_ops[cuckoo_trace::NUM_OP_TYPES] = {0};
+    size_t total_ops = 0;
+    for (size_t t = 0; t < traces.size(); t++) {
+        for (size_t i = 0; i < traces[t].ops.size(); i++) {
+            ++num_ops[traces[t].ops[i]];
+        }
+        total_ops += traces[t].ops.size();
+    }
+
+    std::vector<std::thread> threads;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < nthreads; r++) {
+        threads.emplace_back([&, r]() {
+                for (size_t t = r; t < traces.size(); t += nthreads) {
+                    replay_thread(table, traces[t]);
+                }
+            });
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    const double elapsed_time = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    const char* op_names[cuckoo_trace::NUM_OP_TYPES] = {
+        "Finds", "Inserts", "Erases", "Updates", "Update_fns", "Upserts"
+    };
+    std::cout << "----------Results----------" << std::endl;
+    std::cout << "Recorded threads:\t" << traces.size() << std::endl;
+    std::cout << "Replay threads:\t" << nthreads << std::endl;
+    for (size_t op = 0; op < cuckoo_trace::NUM_OP_TYPES; op++) {
+        std::cout << op_names[op] << ":\t" << num_ops[op] << std::endl;
+    }
+    std::cout << "Time elapsed:\t" << elapsed_time << " seconds" << std::endl;
+    std::cout << "Throughput: " << std::fixed << total_ops / elapsed_time
+              << " ops/sec" << std::endl;
+}
+
+// Records a trace of record_threads threads running a mix of operations on
+// their own keys, so that the final contents of the table don't depend on how
+// the threads interleave. It returns the size of the recorded table.
+size_t record_trace() {
+    cuckoohash_map<KeyType, ValType> table;
+    std::vector<std::thread> threads;
+    cuckoo_trace::start(recorded_path);
+    for (size_t t = 0; t < record_threads; t++) {
+        threads.emplace_back([&table, t]() {
+                std::mt19937_64 gen(seed + t);
+                const auto incr = [](const ValType& v) {
+                    return v + 1;
+                };
+                ValType v;
+                for (size_t i = 0; i < record_ops; i++) {
+                    const KeyType key = (gen() % record_ops) * record_threads + t;
+                    switch (gen() % 6) {
+                    case 0:
+                        table.find(key, v);
+                        break;
+                    case 1:
+                    case 2:
+                        table.insert(key, i);
+                        break;
+                    case 3:
+                        table.erase(key);
+                        break;
+                    case 4:
+                        table.update_fn(key, incr);
+                        break;
+                    case 5:
+                        table.upsert(key, incr, i);
+                        break;
+                    }
+                }
+            });
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    cuckoo_trace::stop();
+    return table.size();
+}
+
+int main(int argc, char** argv) {
+    std::string trace_path;
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--trace") == 0) {
+            trace_path = argv[i+1];
+        }
+    }
+    const char* args[] = {"--power", "--thread-num", "--record-threads",
+                          "--record-ops", "--seed"};
+    size_t* arg_vars[] = {&power, &thread_num, &record_threads, &record_ops,
+                          &seed};
+    const char* arg_help[] = {
+        "The number of elements to size the replay table with, expressed as a "
+        "power of 2",
+        "The number of threads replaying the trace, or 0 for one per recorded "
+        "thread",
+        "The number of threads to record a trace with, if --trace isn't given",
+        "The number of operations each recording thread runs",
+        "The seed used by the random number generator"
+    };
+    parse_flags(argc, argv, "Replays a trace of table operations. Give the "
+                "trace file with --trace FILE, or leave it out to record and "
+                "replay a sample trace.", args, arg_vars, arg_help,
+                sizeof(args)/sizeof(const char*), NULL, NULL, NULL, 0);
+
+    size_t recorded_size = 0;
+    if (trace_path.empty()) {
+        if (seed == 0) {
+            seed = std::chrono::system_clock::now().time_since_epoch().count();
+        }
+        std::cout << "seed = " << seed << std::endl;
+        recorded_size = record_trace();
+        trace_path = recorded_path;
+    }
+
+    const std::vector<ThreadTrace> traces = read_trace(trace_path);
+    ReplayTable table(1U << power);
+    replay(table, traces);
+
+    if (trace_path == recorded_path) {
+        EXPECT_EQ(table.size(), recorded_size);
+        remove(recorded_path);
+    }
+}
@@ -0,0 +1,397 @@
+// A YCSB-style benchmark that runs a configurable mix of operations on a
+// prefilled table, choosing keys with a uniform, Zipfian, or latest
+// distribution, and reports the throughput and latency of each operation type.
+// The --workload-a through --workload-f flags mirror the core YCSB workloads.
+// Since the table has no order, the scans of workload E are emulated by
+// finding a run of consecutive records.
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include <libcuckoo/cuckoohash_map.hh>
+#include "test_util.cc"
+
+typedef uint64_t KeyType;
+typedef std::string KeyType2;
+typedef uint64_t ValType;
+
+// The number of records to load before running operations, expressed as a
+// power of 2. This can be set with the command line flag --power
+size_t power = 18;
+// The number of operations each thread runs. This can be set with the command
+// line flag --ops-per-thread
+size_t ops_per_thread = 1U << 18;
+// The number of threads running operations. This can be set with the command
+// line flag --thread-num
+size_t thread_num = sysconf(_SC_NPROCESSORS_ONLN);
+// The percentage of each type of operation. These can be set with the command
+// line flags --read, --update, --insert, --upsert, --rmw, --erase and --scan,
+// and are overridden by the workload flags.
+size_t read_pct = 0;
+size_t update_pct = 0;
+size_t insert_pct = 0;
+size_t upsert_pct = 0;
+size_t rmw_pct = 0;
+size_t erase_pct = 0;
+size_t scan_pct = 0;
+// The maximum number of records a scan finds. This can be set with the command
+// line flag --scan-length
+size_t scan_length = 100;
+// The seed which the random number generator uses. This can be set with the
+// command line flag --seed
+size_t seed = 0;
+// The YCSB workload presets
+bool workload_a = false;
+bool workload_b = false;
+bool workload_c = false;
+bool workload_d = false;
+bool workload_e = false;
+bool workload_f = false;
+// The key distribution. By default keys are chosen with a Zipfian
+// distribution, scrambled so that the popular keys are spread out.
+bool use_uniform = false;
+bool use_latest = false;
+// The key type. By default keys are integers.
+bool use_fixed_strings = false;
+bool use_variable_strings = false;
+// Whether to count hardware events during the measured operations
+bool use_perf = false;
+
+enum OpType { READ, UPDATE, INSERT, UPSERT, RMW, ERASE, SCAN, NUM_OPS };
+const char* op_names[] = {"Read", "Update", "Insert", "Upsert",
+                          "Read-modify-write", "Erase", "Scan"};
+size_t* op_pcts[] = {&read_pct, &update_pct, &insert_pct, &upsert_pct,
+                     &rmw_pct, &erase_pct, &scan_pct};
+
+// The 64-bit FNV-1a hash of an integer, used to scramble record numbers
+inline uint64_t fnv_hash64(uint64_t v) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < 8; i++) {
+        h ^= v & 0xff;
+        h *= 0x100000001b3ULL;
+        v >>= 8;
+    }
+    return h;
+}
+
+// ZipfianGenerator picks integers in [0, n) such that the probability of
+// picking i is proportional to 1/(i+1)^theta, using the method from Gray et
+// al., "Quickly Generating Billion-Record Synthetic Databases", as YCSB does.
+class ZipfianGenerator {
+public:
+    ZipfianGenerator(size_t n, double theta = 0.99)
+        : n_(n), theta_(theta), zetan_(zeta(n, theta)),
+          alpha_(1.0 / (1.0 - theta)),
+          eta_((1.0 - std::pow(2.0 / n, 1.0 - theta)) /
+               (1.0 - zeta(2, theta) / zetan_)) {}
+
+    template <class Gen>
+    size_t operator()(Gen& gen) {
+        const double u = std::uniform_real_distribution<double>(0, 1)(gen);
+        const double uz = u * zetan_;
+        if (uz < 1.0) {
+            return 0;
+        } else if (uz < 1.0 + std::pow(0.5, theta_)) {
+            return 1;
+        }
+        return std::min(
+            n_ - 1,
+            static_cast<size_t>(n_ * std::pow(eta_ * u - eta_ + 1, alpha_)));
+    }
+
+private:
+    static double zeta(size_t n, double theta) {
+        double sum = 0;
+        for (size_t i = 1; i <= n; i++) {
+            sum += 1.0 / std::pow(i, theta);
+        }
+        return sum;
+    }
+
+    size_t n_;
+    double theta_;
+    double zetan_;
+    double alpha_;
+    double eta_;
+};
+
+// make_key converts a record number into a key of the given type
+template <class K>
+K make_key(size_t i);
+
+template <>
+KeyType make_key<KeyType>(size_t i) {
+    return i;
+}
+
+// String keys are "user" followed by the record number padded to 20 digits.
+// Variable-length keys are padded with between 0 and 99 more characters,
+// depending on the record number.
+template <>
+KeyType2 make_key<KeyType2>(size_t i) {
+    std::string num = std::to_string(i);
+    std::string key = "user" + std::string(20 - num.size(), '0') + num;
+    if (use_variable_strings) {
+        key.append(fnv_hash64(i) % 100, 'x');
+    }
+    return key;
+}
+
+template <class T>
+class YCSBEnvironment {
+    typedef typename T::key_type KType;
+public:
+    YCSBEnvironment()
+        : record_count(1U << power), table(record_count),
+          next_record(record_count), zipf(record_count) {
+        if (seed == 0) {
+            seed = std::chrono::system_clock::now().time_since_epoch().count();
+        }
+        std::cout << "seed = " << seed << std::endl;
+
+        // Loads the initial records with thread_num threads
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < thread_num; t++) {
+            threads.emplace_back([this, t]() {
+                    for (size_t i = t; i < record_count; i += thread_num) {
+                        ASSERT_TRUE(table.insert(make_key<KType>(i), i));
+                    }
+                });
+        }
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+        std::cout << "Table loaded with " << table.size() << " records"
+                  << std::endl;
+    }
+
+    // next_key picks the record number of an existing record to operate on
+    template <class Gen>
+    size_t next_key(Gen& gen) {
+        const size_t count = next_record.load(std::memory_order_relaxed);
+        if (use_latest) {
+            return count - 1 - std::min(zipf(gen), count - 1);
+        } else if (use_uniform) {
+            return gen() % count;
+        }
+        return fnv_hash64(zipf(gen)) % record_count;
+    }
+
+    size_t record_count;
+    T table;
+    // the record number the next insert will use
+    std::atomic<size_t> next_record;
+    ZipfianGenerator zipf;
+};
+
+template <class T>
+void ycsb_thread(YCSBEnvironment<T>& env, size_t thread_seed,
+                 std::vector<LatencyHistogram>& latencies) {
+    typedef std::chrono::steady_clock clock_type;
+    std::mt19937_64 gen(thread_seed);
+    ValType v;
+    for (size_t n = 0; n < ops_per_thread; n++) {
+        size_t op = 0;
+        size_t r = gen() % 100;
+        while (r >= *op_pcts[op]) {
+            r -= *op_pcts[op];
+            ++op;
+        }
+        const size_t record = (op == INSERT) ?
+            env.next_record.fetch_add(1) : env.next_key(gen);
+        const typename T::key_type key = make_key<typename T::key_type>(record);
+        const clock_type::time_point start = clock_type::now();
+        switch (op) {
+        case READ:
+            env.table.find(key, v);
+            break;
+        case UPDATE:
+            env.table.update(key, n);
+            break;
+        case INSERT:
+            env.table.insert(key, n);
+            break;
+        case UPSERT:
+            env.table.upsert(key, [](const ValType& val) {
+                    return val + 1;
+                }, n);
+            break;
+        case RMW:
+            env.table.update_fn(key, [](const ValType& val) {
+                    return val + 1;
+                });
+            break;
+        case ERASE:
+            env.table.erase(key);
+            break;
+        case SCAN:
+            for (size_t i = 0, len = gen() % scan_length + 1; i < len; i++) {
+                env.table.find(
+                    make_key<typename T::key_type>(record + i), v);
+            }
+            break;
+        }
+        latencies[op].record(std::chrono::duration_cast<
+                             std::chrono::nanoseconds>(
+                                 clock_type::now() - start).count());
+    }
+}
+
+template <class T>
+void YCSBTest(YCSBEnvironment<T> *env) {
+    std::vector<std::thread> threads;
+    std::vector<std::vector<LatencyHistogram> > latencies(
+        thread_num, std::vector<LatencyHistogram>(NUM_OPS));
+    PerfCounters perf(use_perf);
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    perf.start();
+    for (size_t i = 0; i < thread_num; i++) {
+        threads.emplace_back(ycsb_thread<T>, std::ref(*env), seed + i,
+                             std::ref(latencies[i]));
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    perf.stop();
+    const double elapsed_time = std::chrono::duration_cast<
+        std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count() / 1e9;
+    // Reports the results
+    std::cout << "----------Results----------" << std::endl;
+    std::cout << "Number of operations:\t" << ops_per_thread * thread_num
+              << std::endl;
+    std::cout << "Time elapsed:\t" << elapsed_time << " seconds" << std::endl;
+    std::cout << "Throughput: " << std::fixed
+              << ops_per_thread * thread_num / elapsed_time << " ops/sec"
+              << std::endl;
+    for (size_t op = 0; op < NUM_OPS; op++) {
+        for (size_t i = 1; i < thread_num; i++) {
+            latencies[0][op].merge(latencies[i][op]);
+        }
+        if (latencies[0][op].count() > 0) {
+            std::cout << op_names[op] << " throughput: "
+                      << latencies[0][op].count() / elapsed_time << " ops/sec"
+                      << std::endl;
+            latencies[0][op].report(std::cout, op_names[op]);
+        }
+    }
+    if (use_perf) {
+        perf.report(std::cout, ops_per_thread * thread_num);
+    }
+}
+
+// Sets the operation mix to the one of the selected YCSB workload, defaulting
+// to workload A if neither a workload nor a mix was given
+void set_workload() {
+    const size_t total = read_pct + update_pct + insert_pct + upsert_pct +
+        rmw_pct + erase_pct + scan_pct;
+    const bool any_workload = workload_a || workload_b || workload_c ||
+        workload_d || workload_e || workload_f;
+    if (any_workload || total == 0) {
+        for (size_t op = 0; op < NUM_OPS; op++) {
+            *op_pcts[op] = 0;
+        }
+    }
+    if (workload_b) {
+        read_pct = 95;
+        update_pct = 5;
+    } else if (workload_c) {
+        read_pct = 100;
+    } else if (workload_d) {
+        read_pct = 95;
+        insert_pct = 5;
+        use_latest = true;
+    } else if (workload_e) {
+        scan_pct = 95;
+        insert_pct = 5;
+    } else if (workload_f) {
+        read_pct = 50;
+        rmw_pct = 50;
+    } else if (workload_a || total == 0) {
+        read_pct = 50;
+        update_pct = 50;
+    } else if (total != 100) {
+        std::cerr << "The operation percentages must add up to 100"
+                  << std::endl;
+        exit(1);
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* args[] = {"--power", "--ops-per-thread", "--thread-num",
+                          "--read", "--update", "--insert", "--upsert",
+                          "--rmw", "--erase", "--scan", "--scan-length",
+                          "--seed"};
+    size_t* arg_vars[] = {&power, &ops_per_thread, &thread_num, &read_pct,
+                          &update_pct, &insert_pct, &upsert_pct, &rmw_pct,
+                          &erase_pct, &scan_pct, &scan_length, &seed};
+    const char* arg_help[] = {
+        "The number of records to load, expressed as a power of 2",
+        "The number of operations each thread runs",
+        "The number of threads to spawn",
+        "The percentage of operations that are finds",
+        "The percentage of operations that are updates",
+        "The percentage of operations that insert a new record",
+        "The percentage of operations that are upserts",
+        "The percentage of operations that are read-modify-writes",
+        "The percentage of operations that are erases",
+        "The percentage of operations that are scans",
+        "The maximum number of records a scan finds",
+        "The seed used by the random number generator"
+    };
+    const char* flags[] = {"--workload-a", "--workload-b", "--workload-c",
+                           "--workload-d", "--workload-e", "--workload-f",
+                           "--uniform", "--latest", "--fixed-strings",
+                           "--variable-strings", "--perf"};
+    bool* flag_vars[] = {&workload_a, &workload_b, &workload_c, &workload_d,
+                         &workload_e, &workload_f, &use_uniform, &use_latest,
+                         &use_fixed_strings, &use_variable_strings,
+                         &use_perf};
+    const char* flag_help[] = {
+        "YCSB workload A: 50% reads and 50% updates",
+        "YCSB workload B: 95% reads and 5% updates",
+        "YCSB workload C: 100% reads",
+        "YCSB workload D: 95% reads and 5% inserts, reading the latest records",
+        "YCSB workload E: 95% scans and 5% inserts",
+        "YCSB workload F: 50% reads and 50% read-modify-writes",
+        "If set, keys are chosen uniformly",
+        "If set, the most recently inserted keys are the most popular",
+        "If set, keys are 24-character strings",
+        "If set, keys are strings of 24 to 123 characters",
+        "If set, hardware performance counters are reported for the "
+        "measured operations"
+    };
+    parse_flags(argc, argv, "A YCSB-style benchmark", args, arg_vars, arg_help,
+                sizeof(args)/sizeof(const char*), flags, flag_vars, flag_help,
+                sizeof(flags)/sizeof(const char*));
+    set_workload();
+    if (scan_length == 0) {
+        std::cerr << "--scan-length must be positive" << std::endl;
+        exit(1);
+    }
+
+    if (use_fixed_strings || use_variable_strings) {
+        auto *env = new YCSBEnvironment<cuckoohash_map<KeyType2, ValType>>;
+        YCSBTest(env);
+        delete env;
+    } else {
+        auto *env = new YCSBEnvironment<cuckoohash_map<KeyType, ValType>>;
+        YCSBTest(env);
+        delete env;
+    }
+}